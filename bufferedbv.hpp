@@ -12,11 +12,43 @@
 #include <cassert>
 #include <cstdint>
 #include <iostream>
+#include <type_traits>
 #include <vector>
 
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+#include "bv_stats.hpp"
+
 namespace dyn {
-template <uint8_t buffer_size>
+/*
+ * Buffered bit vector leaf.
+ *
+ * max_size is an upper bound on the number of bits the leaf will ever hold,
+ * or 0 for no bound. With a bound below 2^14 buffer entries are 16 bits
+ * (14-bit index, type and value) instead of 32 bits, and size and psum
+ * counters are 16 or 32 bits instead of 64 when the bound allows it. When
+ * used in a tree the bound needs to cover the largest leaf before a split.
+ * Growing a leaf past the bound aborts.
+ */
+template <uint8_t buffer_size, uint32_t max_size = 0>
 class buffered_packed_vector {
+    typedef typename std::conditional<(max_size != 0 && max_size < (1 << 14)),
+                                      uint16_t, uint32_t>::type buffer_type;
+    typedef typename std::conditional<
+        (max_size != 0 && max_size < (1 << 16)), uint16_t,
+        typename std::conditional<max_size != 0, uint32_t,
+                                  uint64_t>::type>::type count_type;
+
+    static_assert(buffer_size >= 1 && buffer_size <= 64,
+                  "Buffer size needs to be between 1 and 64");
+    static_assert(max_size <= (uint32_t(1) << 30),
+                  "Buffer entries hold at most 30-bit indexes");
+
+    // Reads the internals in the tests, see tests/commit_reference.hpp
+    friend struct bv_test_access;
+
    public:
     static uint64_t fast_mod(uint64_t const num) { return num & 63; }
 
@@ -25,13 +57,15 @@ class buffered_packed_vector {
     static uint64_t fast_mul(uint64_t const num) { return num << 6; }
 
     explicit buffered_packed_vector(uint64_t const size = 0) {
-        assert(buffer_size >= 1 && buffer_size <= 64);
         std::fill(buffer, buffer + buffer_size, 0);
         buffer_count = 0;
         this->size_ = size;
+        this->phys_size_ = size;
         this->psum_ = 0;
 
         words = std::vector<uint64_t>(fast_div(size_) + (fast_mod(size_) != 0));
+        BV_STAT(bv_stats::leaves++);
+        BV_STAT(bv_stats::resized(0, words.capacity()));
         assert(size_ / int_per_word_ <= words.size());
         assert((size_ / int_per_word_ == words.size() ||
                 !(words[size_ / int_per_word_] >>
@@ -41,14 +75,15 @@ class buffered_packed_vector {
 
     explicit buffered_packed_vector(std::vector<uint64_t>&& _words,
                                     uint64_t const new_size) {
-        assert(buffer_size > 1 && buffer_size <= 64);
-
         std::fill(buffer, buffer + buffer_size, 0);
         buffer_count = 0;
 
         this->words = std::move(_words);
         this->size_ = new_size;
+        this->phys_size_ = new_size;
         this->psum_ = psum(size_ - 1);
+        BV_STAT(bv_stats::leaves++);
+        BV_STAT(bv_stats::resized(0, words.capacity()));
 
         assert(size_ / int_per_word_ <= words.size());
         assert((size_ / int_per_word_ == words.size() ||
@@ -57,7 +92,78 @@ class buffered_packed_vector {
                "uninitialized non-zero values in the end of the vector");
     }
 
-    ~buffered_packed_vector() = default;
+    /*
+     * bulk construction from words whose number of ones is already known
+     */
+    buffered_packed_vector(std::vector<uint64_t>&& _words,
+                           uint64_t const new_size, uint64_t const ones) {
+        std::fill(buffer, buffer + buffer_size, 0);
+        buffer_count = 0;
+
+        this->words = std::move(_words);
+        this->size_ = new_size;
+        this->phys_size_ = new_size;
+        this->psum_ = ones;
+        BV_STAT(bv_stats::leaves++);
+        BV_STAT(bv_stats::resized(0, words.capacity()));
+
+        assert(max_size == 0 || size_ < max_size);
+        assert(size_ / int_per_word_ <= words.size());
+        assert(ones == rank(size_));
+    }
+
+    /*
+     * Copies and moves are dirty, they are new leaves to a checkpoint. A
+     * moved from leaf is left empty.
+     */
+    buffered_packed_vector(const buffered_packed_vector& other)
+        : words(other.words),
+          psum_(other.psum_),
+          size_(other.size_),
+          phys_size_(other.phys_size_),
+          buffer_count(other.buffer_count),
+          dirty_(true) {
+        std::copy(other.buffer, other.buffer + buffer_size, buffer);
+        BV_STAT(bv_stats::leaves++);
+        BV_STAT(bv_stats::resized(0, words.capacity()));
+    }
+
+    buffered_packed_vector(buffered_packed_vector&& other) noexcept
+        : words(std::move(other.words)),
+          psum_(other.psum_),
+          size_(other.size_),
+          phys_size_(other.phys_size_),
+          buffer_count(other.buffer_count),
+          dirty_(true) {
+        std::copy(other.buffer, other.buffer + buffer_size, buffer);
+        other.clear_moved();
+        BV_STAT(bv_stats::leaves++);
+        BV_STAT(bv_stats::resized(0, words.capacity()));
+    }
+
+    buffered_packed_vector& operator=(const buffered_packed_vector& other) {
+        if (this == &other) return *this;
+        BV_STAT(uint64_t old_capacity = words.capacity());
+        words = other.words;
+        assign_counts(other);
+        BV_STAT(bv_stats::resized(old_capacity, words.capacity()));
+        return *this;
+    }
+
+    buffered_packed_vector& operator=(buffered_packed_vector&& other) noexcept {
+        if (this == &other) return *this;
+        BV_STAT(uint64_t old_capacity = words.capacity());
+        words = std::move(other.words);
+        assign_counts(other);
+        other.clear_moved();
+        BV_STAT(bv_stats::resized(old_capacity, words.capacity()));
+        return *this;
+    }
+
+    ~buffered_packed_vector() {
+        BV_STAT(bv_stats::leaves--);
+        BV_STAT(bv_stats::resized(words.capacity(), 0));
+    }
 
     void print() const {
         std::cout << "Leaf: " << size_ << " elems and " << psum_ << " ones";
@@ -110,46 +216,8 @@ class buffered_packed_vector {
      */
     uint64_t search(uint64_t x) const {
         assert(size_ > 0);
-        assert(x <= psum_);
-
-        uint64_t pop = 0;
-        uint64_t pos = 0;
-        uint8_t current_buffer = 0;
-        int8_t a_pos_offset = 0;
-
-        // optimization for bitvectors
-
-        for (uint64_t j = 0; j < words.size(); ++j) {
-            pop += __builtin_popcountll(words[j]);
-            pos += 64;
-            for (uint8_t b = current_buffer; b < buffer_count; b++) {
-                uint32_t b_index = buffer_index(buffer[b]);
-                if (b_index < pos) {
-                    if (buffer_is_insertion(buffer[b])) {
-                        pop += buffer_value(buffer[b]);
-                        pos++;
-                        a_pos_offset--;
-                    } else {
-                        pop -= (words[fast_div(b_index + a_pos_offset)] &
-                                (MASK << fast_mod(b_index + a_pos_offset)))
-                                   ? 1
-                                   : 0;
-                        pos--;
-                        a_pos_offset++;
-                    }
-                    current_buffer++;
-                } else {
-                    break;
-                }
-            }
-            if (pop >= x) break;
-        }
-        pos = size_ < pos ? size_ : pos;
-        // end optimization for bitvectors
-        while (pop >= x) {
-            pop -= at(--pos);
-        }
-        return pos;
+        assert(x > 0 && x <= psum_);
+        return select_bit<true>(x);
     }
 
     /*
@@ -159,51 +227,10 @@ class buffered_packed_vector {
      * i (included) is == x
      */
     uint64_t search_0(uint64_t x) const {
-        // TODO: TESTS
         assert(size_ > 0);
         assert(width_ == 1);
-        assert(x <= size_ - psum_);
-
-        uint64_t s = 0;
-        uint64_t pop = 0;
-        uint64_t pos = 0;
-        uint8_t current_buffer = 0;
-        int8_t a_pos_offset = 0;
-
-        auto div = fast_div(size_);
-        for (uint64_t j = 0; j < div && s < x; ++j) {
-            pop = 64 - __builtin_popcountll(words[j]);
-            pos += 64;
-            s += pop;
-            for (uint8_t b = current_buffer; b < buffer_count; b++) {
-                uint32_t b_index = buffer_index(buffer[b]);
-                if (b_index < pos) {
-                    if (buffer_is_insertion(buffer[b])) {
-                        pop += buffer_value(buffer[b]) ? 0 : 1;
-                        pos++;
-                        a_pos_offset--;
-                    } else {
-                        pop -= (words[fast_div(b_index + a_pos_offset)] &
-                                (MASK << fast_mod(b_index + a_pos_offset)))
-                                   ? 0
-                                   : 1;
-                        pos--;
-                        a_pos_offset++;
-                    }
-                    current_buffer++;
-                } else {
-                    break;
-                }
-            }
-            if (pop >= x) break;
-        }
-
-        pos = size_ < pos ? size_ : pos;
-
-        while (pop >= x) {
-            pop -= at(--pos) ? 0 : 1;
-        }
-        return pos;
+        assert(x > 0 && x <= uint64_t(size_ - psum_));
+        return select_bit<false>(x);
     }
 
     /*
@@ -270,6 +297,7 @@ class buffered_packed_vector {
 
     void increment(uint64_t i, bool delta, bool subtract = false) {
         assert(i < size_);
+        dirty_ = true;
 
         auto pvi = at(i);
 
@@ -287,6 +315,8 @@ class buffered_packed_vector {
 
     void remove(uint64_t i) {
         assert(i < size_);
+        BV_STAT(bv_stats::removes++);
+        dirty_ = true;
         auto x = this->at(i);
         psum_ -= x;
         --size_;
@@ -295,6 +325,7 @@ class buffered_packed_vector {
             uint32_t b = buffer_index(buffer[idx]);
             if (b == i && buffer_is_insertion(buffer[idx]) && !done) {
                 delete_buffer_element(idx--);
+                BV_STAT(bv_stats::remove_cancels++);
                 done = true;
                 continue;
             }
@@ -311,6 +342,7 @@ class buffered_packed_vector {
             buffer[buffer_count] = create_buffer(i, 0, x);
             buffer_count++;
         }
+        BV_STAT(bv_stats::occupancy[buffer_count]++);
         if (buffer_count == buffer_size) commit();
     }
 
@@ -319,6 +351,9 @@ class buffered_packed_vector {
             push_back(x);
             return;
         }
+        BV_STAT(bv_stats::inserts++);
+        check_room(1);
+        dirty_ = true;
         psum_ += x ? 1 : 0;
         bool done = false;
         int a_pos = 0;
@@ -334,6 +369,7 @@ class buffered_packed_vector {
                                 ? true
                                 : false)) {
                 delete_buffer_element(idx--);
+                BV_STAT(bv_stats::insert_cancels++);
                 done = true;
                 a_pos += b;
                 const auto word_nr = fast_div(a_pos);
@@ -356,6 +392,7 @@ class buffered_packed_vector {
             buffer[buffer_count] = create_buffer(i, 1, x);
             buffer_count++;
         }
+        BV_STAT(bv_stats::occupancy[buffer_count]++);
         if (buffer_count == buffer_size) commit();
     }
 
@@ -365,17 +402,21 @@ class buffered_packed_vector {
      * width causes a rebuild of the whole vector!
      */
     void push_back(uint64_t x) {
-        auto pb_size = size_;
-        for (uint8_t i = 0; i < buffer_count; i++) {
-            pb_size += buffer_is_insertion(buffer[i]) ? -1 : 1;
-        }
+        check_room(1);
+        dirty_ = true;
+        uint64_t pb_size = phys_size_;
         size_++;
+        phys_size_++;
         assert(int_per_word_ == 64);
         assert(pb_size <= words.size() * 64);
 
         // not enough space for the new element:
         // push back a new word
-        if (fast_div(pb_size) == words.size()) words.push_back(0);
+        if (fast_div(pb_size) == words.size()) {
+            BV_STAT(uint64_t old_capacity = words.capacity());
+            words.push_back(0);
+            BV_STAT(bv_stats::resized(old_capacity, words.capacity()));
+        }
 
         if (x) {
             // insert x at the last position
@@ -383,7 +424,37 @@ class buffered_packed_vector {
             psum_++;
         }
 
-        assert((((size_ << 1) - pb_size) >> 6) <= words.size());
+        assert(pb_size < fast_mul(words.size()));
+    }
+
+    /*
+     * appends n bits read from in starting at bit in_pos, a word at a time
+     */
+    void append_bits(const uint64_t* in, uint64_t in_pos, uint64_t n) {
+        check_room(n);
+        dirty_ = true;
+        uint64_t end = phys_size_ + n;
+        uint64_t needed = fast_div(end) + (fast_mod(end) != 0);
+        if (needed > words.size()) {
+            BV_STAT(uint64_t old_capacity = words.capacity());
+            words.resize(needed, 0);
+            BV_STAT(bv_stats::resized(old_capacity, words.capacity()));
+        }
+        uint64_t ones = 0;
+        for (uint64_t k = 0; k < n; k += 64) {
+            uint64_t len = n - k < 64 ? n - k : 64;
+            uint64_t p = in_pos + k;
+            uint64_t v = in[fast_div(p)] >> fast_mod(p);
+            if (fast_mod(p) && fast_mod(p) + len > 64) {
+                v |= in[fast_div(p) + 1] << (64 - fast_mod(p));
+            }
+            if (len < 64) v &= (MASK << len) - 1;
+            write_bits(words.data(), phys_size_ + k, v, len);
+            ones += __builtin_popcountll(v);
+        }
+        size_ += n;
+        phys_size_ += n;
+        psum_ += ones;
     }
 
     uint64_t size() const { return size_; }
@@ -391,54 +462,123 @@ class buffered_packed_vector {
     /*
      * split content of this vector into 2 packed blocks:
      * Left part remains in this block, right part in the
-     * new returned block
+     * new returned block. The right block can be created as a type derived
+     * from this one, which needs to have the (words, size, ones)
+     * constructor.
+     *
+     * The buffered edits are divided between the halves instead of being
+     * committed. The right half of the words is copied once, into storage
+     * of its final size, and its ones are counted during the copy. The
+     * ones of the left half follow from psum_.
      */
-    buffered_packed_vector* split() {
-        if (buffer_count > 0) {
-            commit();
-        }
+    template <class R = buffered_packed_vector>
+    R* split() {
+        BV_STAT(bv_stats::splits++);
+        BV_STAT(auto trace_start = bv_stats::now());
+        BV_STAT(uint8_t trace_buffer = buffer_count);
+        BV_STAT(uint64_t trace_size = size_);
+        dirty_ = true;
 
         uint64_t tot_words = fast_div(size_) + (fast_mod(size_) != 0);
+        uint64_t nr_left_ints = fast_mul(tot_words >> 1);
 
-        assert(tot_words <= words.size());
-
-        uint64_t nr_left_words = tot_words >> 1;
-
-        assert(nr_left_words > 0);
-        assert(tot_words - nr_left_words > 0);
+        assert(nr_left_ints > 0);
+        assert(size_ > nr_left_ints);
 
-        uint64_t nr_left_ints = fast_mul(nr_left_words);
+        // Edits before nr_left_ints stay in this block, find the physical
+        // position of the split
+        uint8_t nr_left_edits = 0;
+        uint64_t l = 0;
+        uint64_t p = 0;
+        for (; nr_left_edits < buffer_count; nr_left_edits++) {
+            uint64_t b = buffer_index(buffer[nr_left_edits]);
+            if (b >= nr_left_ints) break;
+            p += b - l;
+            l = b;
+            if (buffer_is_insertion(buffer[nr_left_edits])) {
+                l++;
+            } else {
+                p++;
+            }
+        }
+        p += nr_left_ints - l;
+
+        uint64_t nr_right_phys = phys_size_ - p;
+        uint64_t nr_right_words =
+            fast_div(nr_right_phys) + (fast_mod(nr_right_phys) != 0);
+        std::vector<uint64_t> right_words(nr_right_words + extra_, 0);
+        uint64_t right_ones = 0;
+        // Whole words with a funnel shift, the last one may be partial
+        const uint64_t* in = words.data() + fast_div(p);
+        uint64_t o = fast_mod(p);
+        uint64_t k = 0;
+        uint64_t nr_whole = nr_right_words ? nr_right_words - 1 : 0;
+        if (o) {
+            for (; k < nr_whole; k++) {
+                uint64_t w = (in[k] >> o) | (in[k + 1] << (64 - o));
+                right_ones += __builtin_popcountll(w);
+                right_words[k] = w;
+            }
+        } else {
+            for (; k < nr_whole; k++) {
+                right_ones += __builtin_popcountll(in[k]);
+                right_words[k] = in[k];
+            }
+        }
+        if (k < nr_right_words) {
+            uint64_t n = nr_right_phys - fast_mul(k);
+            uint64_t w = physical_bits(p + fast_mul(k), n);
+            right_ones += __builtin_popcountll(w);
+            right_words[k] = w;
+        }
 
-        assert(size_ > nr_left_ints);
-        uint64_t nr_right_ints = size_ - nr_left_ints;
-
-        assert(words.begin() + nr_left_words + extra_ < words.end());
-        assert(words.begin() + tot_words <= words.end());
-        std::vector<uint64_t> right_words(tot_words - nr_left_words + extra_,
-                                          0);
-        std::copy(words.begin() + nr_left_words, words.begin() + tot_words,
-                  right_words.begin());
-        words.resize(nr_left_words + extra_);
+        // Clear the moved bits and trim the words to the left half. Leaving
+        // the storage of the whole leaf to the left half would not need an
+        // allocation but leaves a third of the words unused on average.
+        uint64_t nr_left_words = fast_div(p) + (fast_mod(p) != 0);
+        if (fast_mod(p)) words[fast_div(p)] &= (MASK << fast_mod(p)) - 1;
+        BV_STAT(uint64_t old_capacity = words.capacity());
+        words.resize(nr_left_words + extra_, 0);
         std::fill(words.begin() + nr_left_words, words.end(), 0);
         words.shrink_to_fit();
+        BV_STAT(bv_stats::resized(old_capacity, words.capacity()));
+
+        auto right = new R(std::move(right_words), nr_right_phys, right_ones);
+        buffered_packed_vector* r = right;
+        uint64_t right_psum = right_ones;
+        for (uint8_t idx = nr_left_edits; idx < buffer_count; idx++) {
+            buffer_type e = buffer[idx];
+            if (buffer_is_insertion(e)) {
+                right_psum += buffer_value(e);
+            } else {
+                right_psum -= buffer_value(e);
+            }
+            r->buffer[r->buffer_count] = e;
+            r->set_buffer_index(buffer_index(e) - nr_left_ints,
+                                r->buffer_count++);
+            buffer[idx] = 0;
+        }
+        r->size_ = size_ - nr_left_ints;
+        r->psum_ = right_psum;
 
+        buffer_count = nr_left_edits;
         size_ = nr_left_ints;
-        psum_ = psum(size_ - 1);
+        phys_size_ = p;
+        psum_ -= right_psum;
 
-        auto right =
-            new buffered_packed_vector(std::move(right_words), nr_right_ints);
-
-        assert(size_ / int_per_word_ <= words.size());
-        assert((size_ / int_per_word_ == words.size() ||
-                !(words[size_ / int_per_word_] >>
-                  ((size_ % int_per_word_) * width_))) &&
-               "uninitialized non-zero values in the end of the vector");
+        assert(phys_size_ <= fast_mul(words.size()));
+        assert(psum_ == rank(size_));
+        assert(r->psum_ == r->rank(r->size_));
 
+        BV_STAT(bv_stats::record("split", trace_start, trace_size,
+                                 trace_buffer));
         return right;
     }
 
     /* set i-th element to x. updates psum */
     void set(const uint64_t i, const bool x) {
+        BV_STAT(bv_stats::sets++);
+        dirty_ = true;
         uint64_t idx = i;
         for (uint8_t j = 0; j < buffer_count; j++) {
             uint32_t b = buffer_index(buffer[j]);
@@ -467,15 +607,43 @@ class buffered_packed_vector {
     }
 
     /*
-     * return total number of bits occupied in memory by this object instance
+     * breakdown of the bits of memory used by a leaf
+     */
+    struct space {
+        uint64_t payload;    // bits stored in words
+        uint64_t slack;      // unused bits of allocated words
+        uint64_t buffer;     // buffer entries and buffer_count
+        uint64_t header;     // words, psum_, size_, phys_size_, padding
+        uint64_t allocator;  // estimated malloc chunk overhead
+
+        uint64_t total() const {
+            return payload + slack + buffer + header + allocator;
+        }
+    };
+
+    /*
+     * Assumes that the leaf itself was allocated with new, as it is in the
+     * tree.
      */
-    uint64_t bit_size() const {
-        return (sizeof(buffered_packed_vector) +
-                words.capacity() * sizeof(uint64_t) +
-                sizeof(buffer) * sizeof(uint32_t) + 1) *
-               8;
+    space space_usage() const {
+        uint64_t pb_size = phys_size_;
+        uint64_t capacity = words.capacity() * sizeof(uint64_t);
+        space s;
+        s.payload = pb_size;
+        s.slack = capacity * 8 - pb_size;
+        s.buffer = (sizeof(buffer) + sizeof(buffer_count)) * 8;
+        s.header = sizeof(buffered_packed_vector) * 8 - s.buffer;
+        s.allocator = (malloc_overhead(sizeof(buffered_packed_vector)) +
+                       (capacity ? malloc_overhead(capacity) : 0)) *
+                      8;
+        return s;
     }
 
+    /*
+     * return total number of bits occupied in memory by this object instance
+     */
+    uint64_t bit_size() const { return space_usage().total(); }
+
     uint64_t width() const { return width_; }
 
     void insert_word(uint64_t i, uint64_t word, uint8_t width, uint8_t n) {
@@ -487,6 +655,8 @@ class buffered_packed_vector {
         assert(width * n == 64 || (word >> width * n) == 0);
 
         if (buffer_count > 0) commit();
+        dirty_ = true;
+        BV_STAT(uint64_t old_capacity = words.capacity());
 
         if (n == 1) {
             // only one integer to insert
@@ -512,7 +682,9 @@ class buffered_packed_vector {
             }
 
             size_ += n;
+            phys_size_ = size_;
             psum_ += __builtin_popcountll(word);
+            BV_STAT(bv_stats::resized(old_capacity, words.capacity()));
 
         } else {
             const uint64_t mask = (1llu << width) - 1;
@@ -543,30 +715,570 @@ class buffered_packed_vector {
         for (size_t i = 0; i < target_word; i++) {
             count += __builtin_popcountll(words[i]);
         }
-        count += __builtin_popcountll(words[target_word] &
-                                      ((MASK << target_offset) - 1));
+        if (target_offset) {
+            count += __builtin_popcountll(words[target_word] &
+                                          ((MASK << target_offset) - 1));
+        }
         return count;
     }
 
     uint64_t select(uint64_t n) { return search(n + 1); }
 
+    /*
+     * n <= 64 bits starting from i, with bit i in the least significant
+     * position
+     */
+    uint64_t get_bits(uint64_t i, uint8_t n) const {
+        assert(n <= 64);
+        assert(i + n <= size_);
+        // extract may write the word after the last bit it copies
+        uint64_t w[2] = {0, 0};
+        extract(i, i + n, w);
+        return w[0];
+    }
+
+    /*
+     * copy bits [i, j) to out, starting from bit offset of out. Other bits of
+     * out are left untouched.
+     */
+    void extract(uint64_t i, uint64_t j, uint64_t* out,
+                 uint64_t offset = 0) const {
+        assert(i <= j && j <= size_);
+        merged_segments(
+            i, j,
+            [&](uint64_t pos, uint64_t p, uint64_t len) {
+                pos += offset;
+                while (len > 0) {
+                    uint64_t n = len < 64 ? len : 64;
+                    write_bits(out, pos, physical_bits(p, n), n);
+                    pos += n;
+                    p += n;
+                    len -= n;
+                }
+            },
+            [&](uint64_t pos, bool v) {
+                pos += offset;
+                out[fast_div(pos)] = (out[fast_div(pos)] &
+                                      ~(MASK << fast_mod(pos))) |
+                                     (uint64_t(v) << fast_mod(pos));
+            });
+    }
+
+    /*
+     * number of ones in [i, j)
+     */
+    uint64_t count_ones(uint64_t i, uint64_t j) const {
+        assert(i <= j && j <= size_);
+        uint64_t count = 0;
+        merged_segments(
+            i, j,
+            [&](uint64_t, uint64_t p, uint64_t len) {
+                uint64_t w = fast_div(p);
+                uint64_t o = fast_mod(p);
+                if (o) {
+                    uint64_t n = 64 - o < len ? 64 - o : len;
+                    count += __builtin_popcountll(physical_bits(p, n));
+                    len -= n;
+                    w++;
+                }
+                for (; len >= 64; len -= 64) {
+                    count += __builtin_popcountll(words[w++]);
+                }
+                if (len) {
+                    count += __builtin_popcountll(words[w] &
+                                                  ((MASK << len) - 1));
+                }
+            },
+            [&](uint64_t, bool v) { count += v; });
+        return count;
+    }
+
+    /*
+     * position of the first one at or after i, size() if there is none
+     */
+    uint64_t next_one(uint64_t i) const { return next_bit<true>(i); }
+
+    /*
+     * position of the first zero at or after i, size() if there is none
+     */
+    uint64_t next_zero(uint64_t i) const { return next_bit<false>(i); }
+
+    /*
+     * position of the last one at or before i, size() if there is none
+     */
+    uint64_t prev_one(uint64_t i) const { return prev_bit<true>(i); }
+
+    /*
+     * position of the last zero at or before i, size() if there is none
+     */
+    uint64_t prev_zero(uint64_t i) const { return prev_bit<false>(i); }
+
+    /*
+     * number of pending edits in the buffer
+     */
+    uint8_t buffer_fill() const { return buffer_count; }
+
+    /*
+     * Whether the contents changed since the last mark_clean(). New leaves
+     * and copies start out dirty. Commits only change the layout of the
+     * words, not the contents.
+     */
+    bool dirty() const { return dirty_; }
+
+    void mark_clean() { dirty_ = false; }
+
+    /*
+     * calls f(pointer, bytes) for the leaf object and its word storage, e.g.
+     * to move them to another NUMA node
+     */
+    template <class F>
+    void for_each_block(F f) const {
+        f(static_cast<const void*>(this), sizeof(buffered_packed_vector));
+        if (words.capacity()) {
+            f(static_cast<const void*>(words.data()),
+              words.capacity() * sizeof(uint64_t));
+        }
+    }
+
+    /*
+     * number of words written by serialize()
+     */
+    uint64_t serialized_words() const {
+        return 4 + buffer_count + fast_div(phys_size_) +
+               (fast_mod(phys_size_) != 0);
+    }
+
+    /*
+     * Writes the leaf to out, including the buffered edits, so it can be
+     * restored with deserialize() without a commit.
+     */
+    void serialize(uint64_t* out) const {
+        out[0] = size_;
+        out[1] = phys_size_;
+        out[2] = psum_;
+        out[3] = buffer_count;
+        for (uint8_t k = 0; k < buffer_count; k++) out[4 + k] = buffer[k];
+        uint64_t nr_words = serialized_words() - 4 - buffer_count;
+        std::copy(words.begin(), words.begin() + nr_words,
+                  out + 4 + buffer_count);
+    }
+
+    /*
+     * replaces the contents with a leaf written by serialize()
+     */
+    void deserialize(const uint64_t* in) {
+        BV_STAT(uint64_t old_capacity = words.capacity());
+        size_ = in[0];
+        phys_size_ = in[1];
+        psum_ = in[2];
+        buffer_count = in[3];
+        assert(buffer_count < buffer_size);
+        std::fill(buffer, buffer + buffer_size, 0);
+        for (uint8_t k = 0; k < buffer_count; k++) buffer[k] = in[4 + k];
+        const uint64_t* w = in + 4 + buffer_count;
+        words.assign(w, w + fast_div(phys_size_) + (fast_mod(phys_size_) != 0));
+        BV_STAT(bv_stats::resized(old_capacity, words.capacity()));
+        dirty_ = true;
+    }
+
+    /*
+     * Apply all buffered edits to the underlying words, from left to right.
+     * Words before the first edit are left alone. A word with edits is
+     * rebuilt by gathering the physical bits for all of its edits at once
+     * (see commit_word). The words between two such words, and the words
+     * after the last one, only move by a fixed shift and are funnel shifted
+     * as a block. The shift is at most 64 bits, so a word is built from
+     * the word before it, itself and the two after it, and only the word
+     * before can have been overwritten already.
+     */
+    void commit() {
+        BV_STAT(bv_stats::commits++);
+        BV_STAT(bv_stats::commit_fill[buffer_count]++);
+        BV_STAT(auto trace_start = bv_stats::now());
+        if (size_ > fast_mul(words.size())) {
+            BV_STAT(uint64_t old_capacity = words.capacity());
+            words.reserve(words.size() + extra_);
+            words.resize(words.size() + extra_, 0);
+            BV_STAT(bv_stats::resized(old_capacity, words.capacity()));
+        }
+
+        const uint64_t nr_words = words.size();
+        uint64_t w = buffer_count ? fast_div(buffer_index(buffer[0])) : 0;
+        // physical position of the next source bit
+        uint64_t p = fast_mul(w);
+        // the original of word w - 1
+        uint64_t before = 0;
+        uint8_t idx = 0;
+        while (idx < buffer_count) {
+            uint64_t e = fast_div(buffer_index(buffer[idx]));
+            // A removal at the end can leave an entry past the last word
+            if (e >= nr_words) break;
+            if (e > w) {
+                uint64_t original = words[e - 1];
+                shift_words(w, e, int64_t(fast_mul(w)) - int64_t(p), before);
+                before = original;
+                p += fast_mul(e - w);
+                w = e;
+            }
+            auto source = [&](uint64_t p) {
+                uint64_t q = fast_div(p);
+                uint64_t o = fast_mod(p);
+                uint64_t lo = q + 1 == w ? before
+                              : q < nr_words ? words[q]
+                                             : 0;
+                if (o == 0) return lo;
+                uint64_t hi = q + 1 < nr_words ? words[q + 1] : 0;
+                return (lo >> o) | (hi << (64 - o));
+            };
+            uint64_t out = commit_word(w, idx, p, source);
+            before = words[w];
+            words[w] = out;
+            w++;
+        }
+        shift_words(w, nr_words, int64_t(fast_mul(w)) - int64_t(p), before);
+        BV_STAT(bv_stats::record("commit", trace_start, size_, buffer_count));
+        buffer_count = 0;
+        phys_size_ = size_;
+    }
+
    private:
-    bool buffer_value(uint32_t e) const { return (e & VALUE_MASK) != 0; }
+    /*
+     * the state besides words of other, for the assignments
+     */
+    void assign_counts(const buffered_packed_vector& other) {
+        psum_ = other.psum_;
+        size_ = other.size_;
+        phys_size_ = other.phys_size_;
+        buffer_count = other.buffer_count;
+        std::copy(other.buffer, other.buffer + buffer_size, buffer);
+        dirty_ = true;
+    }
+
+    /*
+     * empties a leaf whose words were moved out
+     */
+    void clear_moved() {
+        words.clear();
+        psum_ = 0;
+        size_ = 0;
+        phys_size_ = 0;
+        buffer_count = 0;
+        dirty_ = true;
+    }
+
+    /*
+     * Fails unless n more bits fit under max_size. Past the bound buffer
+     * indexes and counters overflow, so this is checked in release builds
+     * too.
+     */
+    void check_room(uint64_t n) const {
+        if (max_size != 0 && size_ + n > max_size) {
+            std::cerr << "Leaf grows past max_size " << max_size
+                      << std::endl;
+            abort();
+        }
+    }
+
+    /*
+     * n <= 64 physical bits starting from physical position p
+     */
+    uint64_t physical_bits(uint64_t p, uint64_t n) const {
+        uint64_t w = fast_div(p);
+        uint64_t o = fast_mod(p);
+        uint64_t res = words[w] >> o;
+        if (o && o + n > 64) res |= words[w + 1] << (64 - o);
+        return n < 64 ? res & ((MASK << n) - 1) : res;
+    }
+
+    /*
+     * Moves the bits of words [a, b) of commit() by shift bits, towards the
+     * end if shift is positive, where before is the original of word a - 1.
+     * Moving towards the end goes from right to left, so that the words read
+     * are still the originals.
+     */
+    void shift_words(uint64_t a, uint64_t b, int64_t shift, uint64_t before) {
+        uint64_t* w = words.data();
+        if (a >= b || shift == 0) return;
+        if (shift > 0) {
+            assert(shift <= 64);
+            uint64_t o = shift;
+            if (o == 64) {
+                for (uint64_t v = b - 1; v > a; v--) w[v] = w[v - 1];
+                w[a] = before;
+            } else {
+                for (uint64_t v = b - 1; v > a; v--) {
+                    w[v] = (w[v] << o) | (w[v - 1] >> (64 - o));
+                }
+                w[a] = (w[a] << o) | (before >> (64 - o));
+            }
+            return;
+        }
+        assert(shift >= -64);
+        const uint64_t n = words.size();
+        uint64_t o = -shift;
+        uint64_t v = a;
+        if (o == 64) {
+            for (; v + 1 < b && v + 1 < n; v++) w[v] = w[v + 1];
+            for (; v < b; v++) w[v] = v + 1 < n ? w[v + 1] : 0;
+        } else {
+            for (; v < b && v + 1 < n; v++) {
+                w[v] = (w[v] >> o) | (w[v + 1] << (64 - o));
+            }
+            for (; v < b; v++) w[v] >>= o;
+        }
+    }
+
+    /*
+     * Output word w of commit(), for the buffered edits from idx on, of
+     * which at least the first lands in it. p is the physical position of
+     * the next source bit and source(p) the 64 physical bits from there.
+     * Both idx and p are moved past the word.
+     *
+     * With BMI2 the physical bits of the word are gathered in one go: PEXT
+     * drops the removed bits from the next 128 physical bits and PDEP
+     * spreads the rest around the inserted ones. Otherwise the runs between
+     * the edits are copied one at a time.
+     */
+    template <class F>
+    uint64_t commit_word(uint64_t w, uint8_t& idx, uint64_t& p,
+                         F source) const {
+        assert(fast_div(buffer_index(buffer[idx])) == w);
+        const uint64_t end = fast_mul(w + 1);
+#ifdef __BMI2__
+        uint64_t keep = ~uint64_t(0);
+        uint64_t inserted = 0;
+        // removed bits among the next 128 physical bits
+        uint64_t removed[2] = {0, 0};
+        uint64_t nr_inserted = 0;
+        uint64_t nr_removed = 0;
+        for (; idx < buffer_count && buffer_index(buffer[idx]) < end; idx++) {
+            uint64_t t = fast_mod(buffer_index(buffer[idx]));
+            if (buffer_is_insertion(buffer[idx])) {
+                keep &= ~(MASK << t);
+                inserted |= uint64_t(buffer_value(buffer[idx])) << t;
+                nr_inserted++;
+            } else {
+                // the removed bit follows the kept bits before t
+                uint64_t r = t - nr_inserted + nr_removed;
+                removed[r >= 64] |= MASK << fast_mod(r);
+                nr_removed++;
+            }
+        }
+        uint64_t bits = _pext_u64(source(p), ~removed[0]);
+        uint64_t got = 64 - __builtin_popcountll(removed[0]);
+        if (got < 64 - nr_inserted) {
+            bits |= _pext_u64(source(p + 64), ~removed[1]) << got;
+        }
+        p += 64 - nr_inserted + nr_removed;
+        return _pdep_u64(bits, keep) | inserted;
+#else
+        uint64_t out = 0;
+        // next output bit
+        uint64_t pos = 0;
+        for (; idx < buffer_count && buffer_index(buffer[idx]) < end; idx++) {
+            uint64_t t = fast_mod(buffer_index(buffer[idx]));
+            if (t > pos) {
+                out |= (source(p) << pos) & ((MASK << t) - 1);
+                p += t - pos;
+            }
+            if (buffer_is_insertion(buffer[idx])) {
+                out |= uint64_t(buffer_value(buffer[idx])) << t;
+                pos = t + 1;
+            } else {
+                p++;
+                pos = t;
+            }
+        }
+        if (pos < 64) {
+            out |= source(p) << pos;
+            p += 64 - pos;
+        }
+        return out;
+#endif
+    }
 
-    bool buffer_is_insertion(uint32_t e) const { return (e & TYPE_MASK) != 0; }
+    /*
+     * position of the x-th (1-based) element equal to bit. Runs of stored
+     * elements between buffered edits are scanned a word at a time and the
+     * target is located inside its word with select_in_word.
+     */
+    template <bool bit>
+    uint64_t select_bit(uint64_t x) const {
+        uint64_t l = 0;
+        uint64_t p = 0;
+        auto scan = [&](uint64_t len) {
+            while (len) {
+                uint64_t o = fast_mod(p);
+                uint64_t n = 64 - o < len ? 64 - o : len;
+                uint64_t w = physical_bits(p, n);
+                if (!bit) w = ~w & (n < 64 ? (MASK << n) - 1 : ~uint64_t(0));
+                uint64_t c = __builtin_popcountll(w);
+                if (c >= x) {
+                    l += select_in_word(w, x - 1);
+                    return true;
+                }
+                x -= c;
+                l += n;
+                p += n;
+                len -= n;
+            }
+            return false;
+        };
+        for (uint8_t idx = 0; idx < buffer_count; idx++) {
+            uint64_t b = buffer_index(buffer[idx]);
+            if (b > l && scan(b - l)) return l;
+            if (buffer_is_insertion(buffer[idx])) {
+                if (buffer_value(buffer[idx]) == bit && --x == 0) return l;
+                l++;
+            } else {
+                p++;
+            }
+        }
+        scan(size_ - l);
+        return l;
+    }
 
-    uint32_t buffer_index(uint32_t e) const { return (e & INDEX_MASK) >> 8; }
+    /*
+     * n <= 64 physical bits from p, complemented if searching for zeros
+     */
+    template <bool bit>
+    uint64_t search_bits(uint64_t p, uint64_t n) const {
+        uint64_t w = physical_bits(p, n);
+        if (bit) return w;
+        return ~w & (n < 64 ? (MASK << n) - 1 : ~uint64_t(0));
+    }
+
+    template <bool bit>
+    uint64_t next_bit(uint64_t i) const {
+        assert(i <= size_);
+        uint64_t res = size_;
+        merged_segments(
+            i, size_,
+            [&](uint64_t pos, uint64_t p, uint64_t len) {
+                if (res != size_) return;
+                for (uint64_t k = 0; k < len;) {
+                    uint64_t o = fast_mod(p + k);
+                    uint64_t n = 64 - o < len - k ? 64 - o : len - k;
+                    uint64_t w = search_bits<bit>(p + k, n);
+                    if (w) {
+                        res = i + pos + k + __builtin_ctzll(w);
+                        return;
+                    }
+                    k += n;
+                }
+            },
+            [&](uint64_t pos, bool v) {
+                if (res == size_ && v == bit) res = i + pos;
+            });
+        return res;
+    }
+
+    template <bool bit>
+    uint64_t prev_bit(uint64_t i) const {
+        assert(i < size_);
+        // Runs of [0, i] in order, len == 0 marks an insertion of value p.
+        struct run {
+            uint64_t pos, p, len;
+        } runs[2 * buffer_size + 1];
+        uint8_t count = 0;
+        merged_segments(
+            0, i + 1,
+            [&](uint64_t pos, uint64_t p, uint64_t len) {
+                runs[count++] = {pos, p, len};
+            },
+            [&](uint64_t pos, bool v) { runs[count++] = {pos, v, 0}; });
+        while (count--) {
+            const run& r = runs[count];
+            if (r.len == 0) {
+                if (bool(r.p) == bit) return r.pos;
+                continue;
+            }
+            for (uint64_t end = r.len; end > 0;) {
+                uint64_t start = (r.p + end - 1) & ~uint64_t(63);
+                start = start < r.p ? 0 : start - r.p;
+                uint64_t w = search_bits<bit>(r.p + start, end - start);
+                if (w) return r.pos + start + 63 - __builtin_clzll(w);
+                end = start;
+            }
+        }
+        return size_;
+    }
+
+    /*
+     * position of the (r + 1)-th set bit of w
+     */
+    static uint64_t select_in_word(uint64_t w, uint64_t r) {
+#ifdef __BMI2__
+        return __builtin_ctzll(_pdep_u64(MASK << r, w));
+#else
+        for (; r > 0; r--) w &= w - 1;
+        return __builtin_ctzll(w);
+#endif
+    }
+
+    static void write_bits(uint64_t* out, uint64_t pos, uint64_t v,
+                           uint64_t n) {
+        uint64_t w = fast_div(pos);
+        uint64_t o = fast_mod(pos);
+        uint64_t mask = n < 64 ? (MASK << n) - 1 : ~uint64_t(0);
+        out[w] = (out[w] & ~(mask << o)) | (v << o);
+        if (o + n > 64) {
+            out[w + 1] = (out[w + 1] & ~(mask >> (64 - o))) | (v >> (64 - o));
+        }
+    }
+
+    /*
+     * Walks the logical range [i, j) in order. Runs of elements that are
+     * stored in words are reported as segment(pos, p, len) where pos is the
+     * offset from i and p the physical position, buffered insertions as
+     * inserted(pos, value).
+     */
+    template <class S, class I>
+    void merged_segments(uint64_t i, uint64_t j, S segment,
+                         I inserted) const {
+        uint64_t l = 0;
+        uint64_t p = 0;
+        auto emit = [&](uint64_t e) {
+            uint64_t lo = l < i ? i : l;
+            uint64_t hi = e < j ? e : j;
+            if (lo < hi) segment(lo - i, p + (lo - l), hi - lo);
+        };
+        for (uint8_t idx = 0; idx < buffer_count && l < j; idx++) {
+            uint64_t b = buffer_index(buffer[idx]);
+            if (b > l) {
+                emit(b);
+                p += b - l;
+                l = b;
+            }
+            if (buffer_is_insertion(buffer[idx])) {
+                if (l >= i && l < j) inserted(l - i, buffer_value(buffer[idx]));
+                l++;
+            } else {
+                p++;
+            }
+        }
+        if (l < j) emit(j);
+    }
+
+    bool buffer_value(buffer_type e) const { return (e & VALUE_MASK) != 0; }
+
+    bool buffer_is_insertion(buffer_type e) const {
+        return (e & TYPE_MASK) != 0;
+    }
+
+    uint32_t buffer_index(buffer_type e) const { return e >> INDEX_SHIFT; }
 
     void set_buffer_index(uint32_t v, uint8_t i) {
-        buffer[i] = (v << 8) | (buffer[i] & ((MASK << 7) - 1));
+        buffer[i] = (v << INDEX_SHIFT) | (buffer[i] & (TYPE_MASK | VALUE_MASK));
     }
 
-    uint32_t create_buffer(uint32_t idx, bool t, bool v) {
-        return ((idx << 8) | (t ? TYPE_MASK : uint32_t(0))) |
-               (v ? VALUE_MASK : uint32_t(0));
+    buffer_type create_buffer(uint32_t idx, bool t, bool v) {
+        assert(idx < (uint32_t(1) << (sizeof(buffer_type) * 8 - INDEX_SHIFT)));
+        return ((idx << INDEX_SHIFT) | (t ? TYPE_MASK : 0)) |
+               (v ? VALUE_MASK : 0);
     }
 
-    void insert_buffer(uint8_t idx, uint32_t buf) {
+    void insert_buffer(uint8_t idx, buffer_type buf) {
         for (uint8_t i = buffer_count; i > idx; i--) {
             buffer[i] = buffer[i - 1];
         }
@@ -606,104 +1318,6 @@ class buffered_packed_vector {
         }
     }
 
-    void commit() {
-        if (size_ > fast_mul(words.size())) {
-            words.reserve(words.size() + extra_);
-            words.resize(words.size() + extra_, 0);
-        }
-
-        uint64_t overflow = 0;
-        uint8_t overflow_length = 0;
-        uint8_t underflow_length = 0;
-        size_t current_word = 0;
-        uint8_t current_index = 0;
-        uint32_t buf = buffer[current_index];
-        size_t target_word = fast_div(buffer_index(buf));
-        size_t target_offset = fast_mod(buffer_index(buf));
-
-        while (current_word < words.size()) {
-            uint64_t underflow =
-                current_word + 1 < words.size() ? words[current_word + 1] : 0;
-            if (overflow_length) {
-                underflow = (underflow << overflow_length) |
-                            (words[current_word] >> (64 - overflow_length));
-            }
-
-            uint64_t new_overflow = 0;
-            //If buffers need to be commit to this word:
-            if (current_word == target_word && current_index < buffer_count) {
-                uint64_t word =
-                    underflow_length
-                        ? (words[current_word] >> underflow_length) |
-                              (underflow << (64 - underflow_length))
-                        : (words[current_word] << overflow_length) | overflow;
-                underflow >>= underflow_length;
-                uint64_t new_word = 0;
-                uint8_t start_offset = 0;
-                //While there are buffers for this word
-                while (current_word == target_word) {
-                    new_word |=
-                        (word << start_offset) & ((MASK << target_offset) - 1);
-                    word = (word >> (target_offset - start_offset)) |
-                           (target_offset == 0
-                                ? 0
-                                : target_offset - start_offset == 0
-                                      ? 0
-                                      : (underflow << (64 - (target_offset -
-                                                             start_offset))));
-                    underflow >>= target_offset - start_offset;
-                    if (buffer_is_insertion(buf)) {
-                        if (buffer_value(buf)) {
-                            new_word |= MASK << target_offset;
-                        }
-                        start_offset = target_offset + 1;
-                        if (underflow_length)
-                            underflow_length--;
-                        else
-                            overflow_length++;
-                    } else {
-                        word >>= 1;
-                        word |= underflow << 63;
-                        underflow >>= 1;
-                        if (overflow_length)
-                            overflow_length--;
-                        else
-                            underflow_length++;
-                        start_offset = target_offset;
-                    }
-                    current_index++;
-                    if (current_index >= buffer_count) break;
-                    buf = buffer[current_index];
-                    target_word = fast_div(buffer_index(buf));
-                    target_offset = fast_mod(buffer_index(buf));
-                }
-                new_word |=
-                    start_offset < 64 ? (word << start_offset) : uint64_t(0);
-                new_overflow = overflow_length ? words[current_word] >>
-                                                     (64 - overflow_length)
-                                               : 0;
-                words[current_word] = new_word;
-            } else {
-                if (underflow_length) {
-                    words[current_word] =
-                        (words[current_word] >> underflow_length) |
-                        (underflow << (64 - underflow_length));
-                } else if (overflow_length) {
-                    new_overflow =
-                        words[current_word] >> (64 - overflow_length);
-                    words[current_word] =
-                        (words[current_word] << overflow_length) | overflow;
-                    overflow = new_overflow;
-                } else {
-                    overflow = 0;
-                }
-            }
-            overflow = new_overflow;
-            current_word++;
-        }
-        buffer_count = 0;
-    }
-
     void shift_right(uint64_t i, uint64_t current_word) {
         // TODO: Test
         assert(i < size());
@@ -771,7 +1385,7 @@ class buffered_packed_vector {
         uint64_t falling_in_idx;
 
         if (fast_mul(current_word) < i) {
-            falling_in_idx = std::min(fast_mul(current_word + 1), size_ - 1);
+            falling_in_idx = std::min(fast_mul(current_word + 1), uint64_t(size_) - 1);
 
             for (uint64_t j = i; j < falling_in_idx; ++j) {
                 assert(j + 1 < size_);
@@ -805,16 +1419,19 @@ class buffered_packed_vector {
     static constexpr uint8_t int_per_word_ = 64;
     static constexpr uint64_t MASK = 1;
     static constexpr uint8_t extra_ = 2;
-    static constexpr uint32_t VALUE_MASK = 1;
-    static constexpr uint32_t TYPE_MASK = 8;
-    static constexpr uint32_t INDEX_MASK = ~((uint32_t(1) << 8) - 1);
+    static constexpr buffer_type VALUE_MASK = 1;
+    static constexpr buffer_type TYPE_MASK = 2;
+    static constexpr uint8_t INDEX_SHIFT = 2;
 
     std::vector<uint64_t> words{};
-    uint64_t psum_ = 0;
-    uint64_t size_ = 0;
+    count_type psum_ = 0;
+    count_type size_ = 0;
+    // number of bits stored in words, size_ with the buffered edits undone
+    count_type phys_size_ = 0;
 
-    uint32_t buffer[buffer_size];
+    buffer_type buffer[buffer_size];
     uint8_t buffer_count;
+    bool dirty_ = true;
 };
 
 }  // namespace dyn
\ No newline at end of file
@@ -0,0 +1,685 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <type_traits>
+#include <vector>
+
+#include "bv_stats.hpp"
+#include "spsi.hpp"
+
+namespace dyn {
+/*
+ * Buffered packed integer vector leaf for fixed widths of 2 to 32 bits.
+ *
+ * The integer counterpart of buffered_packed_vector: insertions and removals
+ * go to a sorted buffer of at most buffer_size entries which is committed to
+ * the words in one pass when it fills up. Elements are packed 64 / int_width
+ * to a word without crossing word boundaries, as in DYNAMIC's packed_vector,
+ * so the element to word mapping is a division by a compile-time constant (a
+ * shift and a mask when int_width divides 64). Values need to fit in
+ * int_width bits, there is no rebuild to a larger width.
+ *
+ * The interface is the one dyn::spsi expects from its leaves, so
+ * spsi<buffered_int_vector<...>, B_LEAF, B> is a searchable partial sum with
+ * buffered leaves. max_size bounds the number of elements as in
+ * buffered_packed_vector.
+ */
+template <uint8_t int_width, uint8_t buffer_size, uint32_t max_size = 0>
+class buffered_int_vector {
+    static_assert(int_width >= 2 && int_width <= 32,
+                  "Width needs to be between 2 and 32, use "
+                  "buffered_packed_vector for bits");
+    static_assert(buffer_size >= 1 && buffer_size <= 64,
+                  "Buffer size needs to be between 1 and 64");
+
+    // Buffer entries are index << (int_width + 1) | type << int_width | value
+    typedef typename std::conditional<
+        (max_size != 0 && max_size < ((uint64_t(1) << 31) >> int_width)),
+        uint32_t, uint64_t>::type buffer_type;
+    typedef typename std::conditional<
+        (max_size != 0 && max_size < (1 << 16)), uint16_t,
+        typename std::conditional<max_size != 0, uint32_t,
+                                  uint64_t>::type>::type count_type;
+
+   public:
+    static uint64_t fast_mod(uint64_t const num) {
+        return num % int_per_word_;
+    }
+
+    static uint64_t fast_div(uint64_t const num) {
+        return num / int_per_word_;
+    }
+
+    static uint64_t fast_mul(uint64_t const num) {
+        return num * int_per_word_;
+    }
+
+    explicit buffered_int_vector(uint64_t const size = 0) {
+        std::fill(buffer, buffer + buffer_size, 0);
+        buffer_count = 0;
+        size_ = size;
+        phys_size_ = size;
+        psum_ = 0;
+        words = std::vector<uint64_t>(fast_div(size_) + (fast_mod(size_) != 0));
+        BV_STAT(bv_stats::leaves++);
+        BV_STAT(bv_stats::resized(0, words.capacity()));
+    }
+
+    buffered_int_vector(std::vector<uint64_t>&& _words,
+                        uint64_t const new_size) {
+        std::fill(buffer, buffer + buffer_size, 0);
+        buffer_count = 0;
+        words = std::move(_words);
+        size_ = new_size;
+        phys_size_ = new_size;
+        psum_ = prefix_sum(size_);
+        BV_STAT(bv_stats::leaves++);
+        BV_STAT(bv_stats::resized(0, words.capacity()));
+        assert(fast_div(size_) <= words.size());
+    }
+
+    buffered_int_vector(const buffered_int_vector& other)
+        : words(other.words),
+          psum_(other.psum_),
+          size_(other.size_),
+          phys_size_(other.phys_size_),
+          buffer_count(other.buffer_count) {
+        std::copy(other.buffer, other.buffer + buffer_size, buffer);
+        BV_STAT(bv_stats::leaves++);
+        BV_STAT(bv_stats::resized(0, words.capacity()));
+    }
+
+    ~buffered_int_vector() {
+        BV_STAT(bv_stats::leaves--);
+        BV_STAT(bv_stats::resized(words.capacity(), 0));
+    }
+
+    uint64_t at(uint64_t i) const {
+        assert(i < size_);
+        uint64_t index = i;
+        for (uint8_t idx = 0; idx < buffer_count; idx++) {
+            uint64_t b = buffer_index(buffer[idx]);
+            if (b == i) {
+                if (buffer_is_insertion(buffer[idx])) {
+                    return buffer_value(buffer[idx]);
+                }
+                index++;
+            } else if (b < i) {
+                index += buffer_is_insertion(buffer[idx]) ? -1 : 1;
+            } else {
+                break;
+            }
+        }
+        return get(index);
+    }
+
+    uint64_t psum() const { return psum_; }
+
+    /*
+     * inclusive partial sum (i.e. up to element i included)
+     */
+    uint64_t psum(uint64_t i) const {
+        assert(i < size_);
+        return prefix_sum(i + 1);
+    }
+
+    /*
+     * smallest index j such that psum(j)>=x
+     */
+    uint64_t search(uint64_t x) const {
+        assert(size_ > 0);
+        assert(x <= psum_);
+        return search_sum<false>(x);
+    }
+
+    /*
+     * smallest index j such that psum(j)+j+1>=x
+     */
+    uint64_t search_r(uint64_t x) const {
+        assert(size_ > 0);
+        assert(x <= psum_ + size_);
+        return search_sum<true>(x);
+    }
+
+    /*
+     * true iif x is one of the partial sums  0, I_0, I_0+I_1, ...
+     */
+    bool contains(uint64_t x) const {
+        assert(size_ > 0);
+        assert(x <= psum_);
+        return x == 0 || psum(search(x)) == x;
+    }
+
+    /*
+     * true iif x is one of  0, I_0+1, I_0+I_1+2, ...
+     */
+    bool contains_r(uint64_t x) const {
+        assert(size_ > 0);
+        assert(x <= psum_ + size_);
+        if (x == 0) return true;
+        uint64_t j = search_r(x);
+        return psum(j) + j + 1 == x;
+    }
+
+    void increment(uint64_t i, uint64_t delta, bool subtract = false) {
+        assert(i < size_);
+        uint64_t x = at(i);
+        assert(!subtract || delta <= x);
+        set(i, subtract ? x - delta : x + delta);
+    }
+
+    void append(uint64_t x) { push_back(x); }
+
+    void remove(uint64_t i) {
+        assert(i < size_);
+        BV_STAT(bv_stats::removes++);
+        uint64_t x = at(i);
+        psum_ -= x;
+        --size_;
+        bool done = false;
+        for (uint8_t idx = 0; idx < buffer_count; idx++) {
+            uint64_t b = buffer_index(buffer[idx]);
+            if (b == i && buffer_is_insertion(buffer[idx]) && !done) {
+                delete_buffer_element(idx--);
+                BV_STAT(bv_stats::remove_cancels++);
+                done = true;
+                continue;
+            }
+            if (b > i) {
+                if (!done) {
+                    insert_buffer(idx, create_buffer(i, false, x));
+                    done = true;
+                } else {
+                    set_buffer_index(b - 1, idx);
+                }
+            }
+        }
+        if (!done) buffer[buffer_count++] = create_buffer(i, false, x);
+        BV_STAT(bv_stats::occupancy[buffer_count]++);
+        if (buffer_count == buffer_size) commit();
+    }
+
+    void insert(uint64_t i, uint64_t x) {
+        assert(x <= MASK);
+        if (i == size_) {
+            push_back(x);
+            return;
+        }
+        BV_STAT(bv_stats::inserts++);
+        check_room(1);
+        psum_ += x;
+        bool done = false;
+        uint64_t p = i;
+        for (uint8_t idx = 0; idx < buffer_count; idx++) {
+            uint64_t b = buffer_index(buffer[idx]);
+            if (b < i) {
+                p += buffer_is_insertion(buffer[idx]) ? -1 : 1;
+            } else if (b == i && !done && !buffer_is_insertion(buffer[idx])) {
+                // A buffered removal at i turns the insertion into a set of
+                // the removed element
+                delete_buffer_element(idx--);
+                BV_STAT(bv_stats::insert_cancels++);
+                done = true;
+                put(p, x);
+            } else {
+                if (!done) {
+                    insert_buffer(idx, create_buffer(i, true, x));
+                    done = true;
+                } else {
+                    set_buffer_index(b + 1, idx);
+                }
+            }
+        }
+        size_++;
+        if (!done) buffer[buffer_count++] = create_buffer(i, true, x);
+        BV_STAT(bv_stats::occupancy[buffer_count]++);
+        if (buffer_count == buffer_size) commit();
+    }
+
+    void push_back(uint64_t x) {
+        assert(x <= MASK);
+        check_room(1);
+        uint64_t p = phys_size_;
+        size_++;
+        phys_size_++;
+        if (fast_div(p) == words.size()) {
+            BV_STAT(uint64_t old_capacity = words.capacity());
+            words.push_back(0);
+            BV_STAT(bv_stats::resized(old_capacity, words.capacity()));
+        }
+        put(p, x);
+        psum_ += x;
+    }
+
+    /*
+     * inserts n integers of w <= int_width bits packed in word, the first one
+     * in the least significant bits, starting from position i
+     */
+    void insert_word(uint64_t i, uint64_t word, uint8_t w, uint8_t n) {
+        assert(i <= size_);
+        assert(n > 0 && w > 0 && w <= width_);
+        assert(n * w <= 64);
+        assert(n * w == 64 || (word >> (n * w)) == 0);
+        check_room(n);
+        if (buffer_count > 0) commit();
+        reserve(size_ + n);
+        move(i, i + n, size_ - i);
+        uint64_t mask = (uint64_t(1) << w) - 1;
+        for (uint8_t k = 0; k < n; k++) {
+            uint64_t x = (word >> (k * w)) & mask;
+            put(i + k, x);
+            psum_ += x;
+        }
+        size_ += n;
+        phys_size_ = size_;
+    }
+
+    uint64_t size() const { return size_; }
+
+    /*
+     * split content of this vector into 2 packed blocks:
+     * Left part remains in this block, right part in the
+     * new returned block.
+     */
+    template <class R = buffered_int_vector>
+    R* split() {
+        BV_STAT(bv_stats::splits++);
+        if (buffer_count > 0) commit();
+
+        uint64_t tot_words = fast_div(size_) + (fast_mod(size_) != 0);
+        uint64_t nr_left_words = tot_words >> 1;
+        assert(nr_left_words > 0);
+        uint64_t nr_left_ints = fast_mul(nr_left_words);
+        assert(size_ > nr_left_ints);
+        uint64_t nr_right_ints = size_ - nr_left_ints;
+
+        std::vector<uint64_t> right_words(tot_words - nr_left_words + extra_,
+                                          0);
+        std::copy(words.begin() + nr_left_words, words.begin() + tot_words,
+                  right_words.begin());
+        BV_STAT(uint64_t old_capacity = words.capacity());
+        words.resize(nr_left_words + extra_);
+        std::fill(words.begin() + nr_left_words, words.end(), 0);
+        words.shrink_to_fit();
+        BV_STAT(bv_stats::resized(old_capacity, words.capacity()));
+
+        size_ = nr_left_ints;
+        phys_size_ = nr_left_ints;
+        psum_ = prefix_sum(size_);
+        return new R(std::move(right_words), nr_right_ints);
+    }
+
+    /* set i-th element to x. updates psum */
+    void set(const uint64_t i, const uint64_t x) {
+        assert(i < size_);
+        assert(x <= MASK);
+        BV_STAT(bv_stats::sets++);
+        uint64_t idx = i;
+        for (uint8_t j = 0; j < buffer_count; j++) {
+            uint64_t b = buffer_index(buffer[j]);
+            if (b < i) {
+                idx += buffer_is_insertion(buffer[j]) ? -1 : 1;
+            } else if (b == i) {
+                if (buffer_is_insertion(buffer[j])) {
+                    psum_ = psum_ - buffer_value(buffer[j]) + x;
+                    buffer[j] = (buffer[j] & ~buffer_type(MASK)) | x;
+                    return;
+                }
+                idx++;
+            } else {
+                break;
+            }
+        }
+        psum_ = psum_ - get(idx) + x;
+        put(idx, x);
+    }
+
+    /*
+     * return total number of bits occupied in memory by this object instance
+     */
+    uint64_t bit_size() const {
+        uint64_t capacity = words.capacity() * sizeof(uint64_t);
+        return (sizeof(buffered_int_vector) + capacity +
+                malloc_overhead(sizeof(buffered_int_vector)) +
+                (capacity ? malloc_overhead(capacity) : 0)) *
+               8;
+    }
+
+    uint64_t width() const { return width_; }
+
+    /*
+     * number of pending edits in the buffer
+     */
+    uint8_t buffer_fill() const { return buffer_count; }
+
+    /*
+     * apply all buffered edits to the underlying words
+     *
+     * Every run of stored elements between buffered edits moves by the
+     * number of insertions minus removals before it. Runs moving left are
+     * moved front to back and runs moving right back to front, so no run
+     * overwrites one that has not been moved yet, then the buffered
+     * insertions are written into the gaps.
+     */
+    void commit() {
+        BV_STAT(bv_stats::commits++);
+        BV_STAT(bv_stats::commit_fill[buffer_count]++);
+        struct run {
+            uint64_t pos, p, len;
+        } runs[buffer_size + 1];
+        uint8_t count = 0;
+        merged_segments(
+            0, size_,
+            [&](uint64_t pos, uint64_t p, uint64_t len) {
+                runs[count++] = {pos, p, len};
+            },
+            [](uint64_t, uint64_t) {});
+        reserve(size_);
+        for (uint8_t r = 0; r < count; r++) {
+            if (runs[r].pos < runs[r].p) {
+                move(runs[r].p, runs[r].pos, runs[r].len);
+            }
+        }
+        for (uint8_t r = count; r-- > 0;) {
+            if (runs[r].pos > runs[r].p) {
+                move(runs[r].p, runs[r].pos, runs[r].len);
+            }
+        }
+        merged_segments(
+            0, size_, [](uint64_t, uint64_t, uint64_t) {},
+            [&](uint64_t pos, uint64_t x) { put(pos, x); });
+        // Keep the elements past the end zero
+        for (uint64_t p = size_; p < phys_size_; p++) put(p, 0);
+        buffer_count = 0;
+        phys_size_ = size_;
+    }
+
+   private:
+    /*
+     * Fails unless n more elements fit under max_size, as in
+     * buffered_packed_vector
+     */
+    void check_room(uint64_t n) const {
+        if (max_size != 0 && size_ + n > max_size) {
+            std::cerr << "Leaf grows past max_size " << max_size
+                      << std::endl;
+            abort();
+        }
+    }
+
+    static constexpr uint8_t width_ = int_width;
+    static constexpr uint8_t int_per_word_ = 64 / width_;
+    static constexpr uint64_t MASK = (uint64_t(1) << width_) - 1;
+    static constexpr uint8_t extra_ = 2;
+    static constexpr uint8_t INDEX_SHIFT = width_ + 1;
+    static constexpr buffer_type TYPE_MASK = buffer_type(1) << width_;
+
+    /*
+     * lowest bit of every element of a word
+     */
+    static constexpr uint64_t low_bits() {
+        uint64_t res = 0;
+        for (uint8_t k = 0; k < int_per_word_; k++) {
+            res |= uint64_t(1) << (k * width_);
+        }
+        return res;
+    }
+
+    static constexpr uint64_t LOW_BITS = low_bits();
+
+    static uint64_t low_mask(uint64_t bits) {
+        return bits < 64 ? (uint64_t(1) << bits) - 1 : ~uint64_t(0);
+    }
+
+    /*
+     * sum of the elements packed in w, one popcount per bit plane for narrow
+     * elements
+     */
+    static uint64_t word_sum(uint64_t w) {
+        uint64_t s = 0;
+        if constexpr (width_ <= 8) {
+            for (uint8_t b = 0; b < width_; b++) {
+                s += uint64_t(__builtin_popcountll(w & (LOW_BITS << b))) << b;
+            }
+        } else {
+            for (uint8_t k = 0; k < int_per_word_; k++) {
+                s += (w >> (k * width_)) & MASK;
+            }
+        }
+        return s;
+    }
+
+    uint64_t get(uint64_t p) const {
+        return (words[fast_div(p)] >> (fast_mod(p) * width_)) & MASK;
+    }
+
+    void put(uint64_t p, uint64_t x) {
+        uint64_t& w = words[fast_div(p)];
+        uint64_t o = fast_mod(p) * width_;
+        w = (w & ~(MASK << o)) | (x << o);
+    }
+
+    /*
+     * n <= int_per_word_ physical elements starting from p, packed in the
+     * low n * width_ bits
+     */
+    uint64_t physical_elems(uint64_t p, uint64_t n) const {
+        uint64_t w = fast_div(p);
+        uint64_t o = fast_mod(p);
+        uint64_t res = words[w] >> (o * width_);
+        if (o && o + n > int_per_word_) {
+            res |= words[w + 1] << ((int_per_word_ - o) * width_);
+        }
+        return res & low_mask(n * width_);
+    }
+
+    void write_elems(uint64_t p, uint64_t v, uint64_t n) {
+        uint64_t w = fast_div(p);
+        uint64_t o = fast_mod(p);
+        uint64_t k = int_per_word_ - o < n ? int_per_word_ - o : n;
+        uint64_t mask = low_mask(k * width_) << (o * width_);
+        words[w] = (words[w] & ~mask) | ((v << (o * width_)) & mask);
+        if (k < n) {
+            mask = low_mask((n - k) * width_);
+            words[w + 1] =
+                (words[w + 1] & ~mask) | ((v >> (k * width_)) & mask);
+        }
+    }
+
+    /*
+     * copies n physical elements from src to dst, the ranges can overlap
+     */
+    void move(uint64_t src, uint64_t dst, uint64_t n) {
+        if (dst < src) {
+            for (uint64_t k = 0; k < n; k += int_per_word_) {
+                uint64_t c = n - k < int_per_word_ ? n - k : int_per_word_;
+                write_elems(dst + k, physical_elems(src + k, c), c);
+            }
+        } else if (dst > src) {
+            for (uint64_t k = n; k > 0;) {
+                uint64_t c = k < int_per_word_ ? k : int_per_word_;
+                k -= c;
+                write_elems(dst + k, physical_elems(src + k, c), c);
+            }
+        }
+    }
+
+    /*
+     * makes room for n physical elements
+     */
+    void reserve(uint64_t n) {
+        uint64_t needed = fast_div(n) + (fast_mod(n) != 0);
+        if (needed > words.size()) {
+            BV_STAT(uint64_t old_capacity = words.capacity());
+            words.resize(needed + extra_, 0);
+            BV_STAT(bv_stats::resized(old_capacity, words.capacity()));
+        }
+    }
+
+    /*
+     * sum of the physical elements [0, n)
+     */
+    uint64_t physical_sum(uint64_t n) const {
+        uint64_t s = 0;
+        uint64_t full = fast_div(n);
+        for (uint64_t w = 0; w < full; w++) s += word_sum(words[w]);
+        if (fast_mod(n)) {
+            s += word_sum(words[full] & low_mask(fast_mod(n) * width_));
+        }
+        return s;
+    }
+
+    /*
+     * sum of the elements [0, n)
+     */
+    uint64_t prefix_sum(uint64_t n) const {
+        uint64_t s = 0;
+        uint64_t idx = n;
+        for (uint8_t i = 0; i < buffer_count; i++) {
+            if (buffer_index(buffer[i]) >= n) break;
+            if (buffer_is_insertion(buffer[i])) {
+                idx--;
+                s += buffer_value(buffer[i]);
+            } else {
+                idx++;
+                s -= buffer_value(buffer[i]);
+            }
+        }
+        return s + physical_sum(idx);
+    }
+
+    /*
+     * smallest j such that the sum of the elements [0, j], each plus one if
+     * r, is >= x. Runs of stored elements are summed a word at a time.
+     */
+    template <bool r>
+    uint64_t search_sum(uint64_t x) const {
+        uint64_t res = size_ - 1;
+        bool found = false;
+        merged_segments(
+            0, size_,
+            [&](uint64_t pos, uint64_t p, uint64_t len) {
+                if (found) return;
+                for (uint64_t k = 0; k < len;) {
+                    uint64_t o = fast_mod(p + k);
+                    uint64_t n = int_per_word_ - o < len - k
+                                     ? int_per_word_ - o
+                                     : len - k;
+                    uint64_t v = physical_elems(p + k, n);
+                    uint64_t s = word_sum(v) + (r ? n : 0);
+                    if (s >= x) {
+                        for (;; k++, v >>= width_) {
+                            uint64_t e = (v & MASK) + r;
+                            if (e >= x) break;
+                            x -= e;
+                        }
+                        res = pos + k;
+                        found = true;
+                        return;
+                    }
+                    x -= s;
+                    k += n;
+                }
+            },
+            [&](uint64_t pos, uint64_t v) {
+                if (found) return;
+                if (v + r >= x) {
+                    res = pos;
+                    found = true;
+                } else {
+                    x -= v + r;
+                }
+            });
+        return res;
+    }
+
+    /*
+     * Walks the logical range [i, j) in order as in buffered_packed_vector:
+     * runs of stored elements are reported as segment(pos, p, len), buffered
+     * insertions as inserted(pos, value).
+     */
+    template <class S, class I>
+    void merged_segments(uint64_t i, uint64_t j, S segment,
+                         I inserted) const {
+        uint64_t l = 0;
+        uint64_t p = 0;
+        auto emit = [&](uint64_t e) {
+            uint64_t lo = l < i ? i : l;
+            uint64_t hi = e < j ? e : j;
+            if (lo < hi) segment(lo - i, p + (lo - l), hi - lo);
+        };
+        for (uint8_t idx = 0; idx < buffer_count && l < j; idx++) {
+            uint64_t b = buffer_index(buffer[idx]);
+            if (b > l) {
+                emit(b);
+                p += b - l;
+                l = b;
+            }
+            if (buffer_is_insertion(buffer[idx])) {
+                if (l >= i && l < j) inserted(l - i, buffer_value(buffer[idx]));
+                l++;
+            } else {
+                p++;
+            }
+        }
+        if (l < j) emit(j);
+    }
+
+    uint64_t buffer_value(buffer_type e) const { return e & MASK; }
+
+    bool buffer_is_insertion(buffer_type e) const {
+        return (e & TYPE_MASK) != 0;
+    }
+
+    uint64_t buffer_index(buffer_type e) const { return e >> INDEX_SHIFT; }
+
+    void set_buffer_index(uint64_t v, uint8_t i) {
+        buffer[i] = (buffer_type(v) << INDEX_SHIFT) |
+                    (buffer[i] & (TYPE_MASK | buffer_type(MASK)));
+    }
+
+    buffer_type create_buffer(uint64_t idx, bool t, uint64_t v) {
+        assert(idx < (uint64_t(1) << (sizeof(buffer_type) * 8 - INDEX_SHIFT)));
+        return (buffer_type(idx) << INDEX_SHIFT) | (t ? TYPE_MASK : 0) |
+               buffer_type(v);
+    }
+
+    void insert_buffer(uint8_t idx, buffer_type buf) {
+        for (uint8_t i = buffer_count; i > idx; i--) {
+            buffer[i] = buffer[i - 1];
+        }
+        buffer[idx] = buf;
+        buffer_count++;
+    }
+
+    void delete_buffer_element(uint8_t idx) {
+        uint8_t l = --buffer_count;
+        for (; idx < l; idx++) {
+            buffer[idx] = buffer[idx + 1];
+        }
+        buffer[l] = 0;
+    }
+
+    std::vector<uint64_t> words{};
+    uint64_t psum_ = 0;
+    count_type size_ = 0;
+    // number of elements stored in words, size_ with the buffered edits undone
+    count_type phys_size_ = 0;
+
+    buffer_type buffer[buffer_size];
+    uint8_t buffer_count;
+};
+
+/*
+ * Searchable partial sum over integers of int_width bits with buffered
+ * leaves.
+ */
+template <uint8_t int_width, uint8_t buffer_size, uint32_t B_LEAF = 8192,
+          uint32_t B = 16>
+using buffered_spsi =
+    spsi<buffered_int_vector<int_width, buffer_size>, B_LEAF, B>;
+}  // namespace dyn
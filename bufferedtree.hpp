@@ -0,0 +1,1543 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+namespace dyn {
+/*
+ * B-tree of buffered leaves with the interface of DYNAMIC's
+ * succinct_bitvector.
+ *
+ * Works like succinct_bitvector<spsi<leaf_type, B_LEAF, B>> but keeps the
+ * tree in this repository, so that operations can walk several leaves in one
+ * traversal. Leaves are split when they reach B_LEAF bits, internal nodes
+ * when they get more than B children. Empty leaves are removed, but nodes are
+ * not merged.
+ *
+ * Nodes and leaves are reference counted and copied on write, so copying a
+ * tree or taking a snapshot() is O(1) and the copies only diverge where they
+ * are updated. A copy does not write to the tree it is taken from. It
+ * bumps a count of copies, and the paths that push_back and fingers update
+ * in place are copied again when that count changed. Copies and snapshots
+ * still have to be taken on the thread that updates the tree. A snapshot
+ * taken on another thread while push_back runs would share a leaf that the
+ * writer still updates in place. Once taken, snapshots can be read and
+ * destroyed on other threads.
+ */
+template <class leaf_type, uint32_t B_LEAF = 8192, uint32_t B = 16>
+class buffered_tree {
+    static_assert(B_LEAF >= 256, "Leaves need to hold at least 4 words");
+    static_assert(B >= 3 && B < 256, "Branching factor needs to be in [3, 256)");
+
+   public:
+    /*
+     * Leaf with a reference count, shared between trees after a copy.
+     */
+    class shared_leaf : public leaf_type {
+       public:
+        using leaf_type::leaf_type;
+
+        shared_leaf(const shared_leaf& other) : leaf_type(other) {}
+
+        std::atomic<uint32_t> refs{1};
+        // entry in the leaf table of the newest incremental checkpoint, only
+        // valid while generation is the generation of that table
+        uint32_t slot = NO_SLOT;
+        uint64_t generation = 0;
+    };
+
+    static constexpr uint32_t NO_SLOT = ~uint32_t(0);
+
+    class node {
+       public:
+        explicit node(bool has_leaves) : has_leaves_(has_leaves) {}
+
+        /*
+         * shallow copy, the children become shared with other
+         */
+        node(const node& other)
+            : nr_children_(other.nr_children_),
+              has_leaves_(other.has_leaves_) {
+            for (uint32_t j = 0; j < nr_children_; j++) {
+                sizes_[j] = other.sizes_[j];
+                psums_[j] = other.psums_[j];
+                children_[j] = other.children_[j];
+                if (has_leaves_) {
+                    shared(j)->refs.fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    child(j)->refs_.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        ~node() {
+            for (uint32_t j = 0; j < nr_children_; j++) {
+                if (has_leaves_) {
+                    unref(shared(j));
+                } else {
+                    unref(child(j));
+                }
+            }
+        }
+
+        /*
+         * drop a reference, deleting the object with the last one
+         */
+        static void unref(node* n) {
+            if (n->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) delete n;
+        }
+
+        static void unref(shared_leaf* l) {
+            if (l->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete l;
+        }
+
+        void ref() { refs_.fetch_add(1, std::memory_order_relaxed); }
+
+        bool is_shared() const {
+            return refs_.load(std::memory_order_acquire) > 1;
+        }
+
+        uint64_t size() const {
+            return nr_children_ ? sizes_[nr_children_ - 1] : 0;
+        }
+
+        uint64_t psum() const {
+            return nr_children_ ? psums_[nr_children_ - 1] : 0;
+        }
+
+        bool has_leaves() const { return has_leaves_; }
+
+        uint32_t nr_children() const { return nr_children_; }
+
+        node* child(uint32_t j) const {
+            return static_cast<node*>(children_[j]);
+        }
+
+        leaf_type* leaf(uint32_t j) const { return shared(j); }
+
+        shared_leaf* shared(uint32_t j) const {
+            return static_cast<shared_leaf*>(children_[j]);
+        }
+
+        /*
+         * child j, copied first if it is shared with another tree
+         */
+        node* mutable_child(uint32_t j) {
+            node* c = child(j);
+            if (c->is_shared()) {
+                children_[j] = new node(*c);
+                unref(c);
+            }
+            return child(j);
+        }
+
+        leaf_type* mutable_leaf(uint32_t j) {
+            shared_leaf* l = shared(j);
+            if (l->refs.load(std::memory_order_acquire) > 1) {
+                children_[j] = new shared_leaf(*l);
+                unref(l);
+            }
+            return leaf(j);
+        }
+
+        /*
+         * number of bits / ones in children before child j
+         */
+        uint64_t offset(uint32_t j) const { return j ? sizes_[j - 1] : 0; }
+
+        uint64_t ones_before(uint32_t j) const { return j ? psums_[j - 1] : 0; }
+
+        uint64_t child_size(uint32_t j) const {
+            return sizes_[j] - offset(j);
+        }
+
+        uint64_t child_psum(uint32_t j) const {
+            return psums_[j] - ones_before(j);
+        }
+
+        /*
+         * child containing position i
+         */
+        uint32_t find(uint64_t i) const {
+            uint32_t j = 0;
+            while (sizes_[j] <= i) j++;
+            return j;
+        }
+
+        /*
+         * child where an element can be inserted at position i
+         */
+        uint32_t find_insert(uint64_t i) const {
+            uint32_t j = 0;
+            while (j + 1 < nr_children_ && sizes_[j] < i) j++;
+            return j;
+        }
+
+        /*
+         * child containing the (x + 1)-th one
+         */
+        uint32_t find_one(uint64_t x) const {
+            uint32_t j = 0;
+            while (psums_[j] <= x) j++;
+            return j;
+        }
+
+        /*
+         * child containing the (x + 1)-th zero
+         */
+        uint32_t find_zero(uint64_t x) const {
+            uint32_t j = 0;
+            while (sizes_[j] - psums_[j] <= x) j++;
+            return j;
+        }
+
+        void append(void* c) { insert_child(nr_children_, c); }
+
+        void insert_child(uint32_t j, void* c) {
+            for (uint32_t k = nr_children_; k > j; k--) {
+                children_[k] = children_[k - 1];
+            }
+            children_[j] = c;
+            nr_children_++;
+            update_counts(j);
+        }
+
+        /*
+         * removes child j without deleting it
+         */
+        void erase_child(uint32_t j) {
+            nr_children_--;
+            for (uint32_t k = j; k < nr_children_; k++) {
+                children_[k] = children_[k + 1];
+            }
+            update_counts(j);
+        }
+
+        /*
+         * recompute cumulative counts from child j onwards
+         */
+        void update_counts(uint32_t j) {
+            for (; j < nr_children_; j++) {
+                uint64_t s, p;
+                if (has_leaves_) {
+                    s = leaf(j)->size();
+                    p = leaf(j)->psum();
+                } else {
+                    s = child(j)->size();
+                    p = child(j)->psum();
+                }
+                sizes_[j] = offset(j) + s;
+                psums_[j] = ones_before(j) + p;
+            }
+        }
+
+        /*
+         * add size and psum deltas to the counts from child j onwards
+         */
+        void add(uint32_t j, int64_t size_delta, int64_t psum_delta) {
+            for (; j < nr_children_; j++) {
+                sizes_[j] += size_delta;
+                psums_[j] += psum_delta;
+            }
+        }
+
+        /*
+         * moves the upper half of the children to a new right sibling
+         */
+        node* split() {
+            node* right = new node(has_leaves_);
+            uint32_t mid = nr_children_ / 2;
+            for (uint32_t k = mid; k < nr_children_; k++) {
+                right->children_[k - mid] = children_[k];
+            }
+            right->nr_children_ = nr_children_ - mid;
+            nr_children_ = mid;
+            right->update_counts(0);
+            return right;
+        }
+
+        /*
+         * returns the new right sibling if this node had to be split
+         */
+        node* insert(uint64_t i, bool x) {
+            uint32_t j = find_insert(i);
+            i -= offset(j);
+            if (has_leaves_) {
+                leaf_type* l = mutable_leaf(j);
+                l->insert(i, x);
+                if (l->size() >= B_LEAF) {
+                    insert_child(j + 1, l->template split<shared_leaf>());
+                    update_counts(j);
+                } else {
+                    add(j, 1, x);
+                }
+            } else {
+                node* right = mutable_child(j)->insert(i, x);
+                if (right != nullptr) {
+                    insert_child(j + 1, right);
+                    update_counts(j);
+                } else {
+                    add(j, 1, x);
+                }
+            }
+            return nr_children_ > B ? split() : nullptr;
+        }
+
+        /*
+         * appends l as the last leaf of this subtree, returns the new right
+         * sibling if this node had to be split
+         */
+        node* append_leaf(shared_leaf* l) {
+            if (has_leaves_) {
+                append(l);
+            } else {
+                uint32_t j = nr_children_ - 1;
+                node* right = mutable_child(j)->append_leaf(l);
+                update_counts(j);
+                if (right != nullptr) append(right);
+            }
+            return nr_children_ > B ? split() : nullptr;
+        }
+
+        void remove(uint64_t i) {
+            uint32_t j = find(i);
+            i -= offset(j);
+            uint64_t old_psum = child_psum(j);
+            uint64_t new_size;
+            uint64_t new_psum;
+            if (has_leaves_) {
+                mutable_leaf(j)->remove(i);
+                new_size = leaf(j)->size();
+                new_psum = leaf(j)->psum();
+            } else {
+                mutable_child(j)->remove(i);
+                new_size = child(j)->size();
+                new_psum = child(j)->psum();
+            }
+            add(j, -1, int64_t(new_psum) - int64_t(old_psum));
+            if (new_size == 0 && nr_children_ > 1) {
+                if (has_leaves_) {
+                    unref(shared(j));
+                } else {
+                    unref(child(j));
+                }
+                erase_child(j);
+            }
+        }
+
+        void set(uint64_t i, bool x) {
+            uint32_t j = find(i);
+            i -= offset(j);
+            uint64_t old_psum = child_psum(j);
+            uint64_t new_psum;
+            if (has_leaves_) {
+                mutable_leaf(j)->set(i, x);
+                new_psum = leaf(j)->psum();
+            } else {
+                mutable_child(j)->set(i, x);
+                new_psum = child(j)->psum();
+            }
+            add(j, 0, int64_t(new_psum) - int64_t(old_psum));
+        }
+
+        /*
+         * deep copy, nothing is shared with this node
+         */
+        node* clone() const {
+            node* n = new node(has_leaves_);
+            n->nr_children_ = nr_children_;
+            for (uint32_t j = 0; j < nr_children_; j++) {
+                n->sizes_[j] = sizes_[j];
+                n->psums_[j] = psums_[j];
+                if (has_leaves_) {
+                    n->children_[j] = new shared_leaf(*shared(j));
+                } else {
+                    n->children_[j] = child(j)->clone();
+                }
+            }
+            return n;
+        }
+
+        /*
+         * calls f(pointer, bytes, pos) for this node and every node and leaf
+         * below it, pos being the position of their first bit
+         */
+        template <class F>
+        void for_each_block(F& f, uint64_t pos) const {
+            f(static_cast<const void*>(this), sizeof(node), pos);
+            for (uint32_t j = 0; j < nr_children_; j++) {
+                uint64_t off = pos + offset(j);
+                if (has_leaves_) {
+                    leaf(j)->for_each_block(
+                        [&](const void* p, uint64_t bytes) { f(p, bytes, off); });
+                } else {
+                    child(j)->for_each_block(f, off);
+                }
+            }
+        }
+
+        /*
+         * calls f(leaf) for every leaf below this node, from the front
+         */
+        template <class F>
+        void for_each_leaf(F& f) const {
+            for (uint32_t j = 0; j < nr_children_; j++) {
+                if (has_leaves_) {
+                    f(static_cast<const shared_leaf&>(*shared(j)));
+                } else {
+                    child(j)->for_each_leaf(f);
+                }
+            }
+        }
+
+        /*
+         * calls f(leaf) for every leaf below this node, copying the nodes
+         * and leaves that are shared with another tree first
+         */
+        template <class F>
+        void for_each_mutable_leaf(F& f) {
+            for (uint32_t j = 0; j < nr_children_; j++) {
+                if (has_leaves_) {
+                    mutable_leaf(j);
+                    f(*shared(j));
+                } else {
+                    mutable_child(j)->for_each_mutable_leaf(f);
+                }
+            }
+        }
+
+        /*
+         * calls f(leaf) for the leaves below this node overlapping [i, j)
+         */
+        template <class F>
+        void for_each_leaf(F& f, uint64_t i, uint64_t j) const {
+            for (uint32_t c = 0; c < nr_children_ && offset(c) < j; c++) {
+                if (sizes_[c] <= i) continue;
+                uint64_t off = offset(c);
+                if (has_leaves_) {
+                    f(static_cast<const shared_leaf&>(*shared(c)));
+                } else {
+                    child(c)->for_each_leaf(f, i > off ? i - off : 0, j - off);
+                }
+            }
+        }
+
+        uint64_t bit_size() const {
+            uint64_t bits = sizeof(node) * 8;
+            for (uint32_t j = 0; j < nr_children_; j++) {
+                bits += has_leaves_ ? leaf(j)->bit_size() +
+                                          (sizeof(shared_leaf) -
+                                           sizeof(leaf_type)) * 8
+                                    : child(j)->bit_size();
+            }
+            return bits;
+        }
+
+       private:
+        uint64_t sizes_[B + 1];
+        uint64_t psums_[B + 1];
+        void* children_[B + 1];
+        uint32_t nr_children_ = 0;
+        std::atomic<uint32_t> refs_{1};
+        bool has_leaves_;
+    };
+
+    /*
+     * Path from the root to the current leaf, and the global offset of that
+     * leaf and the number of ones before it. Moving to a neighbouring leaf
+     * only walks up the tree as far as needed. With need_ones set, subtrees
+     * without ones are skipped using the node counters.
+     */
+    class leaf_cursor {
+       public:
+        /*
+         * position at the leaf containing i, or at the end of the last leaf
+         * if i == size
+         */
+        void seek(const node* n, uint64_t i) {
+            path_.clear();
+            offset_ = 0;
+            ones_ = 0;
+            while (true) {
+                uint32_t j = i < n->size() ? n->find(i) : n->nr_children() - 1;
+                i -= n->offset(j);
+                offset_ += n->offset(j);
+                ones_ += n->ones_before(j);
+                path_.push_back({n, j});
+                if (n->has_leaves()) return;
+                n = n->child(j);
+            }
+        }
+
+        const leaf_type* leaf() const {
+            return path_.back().first->leaf(path_.back().second);
+        }
+
+        uint64_t offset() const { return offset_; }
+
+        uint64_t ones() const { return ones_; }
+
+        /*
+         * move to the next leaf, returns false if there is none
+         */
+        bool next(bool need_ones) {
+            uint64_t off = offset_ + leaf()->size();
+            uint64_t ones = ones_ + leaf()->psum();
+            for (size_t d = path_.size(); d-- > 0;) {
+                const node* n = path_[d].first;
+                for (uint32_t j = path_[d].second + 1; j < n->nr_children();
+                     j++) {
+                    if (n->child_size(j) && (!need_ones || n->child_psum(j))) {
+                        path_[d].second = j;
+                        path_.resize(d + 1);
+                        offset_ = off;
+                        ones_ = ones;
+                        descend(need_ones, false);
+                        return true;
+                    }
+                    off += n->child_size(j);
+                    ones += n->child_psum(j);
+                }
+            }
+            return false;
+        }
+
+        /*
+         * move to the previous leaf, returns false if there is none
+         */
+        bool prev(bool need_ones) {
+            uint64_t off = offset_;
+            uint64_t ones = ones_;
+            for (size_t d = path_.size(); d-- > 0;) {
+                const node* n = path_[d].first;
+                for (uint32_t j = path_[d].second; j-- > 0;) {
+                    off -= n->child_size(j);
+                    ones -= n->child_psum(j);
+                    if (n->child_size(j) && (!need_ones || n->child_psum(j))) {
+                        path_[d].second = j;
+                        path_.resize(d + 1);
+                        offset_ = off;
+                        ones_ = ones;
+                        descend(need_ones, true);
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+
+        /*
+         * Copies the nodes on the path and the leaf where they are shared
+         * with another tree, starting from root, which must not be shared.
+         * Returns the leaf, which can then be updated in place along with
+         * add().
+         */
+        leaf_type* make_mutable(node* root) {
+            node* n = root;
+            for (size_t d = 0;; d++) {
+                path_[d].first = n;
+                if (n->has_leaves()) return n->mutable_leaf(path_[d].second);
+                n = n->mutable_child(path_[d].second);
+            }
+        }
+
+        /*
+         * adds deltas to the counts on the path, after make_mutable()
+         */
+        void add(int64_t size_delta, int64_t psum_delta) {
+            for (auto& e : path_) {
+                const_cast<node*>(e.first)->add(e.second, size_delta,
+                                                psum_delta);
+            }
+        }
+
+       private:
+        /*
+         * extend the path from the child at the end of the path down to a
+         * leaf, taking the first (last if backwards) child at every level
+         */
+        void descend(bool need_ones, bool backwards) {
+            while (!path_.back().first->has_leaves()) {
+                const node* n = path_.back().first->child(path_.back().second);
+                uint32_t j = backwards ? n->nr_children() - 1 : 0;
+                while (n->child_size(j) == 0 ||
+                       (need_ones && n->child_psum(j) == 0)) {
+                    j += backwards ? -1 : 1;
+                }
+                offset_ += n->offset(j);
+                ones_ += n->ones_before(j);
+                path_.push_back({n, j});
+            }
+        }
+
+        std::vector<std::pair<const node*, uint32_t>> path_;
+        uint64_t offset_ = 0;
+        uint64_t ones_ = 0;
+    };
+
+    /*
+     * Bidirectional iterator over the bits. Keeps a cursor into the current
+     * leaf and decodes 64 bits at a time with the leaf buffer merged in.
+     * Reverse iterators step towards the front and end at position -1.
+     */
+    template <bool reverse>
+    class bit_iterator {
+       public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef bool value_type;
+        typedef int64_t difference_type;
+        typedef void pointer;
+        typedef bool reference;
+
+        bit_iterator(const buffered_tree* tree, uint64_t i, bool end = false)
+            : tree_(tree), pos_(i) {
+            if (end) return;
+            cursor_.seek(tree->root_, i);
+            load();
+        }
+
+        bool operator*() const {
+            return (word_ >> (pos_ - cursor_.offset() - word_start_)) & 1;
+        }
+
+        uint64_t position() const { return pos_; }
+
+        bit_iterator& operator++() {
+            reverse ? backward() : forward();
+            return *this;
+        }
+
+        bit_iterator& operator--() {
+            reverse ? forward() : backward();
+            return *this;
+        }
+
+        bit_iterator operator++(int) {
+            bit_iterator it = *this;
+            ++*this;
+            return it;
+        }
+
+        bit_iterator operator--(int) {
+            bit_iterator it = *this;
+            --*this;
+            return it;
+        }
+
+        bool operator==(const bit_iterator& other) const {
+            return pos_ == other.pos_;
+        }
+
+        bool operator!=(const bit_iterator& other) const {
+            return pos_ != other.pos_;
+        }
+
+       private:
+        void forward() {
+            pos_++;
+            uint64_t leaf_pos = pos_ - cursor_.offset();
+            if (leaf_pos == cursor_.leaf()->size()) {
+                if (pos_ == tree_->size()) return;
+                cursor_.next(false);
+                load();
+            } else if (leaf_pos >= word_start_ + 64) {
+                load();
+            }
+        }
+
+        void backward() {
+            pos_--;
+            if (pos_ == ~uint64_t(0)) return;
+            if (pos_ < cursor_.offset()) {
+                cursor_.prev(false);
+                load();
+            } else if (pos_ - cursor_.offset() < word_start_) {
+                load();
+            }
+        }
+
+        void load() {
+            const leaf_type* l = cursor_.leaf();
+            word_start_ = (pos_ - cursor_.offset()) & ~uint64_t(63);
+            uint64_t len = l->size() > word_start_ ? l->size() - word_start_
+                                                   : 0;
+            word_ = l->get_bits(word_start_, len < 64 ? len : 64);
+        }
+
+        const buffered_tree* tree_;
+        leaf_cursor cursor_;
+        uint64_t pos_;
+        uint64_t word_start_ = 0;
+        uint64_t word_ = 0;
+    };
+
+    typedef bit_iterator<false> const_iterator;
+    typedef bit_iterator<true> const_reverse_iterator;
+
+    /*
+     * Forward iterator over the positions of ones. Skips 64 bits at a time
+     * with tzcnt and skips subtrees without ones.
+     */
+    class one_iterator {
+       public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef uint64_t value_type;
+        typedef int64_t difference_type;
+        typedef void pointer;
+        typedef uint64_t reference;
+
+        one_iterator(const buffered_tree* tree, uint64_t i, bool end = false)
+            : tree_(tree), pos_(i) {
+            if (end) return;
+            cursor_.seek(tree->root_, i);
+            uint64_t leaf_pos = i - cursor_.offset();
+            load(leaf_pos & ~uint64_t(63));
+            word_ &= ~uint64_t(0) << (leaf_pos & 63);
+            advance();
+        }
+
+        uint64_t operator*() const { return pos_; }
+
+        one_iterator& operator++() {
+            word_ &= word_ - 1;
+            advance();
+            return *this;
+        }
+
+        one_iterator operator++(int) {
+            one_iterator it = *this;
+            ++*this;
+            return it;
+        }
+
+        bool operator==(const one_iterator& other) const {
+            return pos_ == other.pos_;
+        }
+
+        bool operator!=(const one_iterator& other) const {
+            return pos_ != other.pos_;
+        }
+
+       private:
+        void advance() {
+            while (word_ == 0) {
+                uint64_t start = word_start_ + 64;
+                if (start >= cursor_.leaf()->size()) {
+                    if (!cursor_.next(true)) {
+                        pos_ = tree_->size();
+                        return;
+                    }
+                    start = 0;
+                }
+                load(start);
+            }
+            pos_ = cursor_.offset() + word_start_ + __builtin_ctzll(word_);
+        }
+
+        void load(uint64_t start) {
+            const leaf_type* l = cursor_.leaf();
+            word_start_ = start;
+            uint64_t len = l->size() > start ? l->size() - start : 0;
+            word_ = l->get_bits(start, len < 64 ? len : 64);
+        }
+
+        const buffered_tree* tree_;
+        leaf_cursor cursor_;
+        uint64_t pos_;
+        uint64_t word_start_ = 0;
+        uint64_t word_ = 0;
+    };
+
+    /*
+     * Finger for local access patterns. Remembers the path to a leaf with
+     * the global offset of the leaf and the ones before it. Positions in
+     * that leaf are served without descending from the root, and positions
+     * in a neighbouring leaf by walking over to it, so sequential and nearly
+     * sequential access never searches the tree. Positions further away seek
+     * from the root.
+     *
+     * Inserts, removes and sets through the finger add their deltas to the
+     * counts on the remembered path and keep the finger in place. Inserts
+     * that split the leaf and removes that empty it go through the tree and
+     * seek again. Any other update of the tree makes the finger seek again
+     * on its next use, and a copy or snapshot makes it copy the path again
+     * on its next update.
+     */
+    class finger {
+       public:
+        explicit finger(buffered_tree& tree, uint64_t i = 0) : tree_(&tree) {
+            seek(i);
+        }
+
+        bool at(uint64_t i) {
+            assert(i < tree_->size());
+            move(i);
+            return leaf()->at(i - cursor_.offset());
+        }
+
+        /*
+         * number of ones in [0, i)
+         */
+        uint64_t rank(uint64_t i) {
+            assert(i <= tree_->size());
+            move(i);
+            return cursor_.ones() + leaf()->rank(i - cursor_.offset());
+        }
+
+        void insert(uint64_t i, bool x) {
+            assert(i <= tree_->size());
+            move(i);
+            if (leaf()->size() + 1 >= B_LEAF) {
+                tree_->insert(i, x);
+                seek(i);
+                return;
+            }
+            writable()->insert(i - cursor_.offset(), x);
+            cursor_.add(1, x);
+            updated();
+        }
+
+        void remove(uint64_t i) {
+            assert(i < tree_->size());
+            move(i);
+            if (leaf()->size() == 1) {
+                tree_->remove(i);
+                seek(i < tree_->size() ? i : tree_->size());
+                return;
+            }
+            leaf_type* l = writable();
+            uint64_t ones = l->psum();
+            l->remove(i - cursor_.offset());
+            cursor_.add(-1, int64_t(l->psum()) - int64_t(ones));
+            updated();
+        }
+
+        void set(uint64_t i, bool x = true) {
+            assert(i < tree_->size());
+            move(i);
+            leaf_type* l = writable();
+            uint64_t ones = l->psum();
+            l->set(i - cursor_.offset(), x);
+            cursor_.add(0, int64_t(l->psum()) - int64_t(ones));
+            updated();
+        }
+
+        /*
+         * global offset of the current leaf and the ones before it
+         */
+        uint64_t offset() const { return cursor_.offset(); }
+
+        uint64_t ones() const { return cursor_.ones(); }
+
+       private:
+        const leaf_type* leaf() const { return cursor_.leaf(); }
+
+        void seek(uint64_t i) {
+            cursor_.seek(tree_->root_, i);
+            version_ = tree_->version_;
+            writable_ = false;
+        }
+
+        /*
+         * Moves to the leaf containing i, or the last leaf if i == size.
+         * Walks over at most MAX_STEPS leaves before seeking from the root.
+         */
+        void move(uint64_t i) {
+            if (version_ != tree_->version_) {
+                seek(i);
+                return;
+            }
+            for (uint32_t step = 0;; step++) {
+                uint64_t off = cursor_.offset();
+                uint64_t end = off + leaf()->size();
+                if (i >= off && (i < end || end == tree_->size())) return;
+                writable_ = false;
+                // Leaves hold less than B_LEAF bits
+                if (step == MAX_STEPS || i + (MAX_STEPS - step) * B_LEAF < off ||
+                    i >= end + (MAX_STEPS - step) * B_LEAF ||
+                    !(i < off ? cursor_.prev(false) : cursor_.next(false))) {
+                    seek(i);
+                    return;
+                }
+            }
+        }
+
+        /*
+         * the current leaf, with the path to it copied where it is shared
+         */
+        leaf_type* writable() {
+            uint64_t copies = buffered_tree::copies();
+            if (!writable_ || copies_ != copies) {
+                leaf_ = cursor_.make_mutable(tree_->mutable_root());
+                writable_ = true;
+                copies_ = copies;
+            }
+            return leaf_;
+        }
+
+        /*
+         * other fingers on the tree need to seek again
+         */
+        void updated() { version_ = ++tree_->version_; }
+
+        static constexpr uint32_t MAX_STEPS = 2;
+
+        buffered_tree* tree_;
+        leaf_cursor cursor_;
+        uint64_t version_ = 0;
+        // the path has been made mutable and leaf_ is the current leaf,
+        // while no copy was taken since, see copies()
+        bool writable_ = false;
+        leaf_type* leaf_ = nullptr;
+        uint64_t copies_ = 0;
+    };
+
+    buffered_tree() {
+        root_ = new node(true);
+        root_->append(new shared_leaf());
+    }
+
+    /*
+     * O(1), the trees share all nodes and leaves until either is updated.
+     * Has to run on the thread that updates other, see copies().
+     */
+    buffered_tree(const buffered_tree& other) : root_(other.root_) {
+        root_->ref();
+        copied();
+    }
+
+    buffered_tree& operator=(const buffered_tree& other) {
+        if (this != &other) {
+            other.root_->ref();
+            node::unref(root_);
+            root_ = other.root_;
+            tail_ = nullptr;
+            version_++;
+            copied();
+        }
+        return *this;
+    }
+
+    ~buffered_tree() { node::unref(root_); }
+
+    /*
+     * Read only view of the current contents. Later updates to this tree
+     * copy the leaves and nodes they touch instead of changing the view.
+     * Like a copy, it has to be taken on the thread that updates the tree.
+     */
+    buffered_tree snapshot() const { return *this; }
+
+    /*
+     * Deep copy. Unlike a copy or snapshot nothing is shared, and all nodes
+     * and leaves are allocated by the calling thread, which places them on
+     * its NUMA node under the default first-touch policy.
+     */
+    buffered_tree clone() const {
+        buffered_tree res;
+        node::unref(res.root_);
+        res.root_ = root_->clone();
+        return res;
+    }
+
+    /*
+     * calls f(pointer, bytes, pos) for every allocation of the tree, pos
+     * being the position of the first bit of the node or leaf it belongs to
+     */
+    template <class F>
+    void for_each_block(F f) const {
+        root_->for_each_block(f, 0);
+    }
+
+    /*
+     * calls f(const shared_leaf&) for every leaf from the front
+     */
+    template <class F>
+    void for_each_leaf(F f) const {
+        static_cast<const node*>(root_)->for_each_leaf(f);
+    }
+
+    /*
+     * Calls f(shared_leaf&) for every leaf from the front. Leaves and nodes
+     * shared with copies of the tree are copied first, so f can change the
+     * leaves, but not their size or number of ones.
+     */
+    template <class F>
+    void for_each_leaf(F f) {
+        version_++;
+        mutable_root()->for_each_mutable_leaf(f);
+    }
+
+    /*
+     * calls f(const shared_leaf&) for the leaves overlapping [i, j)
+     */
+    template <class F>
+    void for_each_leaf(uint64_t i, uint64_t j, F f) const {
+        static_cast<const node*>(root_)->for_each_leaf(f, i, j);
+    }
+
+    /*
+     * Replaces the contents with the given leaves, in order. The tree takes
+     * ownership of them.
+     */
+    void assign_leaves(const std::vector<shared_leaf*>& leaves) {
+        std::vector<void*> level(leaves.begin(), leaves.end());
+        build(level);
+    }
+
+    uint64_t size() const { return root_->size(); }
+
+    /*
+     * total number of ones
+     */
+    uint64_t psum() const { return root_->psum(); }
+
+    bool at(uint64_t i) const {
+        assert(i < size());
+        const node* n = root_;
+        while (true) {
+            uint32_t j = n->find(i);
+            i -= n->offset(j);
+            if (n->has_leaves()) return n->leaf(j)->at(i);
+            n = n->child(j);
+        }
+    }
+
+    bool operator[](uint64_t i) const { return at(i); }
+
+    /*
+     * number of ones in [0, i)
+     */
+    uint64_t rank(uint64_t i) const {
+        assert(i <= size());
+        if (i == size()) return psum();
+        uint64_t count = 0;
+        const node* n = root_;
+        while (true) {
+            uint32_t j = n->find(i);
+            i -= n->offset(j);
+            count += n->ones_before(j);
+            if (n->has_leaves()) return count + n->leaf(j)->rank(i);
+            n = n->child(j);
+        }
+    }
+
+    uint64_t rank0(uint64_t i) const { return i - rank(i); }
+
+    /*
+     * position of the (x + 1)-th one
+     */
+    uint64_t select(uint64_t x) const {
+        assert(x < psum());
+        uint64_t pos = 0;
+        const node* n = root_;
+        while (true) {
+            uint32_t j = n->find_one(x);
+            x -= n->ones_before(j);
+            pos += n->offset(j);
+            if (n->has_leaves()) return pos + n->leaf(j)->search(x + 1);
+            n = n->child(j);
+        }
+    }
+
+    /*
+     * position of the (x + 1)-th zero
+     */
+    uint64_t select0(uint64_t x) const {
+        assert(x < size() - psum());
+        uint64_t pos = 0;
+        const node* n = root_;
+        while (true) {
+            uint32_t j = n->find_zero(x);
+            x -= n->offset(j) - n->ones_before(j);
+            pos += n->offset(j);
+            if (n->has_leaves()) return pos + n->leaf(j)->search_0(x + 1);
+            n = n->child(j);
+        }
+    }
+
+    /*
+     * position of the first one at or after i, size() if there is none
+     */
+    uint64_t next_one(uint64_t i) const {
+        return i < size() ? next_bit<true>(root_, i) : size();
+    }
+
+    /*
+     * position of the first zero at or after i, size() if there is none
+     */
+    uint64_t next_zero(uint64_t i) const {
+        return i < size() ? next_bit<false>(root_, i) : size();
+    }
+
+    /*
+     * position of the last one at or before i, size() if there is none
+     */
+    uint64_t prev_one(uint64_t i) const {
+        assert(i < size());
+        return prev_bit<true>(root_, i);
+    }
+
+    /*
+     * position of the last zero at or before i, size() if there is none
+     */
+    uint64_t prev_zero(uint64_t i) const {
+        assert(i < size());
+        return prev_bit<false>(root_, i);
+    }
+
+    void insert(uint64_t i, bool x) {
+        assert(i <= size());
+        version_++;
+        // The last leaf may be split
+        if (tail_ != nullptr && i + tail_->size() >= size()) tail_ = nullptr;
+        grow(mutable_root()->insert(i, x));
+    }
+
+    /*
+     * Appends to the last leaf without searching the tree, unless the leaf
+     * is about to be split.
+     */
+    void push_back(bool x) {
+        version_++;
+        leaf_type* t = tail();
+        if (t->size() + 1 >= B_LEAF) {
+            insert(size(), x);
+            return;
+        }
+        t->push_back(x);
+        add_to_tail(1, x);
+    }
+
+    /*
+     * Appends the first nbits bits of data. The last leaf is filled a word
+     * at a time and the rest goes into new leaves built in bulk.
+     */
+    void append_words(const uint64_t* data, uint64_t nbits) {
+        version_++;
+        uint64_t done = 0;
+        leaf_type* t = tail();
+        if (t->size() < BULK_LEAF) {
+            uint64_t room = BULK_LEAF - t->size();
+            done = room < nbits ? room : nbits;
+            uint64_t ones = t->psum();
+            t->append_bits(data, 0, done);
+            add_to_tail(done, t->psum() - ones);
+        }
+        while (done < nbits) {
+            uint64_t len = nbits - done < BULK_LEAF ? nbits - done : BULK_LEAF;
+            shared_leaf* l = new shared_leaf();
+            l->append_bits(data, done, len);
+            grow(mutable_root()->append_leaf(l));
+            tail_ = l;
+            done += len;
+        }
+    }
+
+    void remove(uint64_t i) {
+        assert(i < size());
+        version_++;
+        // The last leaf may be removed when it becomes empty
+        if (tail_ != nullptr && i + tail_->size() >= size()) tail_ = nullptr;
+        mutable_root()->remove(i);
+        // Only the old root is exclusive to this tree, the nodes it
+        // collapses into can be shared with snapshots
+        while (!root_->has_leaves() && root_->nr_children() == 1) {
+            node* old = root_;
+            root_ = old->child(0);
+            root_->ref();
+            node::unref(old);
+        }
+    }
+
+    void set(uint64_t i, bool x = true) {
+        assert(i < size());
+        version_++;
+        mutable_root()->set(i, x);
+    }
+
+    /*
+     * n <= 64 bits starting from i, with bit i in the least significant
+     * position
+     */
+    uint64_t get_bits(uint64_t i, uint8_t n) const {
+        assert(n <= 64);
+        assert(i + n <= size());
+        // the leaves may write the word after the last bit they copy
+        uint64_t w[2] = {0, 0};
+        extract(i, i + n, w);
+        return w[0];
+    }
+
+    /*
+     * copy bits [i, j) to out, which needs to hold ceil((j - i) / 64) words
+     */
+    void extract(uint64_t i, uint64_t j, uint64_t* out) const {
+        assert(i <= j && j <= size());
+        if (i < j) extract(root_, i, j, out, 0);
+    }
+
+    /*
+     * number of ones in [i, j)
+     */
+    uint64_t count_ones(uint64_t i, uint64_t j) const {
+        assert(i <= j && j <= size());
+        return i < j ? count_ones(root_, i, j) : 0;
+    }
+
+    enum bitwise_op { AND, OR, XOR, ANDNOT };
+
+    /*
+     * Replaces the contents with a op b (a & ~b for ANDNOT). The result has
+     * the length of the longer operand, the shorter one is padded with zeros.
+     * Both operands are read leaf by leaf and the result is built from full
+     * leaves without going through insert, so a or b may be this tree.
+     */
+    void assign(bitwise_op op, const buffered_tree& a, const buffered_tree& b) {
+        uint64_t n = a.size() > b.size() ? a.size() : b.size();
+        std::vector<void*> leaves;
+        leaves.reserve(n / BULK_LEAF + 1);
+        leaf_reader ra(a);
+        leaf_reader rb(b);
+        uint64_t wa[BULK_LEAF / 64];
+        uint64_t wb[BULK_LEAF / 64];
+        for (uint64_t i = 0; i < n; i += BULK_LEAF) {
+            uint64_t len = n - i < BULK_LEAF ? n - i : BULK_LEAF;
+            uint64_t nr_words = (len + 63) / 64;
+            ra.read(wa, len);
+            rb.read(wb, len);
+            std::vector<uint64_t> words(nr_words);
+            uint64_t ones;
+            switch (op) {
+                case AND:
+                    ones = combine(wa, wb, words.data(), nr_words,
+                                   [](uint64_t x, uint64_t y) { return x & y; });
+                    break;
+                case OR:
+                    ones = combine(wa, wb, words.data(), nr_words,
+                                   [](uint64_t x, uint64_t y) { return x | y; });
+                    break;
+                case XOR:
+                    ones = combine(wa, wb, words.data(), nr_words,
+                                   [](uint64_t x, uint64_t y) { return x ^ y; });
+                    break;
+                default:
+                    ones = combine(wa, wb, words.data(), nr_words,
+                                   [](uint64_t x, uint64_t y) { return x & ~y; });
+                    break;
+            }
+            leaves.push_back(new shared_leaf(std::move(words), len, ones));
+        }
+        build(leaves);
+    }
+
+    void bitwise_and(const buffered_tree& other) { assign(AND, *this, other); }
+
+    void bitwise_or(const buffered_tree& other) { assign(OR, *this, other); }
+
+    void bitwise_xor(const buffered_tree& other) { assign(XOR, *this, other); }
+
+    void bitwise_andnot(const buffered_tree& other) {
+        assign(ANDNOT, *this, other);
+    }
+
+    uint64_t bit_size() const {
+        return sizeof(buffered_tree) * 8 + root_->bit_size();
+    }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+
+    const_iterator end() const { return const_iterator(this, size(), true); }
+
+    /*
+     * iterator starting from position i
+     */
+    const_iterator iterator_at(uint64_t i) const {
+        assert(i <= size());
+        return const_iterator(this, i, i == size());
+    }
+
+    const_reverse_iterator rbegin() const {
+        return size() ? const_reverse_iterator(this, size() - 1) : rend();
+    }
+
+    const_reverse_iterator rend() const {
+        return const_reverse_iterator(this, ~uint64_t(0), true);
+    }
+
+    /*
+     * iterator over the positions of ones at or after i
+     */
+    one_iterator ones(uint64_t i = 0) const {
+        assert(i <= size());
+        return one_iterator(this, i, i == size());
+    }
+
+    one_iterator ones_end() const { return one_iterator(this, size(), true); }
+
+    void print() const {
+        std::cout << "Tree: " << size() << " elems and " << psum() << " ones"
+                  << std::endl;
+    }
+
+   private:
+    /*
+     * Leaves built in bulk get this many bits, which leaves room for inserts
+     * before the first split.
+     */
+    static constexpr uint64_t BULK_LEAF = (B_LEAF * 3 / 4) & ~uint64_t(63);
+
+    /*
+     * Reads the bits of a tree from the front, one leaf at a time.
+     */
+    class leaf_reader {
+       public:
+        explicit leaf_reader(const buffered_tree& tree)
+            : remaining_(tree.size()) {
+            cursor_.seek(tree.root_, 0);
+        }
+
+        /*
+         * writes the next n bits to out, zeros past the end of the tree
+         */
+        void read(uint64_t* out, uint64_t n) {
+            std::fill(out, out + (n + 63) / 64, 0);
+            uint64_t done = 0;
+            while (done < n && remaining_ > 0) {
+                const leaf_type* l = cursor_.leaf();
+                if (pos_ == l->size()) {
+                    cursor_.next(false);
+                    pos_ = 0;
+                    continue;
+                }
+                uint64_t take = l->size() - pos_;
+                if (take > n - done) take = n - done;
+                l->extract(pos_, pos_ + take, out, done);
+                pos_ += take;
+                done += take;
+                remaining_ -= take;
+            }
+        }
+
+       private:
+        leaf_cursor cursor_;
+        uint64_t pos_ = 0;
+        uint64_t remaining_;
+    };
+
+    /*
+     * out[k] = f(a[k], b[k]), returns the number of ones in out
+     */
+    template <class F>
+    static uint64_t combine(const uint64_t* a, const uint64_t* b, uint64_t* out,
+                            uint64_t n, F f) {
+        uint64_t ones = 0;
+        for (uint64_t k = 0; k < n; k++) {
+            out[k] = f(a[k], b[k]);
+            ones += __builtin_popcountll(out[k]);
+        }
+        return ones;
+    }
+
+    /*
+     * replaces the tree with one built bottom up from the given leaves
+     */
+    void build(std::vector<void*>& level) {
+        if (level.empty()) level.push_back(new shared_leaf());
+        bool has_leaves = true;
+        do {
+            // Spread the children evenly so no node ends up nearly empty
+            uint64_t nr_nodes = (level.size() + B - 1) / B;
+            std::vector<void*> parents;
+            parents.reserve(nr_nodes);
+            uint64_t k = 0;
+            for (uint64_t p = 0; p < nr_nodes; p++) {
+                node* n = new node(has_leaves);
+                uint64_t end = level.size() * (p + 1) / nr_nodes;
+                for (; k < end; k++) n->append(level[k]);
+                parents.push_back(n);
+            }
+            level.swap(parents);
+            has_leaves = false;
+        } while (level.size() > 1);
+        node::unref(root_);
+        root_ = static_cast<node*>(level[0]);
+        tail_ = nullptr;
+        version_++;
+    }
+
+    /*
+     * adds a new root above the old one if the old root was split
+     */
+    void grow(node* right) {
+        if (right == nullptr) return;
+        node* new_root = new node(false);
+        new_root->append(root_);
+        new_root->append(right);
+        root_ = new_root;
+    }
+
+    /*
+     * root, copied first if it is shared with another tree
+     */
+    node* mutable_root() {
+        if (root_->is_shared()) {
+            node* old = root_;
+            root_ = new node(*old);
+            node::unref(old);
+        }
+        return root_;
+    }
+
+    /*
+     * Last leaf, found by descending along the last children if not cached.
+     * The path to it is copied where shared, so the cached leaf and the
+     * nodes above it can be updated in place until the next copy of a tree
+     * is taken.
+     */
+    leaf_type* tail() {
+        if (tail_ == nullptr || tail_copies_ != copies()) {
+            tail_copies_ = copies();
+            node* n = mutable_root();
+            while (!n->has_leaves()) {
+                n = n->mutable_child(n->nr_children() - 1);
+            }
+            tail_ = n->mutable_leaf(n->nr_children() - 1);
+        }
+        return tail_;
+    }
+
+    /*
+     * adds the deltas to the counts on the path to the last leaf
+     */
+    void add_to_tail(int64_t size_delta, int64_t psum_delta) {
+        node* n = root_;
+        while (true) {
+            n->add(n->nr_children() - 1, size_delta, psum_delta);
+            if (n->has_leaves()) return;
+            n = n->child(n->nr_children() - 1);
+        }
+    }
+
+    /*
+     * Visits the children overlapping [i, j) in order. Children fully inside
+     * the range are summed from the counts without descending.
+     */
+    uint64_t count_ones(const node* n, uint64_t i, uint64_t j) const {
+        uint64_t count = 0;
+        for (uint32_t c = n->find(i); c < n->nr_children(); c++) {
+            uint64_t off = n->offset(c);
+            if (off >= j) break;
+            uint64_t lo = i > off ? i - off : 0;
+            uint64_t hi = j - off < n->child_size(c) ? j - off
+                                                     : n->child_size(c);
+            if (lo == 0 && hi == n->child_size(c)) {
+                count += n->child_psum(c);
+            } else if (n->has_leaves()) {
+                count += n->leaf(c)->count_ones(lo, hi);
+            } else {
+                count += count_ones(n->child(c), lo, hi);
+            }
+        }
+        return count;
+    }
+
+    /*
+     * number of elements equal to bit in child c of n
+     */
+    template <bool bit>
+    static uint64_t child_count(const node* n, uint32_t c) {
+        return bit ? n->child_psum(c) : n->child_size(c) - n->child_psum(c);
+    }
+
+    /*
+     * Tries the child containing i first and then the following children,
+     * skipping children whose counts show they hold no matching bit. Returns
+     * n->size() if there is no match.
+     */
+    template <bool bit>
+    uint64_t next_bit(const node* n, uint64_t i) const {
+        for (uint32_t c = n->find(i); c < n->nr_children(); c++) {
+            if (child_count<bit>(n, c) == 0) continue;
+            uint64_t off = n->offset(c);
+            uint64_t lo = i > off ? i - off : 0;
+            uint64_t r;
+            if (n->has_leaves()) {
+                r = bit ? n->leaf(c)->next_one(lo) : n->leaf(c)->next_zero(lo);
+            } else {
+                r = next_bit<bit>(n->child(c), lo);
+            }
+            if (r < n->child_size(c)) return off + r;
+        }
+        return n->size();
+    }
+
+    template <bool bit>
+    uint64_t prev_bit(const node* n, uint64_t i) const {
+        uint32_t first = n->find(i);
+        for (uint32_t c = first + 1; c-- > 0;) {
+            if (child_count<bit>(n, c) == 0) continue;
+            uint64_t off = n->offset(c);
+            uint64_t hi = c == first ? i - off : n->child_size(c) - 1;
+            uint64_t r;
+            if (n->has_leaves()) {
+                r = bit ? n->leaf(c)->prev_one(hi) : n->leaf(c)->prev_zero(hi);
+            } else {
+                r = prev_bit<bit>(n->child(c), hi);
+            }
+            if (r < n->child_size(c)) return off + r;
+        }
+        return n->size();
+    }
+
+    void extract(const node* n, uint64_t i, uint64_t j, uint64_t* out,
+                 uint64_t out_pos) const {
+        for (uint32_t c = n->find(i); c < n->nr_children(); c++) {
+            uint64_t off = n->offset(c);
+            if (off >= j) break;
+            uint64_t lo = i > off ? i - off : 0;
+            uint64_t hi = j - off < n->child_size(c) ? j - off
+                                                     : n->child_size(c);
+            if (n->has_leaves()) {
+                n->leaf(c)->extract(lo, hi, out, out_pos);
+            } else {
+                extract(n->child(c), lo, hi, out, out_pos);
+            }
+            out_pos += hi - lo;
+        }
+    }
+
+    /*
+     * Number of copies taken of trees of this type. A copy shares the path
+     * to the cached last leaf and the paths of fingers, which are only
+     * updated in place while the count is unchanged. Counting all trees
+     * means a copy does not write to the tree it is taken from, at the cost
+     * of copying a path again after unrelated copies.
+     */
+    static uint64_t copies() {
+        return copy_count().load(std::memory_order_relaxed);
+    }
+
+    static void copied() {
+        copy_count().fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static std::atomic<uint64_t>& copy_count() {
+        static std::atomic<uint64_t> count{0};
+        return count;
+    }
+
+    node* root_;
+    // last leaf, nullptr when it needs to be looked up again
+    leaf_type* tail_ = nullptr;
+    // copies() when tail_ was looked up
+    uint64_t tail_copies_ = 0;
+    // changes with every update, so fingers know when to seek
+    uint64_t version_ = 0;
+};
+}  // namespace dyn
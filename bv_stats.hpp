@@ -0,0 +1,128 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#ifdef BV_STATS
+#define BV_STAT(...) __VA_ARGS__
+#else
+#define BV_STAT(...)
+#endif
+
+namespace dyn {
+/*
+ * Estimate of the bytes a glibc style malloc spends on an allocation of the
+ * given size on top of the requested bytes: an 8 byte chunk header, 16 byte
+ * alignment and a 32 byte minimum chunk.
+ */
+inline uint64_t malloc_overhead(uint64_t bytes) {
+    uint64_t chunk = (bytes + 8 + 15) & ~uint64_t(15);
+    return (chunk < 32 ? 32 : chunk) - bytes;
+}
+
+/*
+ * Process wide event counters for buffered_packed_vector.
+ *
+ * The hooks in bufferedbv.hpp are wrapped in BV_STAT(...) and compile to
+ * nothing unless BV_STATS is defined (cmake -DBV_STATS=ON). When tracing is
+ * enabled commit and split events are additionally recorded with timestamps
+ * and can be written out in Chrome trace format (chrome://tracing).
+ */
+struct bv_stats {
+    typedef std::chrono::steady_clock clock;
+
+    struct event {
+        const char* name;
+        double ts;
+        double dur;
+        uint64_t size;
+        uint8_t buffer;
+    };
+
+    inline static uint64_t inserts = 0;
+    inline static uint64_t removes = 0;
+    inline static uint64_t sets = 0;
+    // insert that turned a buffered removal into a set
+    inline static uint64_t insert_cancels = 0;
+    // remove that deleted a buffered insertion
+    inline static uint64_t remove_cancels = 0;
+    inline static uint64_t commits = 0;
+    inline static uint64_t splits = 0;
+    // buffer_count after each insert/remove
+    inline static uint64_t occupancy[65] = {};
+    // buffer_count at the start of each commit
+    inline static uint64_t commit_fill[65] = {};
+
+    // live leaves and their word storage, for space accounting
+    inline static int64_t leaves = 0;
+    inline static int64_t word_capacity = 0;
+    inline static int64_t word_malloc_overhead = 0;
+
+    inline static bool tracing = false;
+    inline static uint64_t max_events = uint64_t(1) << 20;
+    inline static std::vector<event> events{};
+    inline static const clock::time_point epoch = clock::now();
+
+    static void reset() {
+        inserts = removes = sets = 0;
+        insert_cancels = remove_cancels = 0;
+        commits = splits = 0;
+        std::fill(occupancy, occupancy + 65, 0);
+        std::fill(commit_fill, commit_fill + 65, 0);
+        events.clear();
+    }
+
+    static void resized(uint64_t old_capacity, uint64_t new_capacity) {
+        word_capacity += int64_t(new_capacity) - int64_t(old_capacity);
+        if (old_capacity) {
+            word_malloc_overhead -= malloc_overhead(old_capacity * 8);
+        }
+        if (new_capacity) {
+            word_malloc_overhead += malloc_overhead(new_capacity * 8);
+        }
+    }
+
+    static clock::time_point now() { return clock::now(); }
+
+    static void record(const char* name, clock::time_point start,
+                       uint64_t size, uint8_t buffer) {
+        if (!tracing || events.size() >= max_events) return;
+        auto end = clock::now();
+        std::chrono::duration<double, std::micro> ts = start - epoch;
+        std::chrono::duration<double, std::micro> dur = end - start;
+        events.push_back({name, ts.count(), dur.count(), size, buffer});
+    }
+
+    static void print(std::ostream& out) {
+        out << "inserts\t" << inserts << "\n"
+            << "removes\t" << removes << "\n"
+            << "sets\t" << sets << "\n"
+            << "ins_cancel\t" << insert_cancels << "\n"
+            << "rem_cancel\t" << remove_cancels << "\n"
+            << "commits\t" << commits << "\n"
+            << "splits\t" << splits << "\n"
+            << "buf\toccupancy\tcommit_fill\n";
+        for (size_t i = 0; i < 65; i++) {
+            if (occupancy[i] == 0 && commit_fill[i] == 0) continue;
+            out << i << "\t" << occupancy[i] << "\t" << commit_fill[i] << "\n";
+        }
+        out << std::flush;
+    }
+
+    static void write_trace(std::ostream& out) {
+        out << "{\"traceEvents\":[";
+        for (size_t i = 0; i < events.size(); i++) {
+            const event& e = events[i];
+            out << (i ? ",\n" : "\n") << "{\"name\":\"" << e.name
+                << "\",\"cat\":\"leaf\",\"ph\":\"X\",\"pid\":1,\"tid\":1"
+                << ",\"ts\":" << e.ts << ",\"dur\":" << e.dur
+                << ",\"args\":{\"size\":" << e.size
+                << ",\"buffer\":" << uint32_t(e.buffer) << "}}";
+        }
+        out << "\n],\"displayTimeUnit\":\"ns\"}" << std::endl;
+    }
+};
+}  // namespace dyn
@@ -0,0 +1,301 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "log_io.hpp"
+
+namespace dyn {
+/*
+ * Incremental checkpoints of a buffered_tree.
+ *
+ * A checkpoint directory holds a base file and the deltas delta.1, delta.2,
+ * ... written after it. Every file ends with a table that has an entry for
+ * each leaf of the tree when the file was written: the leaf's size and the
+ * file and offset of its words. A delta only gets the words of the leaves
+ * that changed since the previous checkpoint, which buffered_packed_vector
+ * tracks with its dirty flag. The entries of the other leaves point into
+ * older files. A delta thus costs the leaves touched plus 16 bytes per leaf
+ * for the table, and the newest file always describes the whole tree.
+ *
+ * compact() copies the leaves of the newest table into a new base and drops
+ * the deltas. Files are written under a temporary name and renamed when
+ * complete, and deltas carry the id of their base, so a crash at any point
+ * leaves a readable checkpoint.
+ *
+ * Each leaf remembers its entry in the newest table and the generation of
+ * that table. A checkpoint updates the leaves through the mutable
+ * for_each_leaf, which first copies the leaves shared with copies and
+ * snapshots of the tree, so those are written again. A tree rolled back to
+ * a snapshot has clean leaves whose entries are in an older table. Their
+ * generation no longer matches, and they are written again too. I/O errors
+ * are fatal.
+ */
+template <class T>
+class incremental_checkpoint {
+    typedef typename T::shared_leaf leaf;
+
+   public:
+    /*
+     * Opens or creates the checkpoint directory dir. If it holds a
+     * checkpoint, the contents of tree are replaced with it.
+     */
+    incremental_checkpoint(T& tree, const std::string& dir)
+        : tree_(tree), dir_(dir) {
+        if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+            log_file::fail(dir);
+        }
+        load();
+    }
+
+    /*
+     * Writes the leaves changed since the last checkpoint to a new delta, or
+     * all leaves to the base if there is none yet. Returns the number of
+     * bytes written.
+     */
+    uint64_t checkpoint() {
+        bool full = !has_base_;
+        uint32_t file = full ? 0 : deltas_ + 1;
+        uint64_t id = full ? base_id_ + 1 : base_id_;
+        std::vector<entry> table;
+        std::vector<uint64_t> words;
+        uint64_t offset = sizeof(header);
+        uint64_t generation = next_generation();
+        FILE* f = create(file);
+        tree_.for_each_leaf([&](leaf& l) {
+            entry e;
+            if (full || l.dirty() || l.generation != generation_) {
+                uint64_t nr_words = (l.size() + 63) / 64;
+                words.assign(nr_words, 0);
+                if (l.size()) l.extract(0, l.size(), words.data());
+                write(f, words.data(), nr_words * 8, file);
+                e = entry{offset, uint32_t(l.size()), file};
+                offset += nr_words * 8;
+                l.mark_clean();
+            } else {
+                e = table_[l.slot];
+            }
+            l.slot = table.size();
+            l.generation = generation;
+            table.push_back(e);
+        });
+        uint64_t bytes = finish(f, file, id, offset, table);
+        table_.swap(table);
+        generation_ = generation;
+        if (full) {
+            has_base_ = true;
+            base_id_ = id;
+        } else {
+            deltas_++;
+        }
+        return bytes;
+    }
+
+    /*
+     * Merges the base and the deltas into a new base, without changing the
+     * tree. Returns the number of bytes written.
+     */
+    uint64_t compact() {
+        if (deltas_ == 0) return 0;
+        std::vector<FILE*> files(deltas_ + 1, nullptr);
+        std::vector<entry> table(table_.size());
+        std::vector<uint64_t> words;
+        uint64_t offset = sizeof(header);
+        FILE* f = create(0);
+        for (uint64_t k = 0; k < table_.size(); k++) {
+            const entry& e = table_[k];
+            uint64_t bytes = (e.size + 63) / 64 * 8;
+            words.resize(bytes / 8);
+            read(files, e.file, words.data(), bytes, e.offset);
+            write(f, words.data(), bytes, 0);
+            table[k] = entry{offset, e.size, 0};
+            offset += bytes;
+        }
+        for (FILE* in : files) {
+            if (in != nullptr) fclose(in);
+        }
+        uint64_t bytes = finish(f, 0, base_id_ + 1, offset, table);
+        base_id_++;
+        for (uint32_t d = 1; d <= deltas_; d++) unlink(path(d).c_str());
+        deltas_ = 0;
+        // Same leaves in the same order, so the leaves' slots stay valid
+        table_.swap(table);
+        return bytes;
+    }
+
+    uint32_t deltas() const { return deltas_; }
+
+    /*
+     * number of leaves in the newest table
+     */
+    uint64_t leaves() const { return table_.size(); }
+
+   private:
+    static constexpr char MAGIC[8] = {'B', 'V', 'C', 'K', 'P', 'I', 'N', '1'};
+
+    struct header {
+        char magic[8];
+        uint64_t base_id;
+        uint64_t table_offset;
+        uint64_t leaves;
+    };
+
+    struct entry {
+        uint64_t offset;
+        uint32_t size;
+        uint32_t file;
+    };
+
+    /*
+     * Unique across all checkpoints in the process, so that a leaf shared
+     * with a tree of another checkpoint never matches by accident
+     */
+    static uint64_t next_generation() {
+        static std::atomic<uint64_t> generation{0};
+        return ++generation;
+    }
+
+    std::string path(uint32_t file) const {
+        return dir_ + (file ? "/delta." + std::to_string(file) : "/base");
+    }
+
+    void write(FILE* f, const void* data, uint64_t bytes, uint32_t file) {
+        if (bytes && fwrite(data, 1, bytes, f) != bytes) {
+            log_file::fail(path(file));
+        }
+    }
+
+    /*
+     * reads bytes at offset of file, opening it if needed
+     */
+    void read(std::vector<FILE*>& files, uint32_t file, void* data,
+              uint64_t bytes, uint64_t offset) {
+        if (files[file] == nullptr) {
+            files[file] = fopen(path(file).c_str(), "rb");
+            if (files[file] == nullptr) log_file::fail(path(file));
+        }
+        if (bytes == 0) return;
+        if (fseeko(files[file], offset, SEEK_SET) != 0 ||
+            fread(data, 1, bytes, files[file]) != bytes) {
+            std::cerr << path(file) << " is truncated" << std::endl;
+            exit(1);
+        }
+    }
+
+    /*
+     * opens the temporary file for file, leaving room for the header
+     */
+    FILE* create(uint32_t file) {
+        std::string tmp = path(file) + ".tmp";
+        FILE* f = fopen(tmp.c_str(), "wb");
+        if (f == nullptr) log_file::fail(tmp);
+        if (fseeko(f, sizeof(header), SEEK_SET) != 0) log_file::fail(tmp);
+        return f;
+    }
+
+    /*
+     * Appends the table and the header, syncs the file and renames it to its
+     * final name. Returns the size of the file.
+     */
+    uint64_t finish(FILE* f, uint32_t file, uint64_t id, uint64_t offset,
+                    const std::vector<entry>& table) {
+        std::string tmp = path(file) + ".tmp";
+        write(f, table.data(), table.size() * sizeof(entry), file);
+        header h;
+        memcpy(h.magic, MAGIC, sizeof(h.magic));
+        h.base_id = id;
+        h.table_offset = offset;
+        h.leaves = table.size();
+        if (fseeko(f, 0, SEEK_SET) != 0) log_file::fail(tmp);
+        write(f, &h, sizeof(h), file);
+        if (fflush(f) != 0 || fsync(fileno(f)) != 0) log_file::fail(tmp);
+        fclose(f);
+        if (rename(tmp.c_str(), path(file).c_str()) != 0) log_file::fail(tmp);
+        int dir = open(dir_.c_str(), O_RDONLY | O_DIRECTORY);
+        if (dir < 0 || fsync(dir) != 0) log_file::fail(dir_);
+        close(dir);
+        return offset + table.size() * sizeof(entry);
+    }
+
+    /*
+     * reads the header and table of file, false if it does not exist
+     */
+    bool read_table(uint32_t file, header& h, std::vector<entry>& table) {
+        FILE* f = fopen(path(file).c_str(), "rb");
+        if (f == nullptr) return false;
+        if (fread(&h, sizeof(h), 1, f) != 1 ||
+            memcmp(h.magic, MAGIC, sizeof(h.magic)) != 0) {
+            std::cerr << path(file) << " is not a checkpoint" << std::endl;
+            exit(1);
+        }
+        table.resize(h.leaves);
+        if (fseeko(f, h.table_offset, SEEK_SET) != 0 ||
+            fread(table.data(), sizeof(entry), h.leaves, f) != h.leaves) {
+            std::cerr << path(file) << " is truncated" << std::endl;
+            exit(1);
+        }
+        fclose(f);
+        return true;
+    }
+
+    void load() {
+        header h;
+        if (!read_table(0, h, table_)) return;
+        has_base_ = true;
+        base_id_ = h.base_id;
+        std::vector<entry> table;
+        while (read_table(deltas_ + 1, h, table)) {
+            // Deltas of an older base are left over from a compaction
+            if (h.base_id != base_id_) break;
+            deltas_++;
+            table_.swap(table);
+        }
+        uint32_t stale = deltas_ + 1;
+        while (unlink(path(stale).c_str()) == 0) stale++;
+
+        generation_ = next_generation();
+        std::vector<FILE*> files(deltas_ + 1, nullptr);
+        std::vector<leaf*> leaves;
+        leaves.reserve(table_.size());
+        for (uint64_t k = 0; k < table_.size(); k++) {
+            const entry& e = table_[k];
+            leaf* l;
+            if (e.size == 0) {
+                l = new leaf();
+            } else {
+                std::vector<uint64_t> words((e.size + 63) / 64);
+                read(files, e.file, words.data(), words.size() * 8, e.offset);
+                l = new leaf(std::move(words), e.size);
+            }
+            l->mark_clean();
+            l->slot = k;
+            l->generation = generation_;
+            leaves.push_back(l);
+        }
+        for (FILE* f : files) {
+            if (f != nullptr) fclose(f);
+        }
+        tree_.assign_leaves(leaves);
+    }
+
+    T& tree_;
+    std::string dir_;
+    bool has_base_ = false;
+    uint64_t base_id_ = 0;
+    uint32_t deltas_ = 0;
+    // leaf table of the newest file
+    std::vector<entry> table_;
+    uint64_t generation_ = 0;
+};
+}  // namespace dyn
@@ -0,0 +1,88 @@
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include "bufferedbv.hpp"
+#include "bufferedtree.hpp"
+#include "checkpoint.hpp"
+
+/*
+ * Cost of the incremental checkpoints of checkpoint.hpp.
+ *
+ * A tree of n random bits gets a full base checkpoint, then rounds of an
+ * increasing number of random sets, each followed by an incremental
+ * checkpoint. The bytes written and the time should follow the number of
+ * leaves touched rather than n. Finally the deltas are compacted and the
+ * tree is loaded back.
+ *
+ * Usage: checkpoint_bench [n] [directory]
+ */
+
+typedef dyn::buffered_tree<dyn::buffered_packed_vector<8>, 8192, 16> tree;
+
+template <class F>
+double seconds(F f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+int main(int argc, char** argv) {
+    uint64_t n = 500000000;
+    std::string dir = "checkpoint_bench.dir";
+    if (argc > 1) std::istringstream(argv[1]) >> n;
+    if (argc > 2) dir = argv[2];
+    if (n == 0) {
+        std::cerr << "Usage: " << argv[0] << " [n] [directory]" << std::endl;
+        return 1;
+    }
+    std::filesystem::remove_all(dir);
+
+    std::mt19937_64 gen(42);
+    tree t;
+    std::vector<uint64_t> chunk(1 << 16);
+    for (uint64_t done = 0; done < n; done += chunk.size() * 64) {
+        for (auto& w : chunk) w = gen();
+        uint64_t bits = std::min<uint64_t>(chunk.size() * 64, n - done);
+        t.append_words(chunk.data(), bits);
+    }
+
+    std::cout << "phase\tedits\tMB\tseconds" << std::endl;
+    auto report = [](const char* phase, uint64_t edits, uint64_t bytes,
+                     double s) {
+        std::cout << phase << "\t" << edits << "\t" << std::fixed
+                  << std::setprecision(2) << bytes / 1e6 << "\t"
+                  << std::setprecision(3) << s << std::endl;
+    };
+    uint64_t total_edits = 0;
+    {
+        dyn::incremental_checkpoint<tree> cp(t, dir);
+        uint64_t bytes = 0;
+        double s = seconds([&] { bytes = cp.checkpoint(); });
+        report("full", 0, bytes, s);
+        std::cerr << cp.leaves() << " leaves" << std::endl;
+        for (uint64_t edits = 10; edits <= n / 1000; edits *= 10) {
+            for (uint64_t k = 0; k < edits; k++) t.set(gen() % n, gen() % 2);
+            total_edits += edits;
+            s = seconds([&] { bytes = cp.checkpoint(); });
+            report("delta", edits, bytes, s);
+        }
+        s = seconds([&] { bytes = cp.compact(); });
+        report("compact", total_edits, bytes, s);
+    }
+    tree loaded;
+    double s = seconds([&] { dyn::incremental_checkpoint<tree> cp(loaded, dir); });
+    report("load", total_edits, std::filesystem::file_size(dir + "/base"), s);
+    if (loaded.size() != t.size() || loaded.psum() != t.psum()) {
+        std::cerr << "Loaded tree differs" << std::endl;
+        return 1;
+    }
+    std::filesystem::remove_all(dir);
+    return 0;
+}
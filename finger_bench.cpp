@@ -0,0 +1,107 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include "bufferedbv.hpp"
+#include "bufferedtree.hpp"
+
+/*
+ * Local access through a finger against access from the root, see
+ * buffered_tree::finger.
+ *
+ * A tree of n random bits is built, then at, rank, insert and set are
+ * timed at positions that walk randomly by at most max_step bits at a time,
+ * first from the root and then through a finger.
+ *
+ * Usage: finger_bench [n] [max_step]
+ */
+
+typedef dyn::buffered_tree<dyn::buffered_packed_vector<8>, 8192, 16> tree;
+
+int main(int argc, char** argv) {
+    uint64_t n = 100000000;
+    uint64_t max_step = 64;
+    if (argc > 1) std::istringstream(argv[1]) >> n;
+    if (argc > 2) std::istringstream(argv[2]) >> max_step;
+    if (n == 0 || max_step == 0) {
+        std::cerr << "Usage: " << argv[0] << " [n] [max_step]" << std::endl;
+        return 1;
+    }
+
+    std::mt19937_64 gen(42);
+    tree t;
+    std::vector<uint64_t> chunk(1 << 16);
+    for (uint64_t done = 0; done < n; done += chunk.size() * 64) {
+        for (auto& w : chunk) w = gen();
+        uint64_t bits = std::min<uint64_t>(chunk.size() * 64, n - done);
+        t.append_words(chunk.data(), bits);
+    }
+
+    const uint64_t ops = 10000000;
+    std::vector<uint64_t> positions(ops);
+    uint64_t pos = n / 2;
+    for (auto& p : positions) {
+        uint64_t step = gen() % (2 * max_step + 1);
+        if (pos + step >= max_step && pos + step - max_step < n / 2) {
+            pos = pos + step - max_step;
+        }
+        p = pos;
+    }
+    std::cout << "op\troot Mops/s\tfinger Mops/s" << std::endl;
+    auto time = [&](auto f) {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t checksum = f();
+        std::chrono::duration<double> s =
+            std::chrono::steady_clock::now() - start;
+        std::cerr << "checksum: " << checksum << std::endl;
+        return ops / s.count() / 1e6;
+    };
+    auto bench = [&](const char* name, auto root_op, auto finger_op) {
+        double root = time([&] {
+            uint64_t sum = 0;
+            for (uint64_t k = 0; k < ops; k++) sum += root_op(k);
+            return sum;
+        });
+        tree::finger f(t, n / 2);
+        double finger = time([&] {
+            uint64_t sum = 0;
+            for (uint64_t k = 0; k < ops; k++) sum += finger_op(f, k);
+            return sum;
+        });
+        std::cout << name << "\t" << std::fixed << std::setprecision(3)
+                  << root << "\t" << finger << std::endl;
+    };
+
+    bench(
+        "at", [&](uint64_t k) { return t.at(positions[k]); },
+        [&](tree::finger& f, uint64_t k) { return f.at(positions[k]); });
+    bench(
+        "rank", [&](uint64_t k) { return t.rank(positions[k]); },
+        [&](tree::finger& f, uint64_t k) { return f.rank(positions[k]); });
+    // Positions stay below n / 2, so they are valid while the tree grows
+    bench(
+        "insert",
+        [&](uint64_t k) {
+            t.insert(positions[k], k % 2);
+            return 0;
+        },
+        [&](tree::finger& f, uint64_t k) {
+            f.insert(positions[k], k % 2);
+            return 0;
+        });
+    bench(
+        "set",
+        [&](uint64_t k) {
+            t.set(positions[k], k % 2);
+            return 0;
+        },
+        [&](tree::finger& f, uint64_t k) {
+            f.set(positions[k], k % 2);
+            return 0;
+        });
+    std::cerr << "psum: " << t.psum() << std::endl;
+    return 0;
+}
@@ -0,0 +1,256 @@
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bufferedbv.hpp"
+#include "bufferedtree.hpp"
+#include "dynamic.hpp"
+#include "spsi.hpp"
+#include "succinct_bitvector.hpp"
+#include "wavelet_matrix.hpp"
+
+/*
+ * Dynamic FM-index benchmark.
+ *
+ * The BWT of a text file is built online by prepending the text one
+ * character at a time, right to left. Each step replaces the terminator by
+ * the new character and inserts a new terminator at its LF position, so
+ * every character costs a remove and two inserts in the wavelet matrix
+ * holding the BWT. The bit vectors of the wavelet matrix are swapped between
+ * suc_bv, buffered leaves and buffered_tree.
+ *
+ * After the build one LF pass over the whole BWT samples every s-th text
+ * position. The sampled rows are marked in a bit vector of the same type.
+ * Then random substrings of the text are counted with backward search and
+ * their occurrences are located by walking LF to the nearest sample.
+ *
+ * Usage: fm_bench <text> [max_bytes] [pattern_length] [sample_rate]
+ */
+
+typedef dyn::suc_bv sbv;
+
+template <uint8_t k>
+using bbv = dyn::succinct_bitvector<
+    dyn::spsi<dyn::buffered_packed_vector<k>, 8192, 16>>;
+
+template <uint8_t k>
+using btree = dyn::buffered_tree<dyn::buffered_packed_vector<k>, 8192, 16>;
+
+static const uint64_t PATTERNS = 10000;
+static const uint64_t MAX_LOCATE = 100;
+
+template <class bv_type>
+class dynamic_fm_index {
+   public:
+    explicit dynamic_fm_index(uint64_t sample_rate)
+        : bwt_(8), sample_rate_(sample_rate) {
+        // BWT of the empty text is the terminator
+        bwt_.push_back(0);
+    }
+
+    /*
+     * prepends c to the indexed text, c can not be 0
+     */
+    void extend(uint8_t c) {
+        bwt_.remove(term_);
+        bwt_.insert(term_, c);
+        uint64_t pos = C(c) + bwt_.rank(term_, c);
+        add(c);
+        bwt_.insert(pos, 0);
+        term_ = pos;
+    }
+
+    /*
+     * samples the suffix array, has to be called after the last extend
+     */
+    void sample() {
+        uint64_t n = bwt_.size();
+        std::vector<std::pair<uint64_t, uint64_t>> samples;
+        // Row term_ is the whole text, each LF step moves one position left
+        uint64_t row = term_;
+        for (uint64_t pos = 0; pos < n; pos++) {
+            uint64_t text_pos = (n - pos) % n;
+            if (text_pos % sample_rate_ == 0) samples.push_back({row, text_pos});
+            row = LF(row);
+        }
+        std::sort(samples.begin(), samples.end());
+        uint64_t next = 0;
+        for (uint64_t r = 0; r < n; r++) {
+            bool marked = next < samples.size() && samples[next].first == r;
+            marks_.push_back(marked);
+            if (marked) sampled_.push_back(samples[next++].second);
+        }
+    }
+
+    /*
+     * rows [sp, ep) prefixed by the pattern
+     */
+    std::pair<uint64_t, uint64_t> range(const std::string &pattern) const {
+        uint64_t sp = 0;
+        uint64_t ep = bwt_.size();
+        for (size_t k = pattern.size(); k-- > 0 && sp < ep;) {
+            uint8_t c = pattern[k];
+            sp = C(c) + bwt_.rank(sp, c);
+            ep = C(c) + bwt_.rank(ep, c);
+        }
+        return {sp, sp < ep ? ep : sp};
+    }
+
+    uint64_t locate(uint64_t row) const {
+        uint64_t steps = 0;
+        while (!marks_.at(row)) {
+            row = LF(row);
+            steps++;
+        }
+        return sampled_[marks_.rank(row)] + steps;
+    }
+
+    uint64_t size() const { return bwt_.size(); }
+
+    uint64_t bit_size() const {
+        return bwt_.bit_size() + marks_.bit_size() +
+               sampled_.capacity() * sizeof(uint64_t) * 8;
+    }
+
+   private:
+    /*
+     * number of BWT characters smaller than c, counting the terminator
+     */
+    uint64_t C(uint8_t c) const {
+        uint64_t res = 1;
+        for (uint32_t i = c; i > 0; i -= i & -i) res += fenwick_[i];
+        return res;
+    }
+
+    void add(uint8_t c) {
+        for (uint32_t i = c + 1; i <= 256; i += i & -i) fenwick_[i]++;
+    }
+
+    uint64_t LF(uint64_t row) const {
+        uint8_t c = bwt_.at(row);
+        if (c == 0) return 0;
+        return C(c) + bwt_.rank(row, c);
+    }
+
+    dyn::wavelet_matrix<bv_type> bwt_;
+    uint64_t term_ = 0;
+    uint64_t fenwick_[257] = {};
+    uint64_t sample_rate_;
+    bv_type marks_;
+    std::vector<uint64_t> sampled_;
+};
+
+uint64_t max_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+template <class bv_type>
+void bench(const char *name, const std::string &text,
+           const std::vector<std::string> &patterns, uint64_t sample_rate) {
+    auto index = new dynamic_fm_index<bv_type>(sample_rate);
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = text.size(); i-- > 0;) index->extend(text[i]);
+    double build = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    index->sample();
+    double sampling = seconds_since(start);
+
+    uint64_t occurrences = 0;
+    start = std::chrono::steady_clock::now();
+    for (const auto &p : patterns) {
+        auto r = index->range(p);
+        occurrences += r.second - r.first;
+    }
+    double count = seconds_since(start);
+
+    uint64_t located = 0;
+    uint64_t checksum = 0;
+    start = std::chrono::steady_clock::now();
+    for (const auto &p : patterns) {
+        auto r = index->range(p);
+        for (uint64_t row = r.first; row < r.second && row < r.first + MAX_LOCATE;
+             row++) {
+            checksum += index->locate(row);
+            located++;
+        }
+    }
+    double locate = seconds_since(start);
+
+    std::cout << name << "\t" << std::fixed << std::setprecision(3) << build
+              << "\t" << sampling << "\t" << std::setprecision(2)
+              << 1e6 * count / patterns.size() << "\t"
+              << (located ? 1e6 * locate / located : 0) << "\t"
+              << double(index->bit_size()) / text.size() << "\t"
+              << max_rss_kb() / 1024 << std::endl;
+    std::cerr << name << " occurrences: " << occurrences
+              << " located: " << located << " checksum: " << checksum
+              << std::endl;
+    delete index;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0]
+                  << " <text> [max_bytes] [pattern_length] [sample_rate]"
+                  << std::endl;
+        return 1;
+    }
+    uint64_t max_bytes = 10000000;
+    uint64_t m = 8;
+    uint64_t sample_rate = 32;
+    if (argc > 2) std::istringstream(argv[2]) >> max_bytes;
+    if (argc > 3) std::istringstream(argv[3]) >> m;
+    if (argc > 4) std::istringstream(argv[4]) >> sample_rate;
+
+    std::ifstream in(argv[1], std::ios::binary);
+    if (!in) {
+        std::cerr << "Unable to open " << argv[1] << std::endl;
+        return 1;
+    }
+    std::string text(max_bytes, '\0');
+    in.read(&text[0], max_bytes);
+    text.resize(in.gcount());
+    if (text.find('\0') != std::string::npos) {
+        std::cerr << "The text can not contain NUL bytes, 0 is the terminator"
+                  << std::endl;
+        return 1;
+    }
+    if (text.size() < m || m == 0 || sample_rate == 0) {
+        std::cerr << "Invalid pattern length or sample rate" << std::endl;
+        return 1;
+    }
+
+    std::mt19937_64 gen(42);
+    std::vector<std::string> patterns(PATTERNS);
+    for (auto &p : patterns) p = text.substr(gen() % (text.size() - m + 1), m);
+
+    std::cerr << "n = " << text.size() << ", m = " << m
+              << ", sample rate = " << sample_rate << std::endl;
+    // Times are seconds for the build and sampling, microseconds per pattern
+    // for count and per occurrence for locate. maxrss is the peak so far.
+    std::cout << "type\tbuild\tsample\tcount\tlocate\tbits/c\tmaxrss_mb"
+              << std::endl;
+    bench<sbv>("suc_bv", text, patterns, sample_rate);
+    bench<bbv<8>>("bbv8", text, patterns, sample_rate);
+    bench<bbv<16>>("bbv16", text, patterns, sample_rate);
+    bench<btree<8>>("tree8", text, patterns, sample_rate);
+    return 0;
+}
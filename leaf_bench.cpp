@@ -0,0 +1,225 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAS_RDTSC
+#endif
+
+#include "bufferedbv.hpp"
+
+/*
+ * Micro benchmarks for single buffered_packed_vector leaves.
+ *
+ * For every buffer size, leaf fill level, buffer occupancy and distribution of
+ * the buffered positions a leaf is prepared and each operation is timed in
+ * isolation. Mutating operations are run once on each of a batch of copies of
+ * the prepared leaf so that the buffer occupancy is the same for every timed
+ * call. Output is tab separated, cycles are rdtsc ticks and 0 when rdtsc is
+ * not available.
+ */
+
+static const uint64_t QUERIES = 1 << 16;
+static const uint64_t COPIES = 256;
+static const uint64_t ROUNDS = 16;
+
+enum dist { UNIFORM, CLUSTERED, FRONT, BACK };
+static const char *dist_names[] = {"uniform", "clustered", "front", "back"};
+
+uint64_t ticks() {
+#ifdef HAS_RDTSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+struct timer {
+    std::chrono::steady_clock::time_point start;
+    uint64_t start_ticks;
+    double ns = 0;
+    double cycles = 0;
+
+    void begin() {
+        start = std::chrono::steady_clock::now();
+        start_ticks = ticks();
+    }
+
+    void end() {
+        cycles += ticks() - start_ticks;
+        std::chrono::duration<double, std::nano> elapsed =
+            std::chrono::steady_clock::now() - start;
+        ns += elapsed.count();
+    }
+};
+
+uint64_t buffered_position(std::mt19937_64 &gen, dist d, uint64_t size) {
+    switch (d) {
+        case CLUSTERED:
+            return size / 2 + gen() % 64;
+        case FRONT:
+            return gen() % 64;
+        case BACK:
+            return size - 1 - gen() % 64;
+        default:
+            return gen() % size;
+    }
+}
+
+template <uint8_t k>
+dyn::buffered_packed_vector<k> *prepare(std::mt19937_64 &gen, uint64_t fill,
+                                        uint8_t occupancy, dist d) {
+    auto leaf = new dyn::buffered_packed_vector<k>();
+    for (uint64_t i = 0; i < fill; i++) {
+        leaf->push_back(gen() % 2);
+    }
+    // Alternate inserts and removes until the buffer holds the requested
+    // number of edits. Cancelling pairs just take another iteration.
+    bool ins = true;
+    while (leaf->buffer_fill() < occupancy) {
+        uint64_t pos = buffered_position(gen, d, leaf->size());
+        if (ins) {
+            leaf->insert(pos, gen() % 2);
+        } else {
+            leaf->remove(pos);
+        }
+        ins = !ins;
+    }
+    return leaf;
+}
+
+void report(uint8_t k, uint64_t fill, uint8_t occupancy, dist d,
+            const char *op, const timer &t, uint64_t n) {
+    std::cout << uint32_t(k) << "\t" << fill << "\t" << uint32_t(occupancy)
+              << "\t" << dist_names[d] << "\t" << op << "\t" << std::fixed
+              << std::setprecision(2) << t.ns / n << "\t" << t.cycles / n
+              << std::endl;
+}
+
+template <uint8_t k, class F>
+timer time_mutation(const dyn::buffered_packed_vector<k> &base, F op) {
+    timer t;
+    std::vector<dyn::buffered_packed_vector<k> *> copies(COPIES);
+    for (uint64_t r = 0; r < ROUNDS; r++) {
+        for (auto &c : copies) c = new dyn::buffered_packed_vector<k>(base);
+        t.begin();
+        for (auto c : copies) op(c);
+        t.end();
+        for (auto c : copies) delete c;
+    }
+    return t;
+}
+
+template <uint8_t k>
+void bench(std::mt19937_64 &gen, uint64_t fill, uint8_t occupancy, dist d,
+           uint64_t &checksum) {
+    auto leaf = prepare<k>(gen, fill, occupancy, d);
+    uint64_t size = leaf->size();
+    uint64_t ones = leaf->psum();
+
+    std::vector<uint64_t> pos(QUERIES);
+    for (auto &p : pos) p = gen() % size;
+    std::vector<uint64_t> sel(QUERIES);
+    for (auto &p : sel) p = ones ? gen() % ones + 1 : 0;
+    std::vector<uint64_t> sel0(QUERIES);
+    for (auto &p : sel0) p = size - ones ? gen() % (size - ones) + 1 : 0;
+
+    timer t;
+    t.begin();
+    for (auto p : pos) checksum += leaf->at(p);
+    t.end();
+    report(k, fill, occupancy, d, "at", t, QUERIES);
+
+    t = timer();
+    t.begin();
+    for (auto p : pos) checksum += leaf->rank(p);
+    t.end();
+    report(k, fill, occupancy, d, "rank", t, QUERIES);
+
+    if (ones) {
+        t = timer();
+        t.begin();
+        for (auto p : sel) checksum += leaf->search(p);
+        t.end();
+        report(k, fill, occupancy, d, "search", t, QUERIES);
+    }
+
+    if (size - ones) {
+        t = timer();
+        t.begin();
+        for (auto p : sel0) checksum += leaf->search_0(p);
+        t.end();
+        report(k, fill, occupancy, d, "search_0", t, QUERIES);
+    }
+
+    t = timer();
+    t.begin();
+    for (uint64_t i = 0; i < QUERIES; i++) leaf->set(pos[i], i & 1);
+    t.end();
+    report(k, fill, occupancy, d, "set", t, QUERIES);
+
+    uint64_t n = COPIES * ROUNDS;
+    uint64_t p = buffered_position(gen, d, size);
+    bool v = gen() % 2;
+    t = time_mutation<k>(*leaf, [&](dyn::buffered_packed_vector<k> *c) {
+        c->insert(p, v);
+    });
+    report(k, fill, occupancy, d, "insert", t, n);
+
+    t = time_mutation<k>(*leaf, [&](dyn::buffered_packed_vector<k> *c) {
+        c->remove(p);
+    });
+    report(k, fill, occupancy, d, "remove", t, n);
+
+    t = time_mutation<k>(*leaf, [&](dyn::buffered_packed_vector<k> *c) {
+        c->commit();
+    });
+    report(k, fill, occupancy, d, "commit", t, n);
+
+    std::vector<dyn::buffered_packed_vector<k> *> rights;
+    rights.reserve(n);
+    t = time_mutation<k>(*leaf, [&](dyn::buffered_packed_vector<k> *c) {
+        rights.push_back(c->split());
+    });
+    for (auto r : rights) {
+        checksum += r->size();
+        delete r;
+    }
+    report(k, fill, occupancy, d, "split", t, n);
+
+    delete leaf;
+}
+
+template <uint8_t k>
+void sweep(std::mt19937_64 &gen, const std::vector<uint64_t> &fills,
+           uint64_t &checksum) {
+    std::vector<uint8_t> occupancies = {0, k / 4, k / 2, k - 1};
+    for (auto fill : fills) {
+        uint8_t last = 255;
+        for (auto occupancy : occupancies) {
+            if (occupancy == last) continue;
+            last = occupancy;
+            for (auto d : {UNIFORM, CLUSTERED, FRONT, BACK}) {
+                bench<k>(gen, fill, occupancy, d, checksum);
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    std::mt19937_64 gen(argc > 1 ? std::stoull(argv[1]) : 1);
+    std::vector<uint64_t> fills = {1024, 4096, 6144, 8000};
+
+    uint64_t checksum = 0;
+    std::cout << "buf\tfill\tocc\tdist\top\tns/op\tcycles/op" << std::endl;
+    sweep<4>(gen, fills, checksum);
+    sweep<8>(gen, fills, checksum);
+    sweep<16>(gen, fills, checksum);
+    sweep<32>(gen, fills, checksum);
+    std::cerr << "checksum: " << checksum << std::endl;
+    return 0;
+}
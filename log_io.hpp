@@ -0,0 +1,247 @@
+#pragma once
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace dyn {
+/*
+ * Update records, shared by the traces in trace.hpp and the logs in wal.hpp
+ * and replication.hpp.
+ *
+ * Each record is one op byte optionally followed by a position as an LEB128
+ * varint, so positions are 64-bit but typically take 1-5 bytes. The low 4
+ * bits of the op byte are the op code (same numbering as execute_op in
+ * runners.hpp) and bit 4 is the value for insert, set and push_back.
+ */
+struct trace {
+    // magic of trace files, see trace.hpp
+    static constexpr char MAGIC[8] = {'B', 'V', 'T', 'R', 'A', 'C', 'E', '2'};
+    static constexpr uint8_t OP_MASK = 15;
+    static constexpr uint8_t VALUE_MASK = 16;
+    // op byte and a 64-bit varint
+    static constexpr uint8_t MAX_RECORD = 11;
+
+    enum op : uint8_t {
+        INSERT = 0,
+        REMOVE = 1,
+        SET = 2,
+        PUSH_BACK = 3,
+        RANK = 4,
+        SELECT = 5,
+        AT = 6,
+        SELECT0 = 7
+    };
+
+    static bool has_position(uint8_t op) { return (op & OP_MASK) != PUSH_BACK; }
+
+    static uint8_t write_varint(uint8_t* out, uint64_t v) {
+        uint8_t n = 0;
+        while (v >= 128) {
+            out[n++] = uint8_t(v) | 128;
+            v >>= 7;
+        }
+        out[n++] = uint8_t(v);
+        return n;
+    }
+
+    /*
+     * writes the record of op to out, returns its length
+     */
+    static uint8_t encode(uint8_t* out, uint8_t op, uint64_t pos, bool value) {
+        uint8_t len = 0;
+        out[len++] = op | (value ? VALUE_MASK : 0);
+        if (has_position(op)) len += write_varint(out + len, pos);
+        return len;
+    }
+
+    static void append(std::vector<uint8_t>& out, uint8_t op, uint64_t pos,
+                       bool value) {
+        uint8_t rec[MAX_RECORD];
+        out.insert(out.end(), rec, rec + encode(rec, op, pos, value));
+    }
+
+    static uint8_t read_varint(const uint8_t* in, uint64_t& v) {
+        uint8_t n = 0;
+        uint8_t shift = 0;
+        v = 0;
+        do {
+            v |= uint64_t(in[n] & 127) << shift;
+            shift += 7;
+        } while (in[n++] & 128);
+        return n;
+    }
+
+    /*
+     * length of the record at rec, 0 if it does not end before end
+     */
+    static uint8_t record_length(const uint8_t* rec, const uint8_t* end) {
+        if (rec >= end) return 0;
+        if (!has_position(rec[0])) return 1;
+        for (uint8_t n = 1; n <= 10 && rec + n < end; n++) {
+            if (!(rec[n] & 128)) return n + 1;
+        }
+        return 0;
+    }
+};
+
+/*
+ * File descriptor I/O of the logs in wal.hpp and replication.hpp and the
+ * checkpoints in checkpoint.hpp. Errors are fatal, a short read is not.
+ */
+struct log_file {
+    static constexpr uint64_t HASH_SEED = 0xcbf29ce484222325ull;
+
+    static void fail(const std::string& path) {
+        std::cerr << "I/O error on " << path << ": " << strerror(errno)
+                  << std::endl;
+        exit(1);
+    }
+
+    static void write_all(int fd, const void* data, uint64_t n,
+                          const std::string& path) {
+        const char* p = static_cast<const char*>(data);
+        while (n > 0) {
+            ssize_t w = write(fd, p, n);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) fail(path);
+            p += w;
+            n -= w;
+        }
+    }
+
+    /*
+     * reads n bytes at offset, false if the file is shorter
+     */
+    static bool read_all(int fd, void* data, uint64_t n, uint64_t offset) {
+        char* p = static_cast<char*>(data);
+        while (n > 0) {
+            ssize_t r = pread(fd, p, n, offset);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) return false;
+            p += r;
+            n -= r;
+            offset += r;
+        }
+        return true;
+    }
+
+    /*
+     * 64-bit FNV-1a style hash a word at a time, the checksum of the frames
+     * of records in a log
+     */
+    static uint64_t hash(const void* data, uint64_t n,
+                         uint64_t h = HASH_SEED) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        for (; n >= 8; n -= 8, p += 8) {
+            uint64_t w;
+            memcpy(&w, p, 8);
+            h = (h ^ w) * 0x100000001b3ull;
+            h ^= h >> 29;
+        }
+        for (; n > 0; n--, p++) h = (h ^ *p) * 0x100000001b3ull;
+        return h;
+    }
+};
+
+/*
+ * Appends n bits from in to tree. Trees without append_words() get a
+ * push_back per bit.
+ */
+template <class T>
+auto load_bits(T& tree, const uint64_t* in, uint64_t n, int)
+    -> decltype(tree.append_words(in, n), void()) {
+    tree.append_words(in, n);
+}
+
+template <class T>
+void load_bits(T& tree, const uint64_t* in, uint64_t n, long) {
+    for (uint64_t k = 0; k < n; k++) {
+        tree.push_back((in[k / 64] >> (k % 64)) & 1);
+    }
+}
+
+template <class T>
+void load_bits(T& tree, const uint64_t* in, uint64_t n) {
+    load_bits(tree, in, n, 0);
+}
+
+/*
+ * Executes the trace record at rec on the tree. Returns the record length in
+ * bytes. Query results are written to out.
+ */
+template <class T>
+uint8_t execute_trace_op(T& tree, const uint8_t* rec, uint64_t& out) {
+    uint8_t op = rec[0];
+    bool value = op & trace::VALUE_MASK;
+    uint64_t pos = 0;
+    uint8_t len = 1;
+    if (trace::has_position(op)) len += trace::read_varint(rec + 1, pos);
+    out = 0;
+    switch (op & trace::OP_MASK) {
+        case trace::INSERT:
+            tree.insert(pos, value);
+            break;
+        case trace::REMOVE:
+            tree.remove(pos);
+            break;
+        case trace::SET:
+            tree.set(pos, value);
+            break;
+        case trace::PUSH_BACK:
+            tree.push_back(value);
+            break;
+        case trace::RANK:
+            out = tree.rank(pos);
+            break;
+        case trace::SELECT:
+            out = tree.select(pos);
+            break;
+        case trace::SELECT0:
+            out = tree.select0(pos);
+            break;
+        default:
+            out = tree.at(pos);
+            break;
+    }
+    return len;
+}
+
+/*
+ * Executes the records in [rec, end) on the tree, with runs of push_backs
+ * batched into load_bits. bits is scratch space of at least one word, which
+ * has to be zeroed and is zeroed again on return.
+ */
+template <class T>
+void apply_records(T& tree, const uint8_t* rec, const uint8_t* end,
+                   std::vector<uint64_t>& bits) {
+    uint64_t nbits = 0;
+    auto flush = [&] {
+        if (nbits == 0) return;
+        load_bits(tree, bits.data(), nbits);
+        std::fill(bits.begin(), bits.begin() + (nbits + 63) / 64, 0);
+        nbits = 0;
+    };
+    while (rec < end) {
+        uint8_t op = rec[0] & trace::OP_MASK;
+        bool x = rec[0] & trace::VALUE_MASK;
+        if (op == trace::PUSH_BACK) {
+            bits[nbits / 64] |= uint64_t(x) << (nbits % 64);
+            if (++nbits == bits.size() * 64) flush();
+            rec++;
+            continue;
+        }
+        flush();
+        uint64_t out;
+        rec += execute_trace_op(tree, rec, out);
+    }
+    flush();
+}
+}  // namespace dyn
@@ -1,4 +1,5 @@
 #include <chrono>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <random>
@@ -57,8 +58,11 @@ typedef dyn::succinct_bitvector<
 
 typedef dyn::suc_bv sbv;
 
-int8_t get_op(std::vector<uint32_t> &ops, std::mt19937 &gen, uint32_t size) {
-    uint32_t selection = gen() % 7;
+// Op 7, select0, is only drawn with -s, which keeps the default mix at ops
+// 0 to 6
+int8_t get_op(std::vector<uint32_t> &ops, std::mt19937 &gen, uint32_t size,
+              bool select0) {
+    uint32_t selection = gen() % (select0 ? 8 : 7);
     ops.push_back(selection);
     switch (selection) {
         case 0:
@@ -79,6 +83,7 @@ int8_t get_op(std::vector<uint32_t> &ops, std::mt19937 &gen, uint32_t size) {
             ops.push_back(size ? gen() % size : 0);
             return 0;
         case 5:
+        case 7:
             ops.push_back(gen());
             return 0;
         default:
@@ -94,7 +99,8 @@ int main(int argc, char **argv) {
     std::random_device rd;
     std::mt19937 gen(rd());
 
-    if (argc > 1) {
+    bool select0 = argc > 1 && strcmp(argv[1], "-s") == 0;
+    if (argc > 1 + select0) {
         std::vector<uint32_t> b_ops;
         std::vector<uint32_t> c_ops;
         b_ops.push_back(20000);
@@ -129,7 +135,7 @@ int main(int argc, char **argv) {
         uint16_t size = gen() % initial_size_limit;
         ops.push_back(size);
         for (size_t i = 0; i < num_ops; i++) {
-            size += get_op(ops, gen, size);
+            size += get_op(ops, gen, size, select0);
         }
         if (run_test<sbv, bbv3>(ops)) break;
         std::cout << std::setw(w) << run_timing<sbv>(ops);
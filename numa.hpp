@@ -0,0 +1,248 @@
+#pragma once
+
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace dyn {
+/*
+ * NUMA placement for trees.
+ *
+ * Uses the Linux memory policy syscalls directly, so no libnuma is needed.
+ * On machines or kernels without NUMA support everything degrades to a
+ * single node 0 and the placement calls return false.
+ *
+ * Memory is moved a page at a time, so small nodes and leaves that share a
+ * page with an allocation of another partition can end up on either node.
+ * Leaves built in order are mostly allocated in order, which keeps this to
+ * the partition boundaries.
+ */
+namespace numa {
+// Node masks are a single word
+static const uint32_t MAX_NODES = 64;
+
+/*
+ * parses a sysfs list like "0-3,8,10-11"
+ */
+inline std::vector<uint32_t> parse_list(const std::string& list) {
+    std::vector<uint32_t> res;
+    std::istringstream in(list);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        uint32_t lo = 0;
+        uint32_t hi = 0;
+        char dash = 0;
+        std::istringstream range(item);
+        if (!(range >> lo)) continue;
+        hi = lo;
+        if (range >> dash >> hi && dash != '-') hi = lo;
+        for (uint32_t v = lo; v <= hi; v++) res.push_back(v);
+    }
+    return res;
+}
+
+inline std::string read_sysfs(const std::string& path) {
+    std::ifstream in(path);
+    std::string res;
+    std::getline(in, res);
+    return res;
+}
+
+/*
+ * number of NUMA nodes, 1 without NUMA support
+ */
+inline uint32_t nodes() {
+    static const uint32_t n = [] {
+        auto online = parse_list(read_sysfs("/sys/devices/system/node/online"));
+        uint32_t res = online.empty() ? 1 : online.back() + 1;
+        return res < MAX_NODES ? res : MAX_NODES;
+    }();
+    return n;
+}
+
+/*
+ * CPUs of node
+ */
+inline std::vector<uint32_t> cpus(uint32_t node) {
+    return parse_list(read_sysfs("/sys/devices/system/node/node" +
+                                 std::to_string(node) + "/cpulist"));
+}
+
+/*
+ * node of the CPU the calling thread runs on
+ */
+inline uint32_t current_node() {
+    static const std::vector<uint32_t> cpu_nodes = [] {
+        std::vector<uint32_t> res;
+        for (uint32_t node = 0; node < nodes(); node++) {
+            for (uint32_t cpu : cpus(node)) {
+                if (cpu >= res.size()) res.resize(cpu + 1, 0);
+                res[cpu] = node;
+            }
+        }
+        return res;
+    }();
+    int cpu = sched_getcpu();
+    return cpu >= 0 && uint32_t(cpu) < cpu_nodes.size() ? cpu_nodes[cpu] : 0;
+}
+
+enum policy_type { LOCAL, INTERLEAVE, BIND };
+
+/*
+ * mask of node, or of all nodes for INTERLEAVE
+ */
+inline unsigned long node_mask(policy_type policy, uint32_t node) {
+    if (policy == INTERLEAVE) {
+        return nodes() == MAX_NODES ? ~0ul : (1ul << nodes()) - 1;
+    }
+    return 1ul << node;
+}
+
+inline int mode(policy_type policy) {
+    return policy == INTERLEAVE ? MPOL_INTERLEAVE
+                                : policy == BIND ? MPOL_BIND : MPOL_DEFAULT;
+}
+
+/*
+ * Memory policy of the calling thread for new pages while in scope: LOCAL is
+ * first touch, INTERLEAVE spreads pages over all nodes and BIND allocates on
+ * node.
+ */
+class scoped_policy {
+   public:
+    explicit scoped_policy(policy_type policy, uint32_t node = 0) {
+        unsigned long mask = node_mask(policy, node);
+        ok_ = syscall(SYS_set_mempolicy, mode(policy),
+                      policy == LOCAL ? nullptr : &mask, MAX_NODES + 1) == 0;
+    }
+
+    ~scoped_policy() {
+        if (ok_) syscall(SYS_set_mempolicy, MPOL_DEFAULT, nullptr, 0);
+    }
+
+    bool ok() const { return ok_; }
+
+   private:
+    bool ok_;
+};
+
+/*
+ * runs the calling thread on the CPUs of node and allocates its new pages
+ * there
+ */
+inline bool bind_thread(uint32_t node) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (uint32_t cpu : cpus(node)) CPU_SET(cpu, &set);
+    if (CPU_COUNT(&set) == 0) return false;
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) return false;
+    unsigned long mask = node_mask(BIND, node);
+    return syscall(SYS_set_mempolicy, MPOL_BIND, &mask, MAX_NODES + 1) == 0;
+}
+
+/*
+ * moves the pages overlapping [p, p + bytes) according to policy
+ */
+inline bool move(const void* p, uint64_t bytes, policy_type policy,
+                 uint32_t node = 0) {
+    static const uint64_t page = sysconf(_SC_PAGESIZE);
+    uint64_t start = reinterpret_cast<uint64_t>(p) & ~(page - 1);
+    uint64_t end = reinterpret_cast<uint64_t>(p) + bytes;
+    unsigned long mask = node_mask(policy, node);
+    return syscall(SYS_mbind, start, end - start, mode(policy),
+                   policy == LOCAL ? nullptr : &mask, MAX_NODES + 1,
+                   MPOL_MF_MOVE) == 0;
+}
+
+/*
+ * spreads the pages of tree over all nodes, returns false if any move failed
+ */
+template <class T>
+bool interleave(const T& tree) {
+    bool ok = true;
+    tree.for_each_block([&](const void* p, uint64_t bytes, uint64_t) {
+        ok &= move(p, bytes, INTERLEAVE);
+    });
+    return ok;
+}
+
+/*
+ * node owning position pos after pin_partitions
+ */
+template <class T>
+uint32_t partition(const T& tree, uint64_t pos) {
+    uint64_t size = tree.size();
+    return size ? uint32_t(pos * nodes() / size) : 0;
+}
+
+/*
+ * Splits the positions of tree into nodes() equal ranges and moves the
+ * leaves and nodes starting in range p to node p. Queries should then be
+ * routed to threads on the node owning their position, see partition().
+ */
+template <class T>
+bool pin_partitions(const T& tree) {
+    bool ok = true;
+    tree.for_each_block([&](const void* p, uint64_t bytes, uint64_t pos) {
+        ok &= move(p, bytes, BIND, partition(tree, pos));
+    });
+    return ok;
+}
+
+/*
+ * Read only copies of a tree, one per node. Each copy is built with
+ * T::clone() by a thread bound to its node, so it lives in that node's
+ * memory. Queries are answered by the copy of the calling thread's node.
+ * Updates to the source are not reflected, build a new set of replicas
+ * after a write phase.
+ */
+template <class T>
+class replicated {
+   public:
+    explicit replicated(const T& source) : replicas_(nodes(), nullptr) {
+        for (uint32_t node = 0; node < replicas_.size(); node++) {
+            std::thread([&] {
+                bind_thread(node);
+                replicas_[node] = new T(source.clone());
+            }).join();
+        }
+    }
+
+    replicated(const replicated&) = delete;
+
+    replicated& operator=(const replicated&) = delete;
+
+    ~replicated() {
+        for (auto r : replicas_) delete r;
+    }
+
+    /*
+     * copy on the calling thread's node
+     */
+    const T& local() const { return *replicas_[current_node()]; }
+
+    const T& on(uint32_t node) const { return *replicas_[node]; }
+
+    uint32_t size() const { return replicas_.size(); }
+
+    bool at(uint64_t i) const { return local().at(i); }
+
+    uint64_t rank(uint64_t i) const { return local().rank(i); }
+
+    uint64_t select(uint64_t x) const { return local().select(x); }
+
+    uint64_t select0(uint64_t x) const { return local().select0(x); }
+
+   private:
+    std::vector<T*> replicas_;
+};
+}  // namespace numa
+}  // namespace dyn
@@ -0,0 +1,127 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "bufferedbv.hpp"
+#include "bufferedtree.hpp"
+#include "numa.hpp"
+
+/*
+ * Rank throughput of a tree under the NUMA placements of numa.hpp.
+ *
+ * A tree of n random bits is built by the main thread, then every thread,
+ * bound to node t % nodes(), runs a batch of random rank queries:
+ *
+ *   first-touch  the tree where the main thread allocated it
+ *   interleave   pages spread over all nodes
+ *   partition    positions split into one range per node, each thread only
+ *                queries the range of its own node
+ *   replicas     one clone per node, each thread queries its local copy
+ *
+ * Throughput is millions of ranks per second over all threads.
+ *
+ * Usage: numa_bench [n] [queries per thread] [threads]
+ */
+
+typedef dyn::buffered_tree<dyn::buffered_packed_vector<8>, 8192, 16> tree;
+
+/*
+ * runs f(thread, node) on threads bound round robin to the nodes, returns
+ * the elapsed seconds
+ */
+template <class F>
+double run_threads(uint32_t threads, F f) {
+    std::vector<std::thread> pool;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t t = 0; t < threads; t++) {
+        pool.emplace_back([&, t] {
+            uint32_t node = t % dyn::numa::nodes();
+            dyn::numa::bind_thread(node);
+            f(t, node);
+        });
+    }
+    for (auto& th : pool) th.join();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+int main(int argc, char** argv) {
+    uint64_t n = 500000000;
+    uint64_t queries = 1000000;
+    uint32_t threads = std::thread::hardware_concurrency();
+    if (argc > 1) std::istringstream(argv[1]) >> n;
+    if (argc > 2) std::istringstream(argv[2]) >> queries;
+    if (argc > 3) std::istringstream(argv[3]) >> threads;
+    if (n == 0 || threads == 0) {
+        std::cerr << "Usage: " << argv[0] << " [n] [queries per thread] [threads]"
+                  << std::endl;
+        return 1;
+    }
+    uint32_t nodes = dyn::numa::nodes();
+    std::cerr << nodes << " nodes, " << threads << " threads" << std::endl;
+
+    std::mt19937_64 gen(42);
+    tree t;
+    std::vector<uint64_t> chunk(1 << 16);
+    for (uint64_t done = 0; done < n; done += chunk.size() * 64) {
+        for (auto& w : chunk) w = gen();
+        uint64_t bits = std::min<uint64_t>(chunk.size() * 64, n - done);
+        t.append_words(chunk.data(), bits);
+    }
+
+    // Query positions per thread, in the thread's own partition if asked
+    auto positions = [&](uint32_t th, bool local) {
+        std::mt19937_64 g(th);
+        uint64_t lo = 0;
+        uint64_t len = n;
+        if (local) {
+            uint32_t node = th % nodes;
+            lo = n * node / nodes;
+            len = n * (node + 1) / nodes - lo;
+        }
+        std::vector<uint64_t> res(queries);
+        for (auto& p : res) p = lo + g() % len;
+        return res;
+    };
+    std::vector<std::vector<uint64_t>> global(threads);
+    std::vector<std::vector<uint64_t>> partitioned(threads);
+    for (uint32_t th = 0; th < threads; th++) {
+        global[th] = positions(th, false);
+        partitioned[th] = positions(th, true);
+    }
+
+    std::vector<uint64_t> sums(threads);
+    auto bench = [&](const char* name, auto query, bool local) {
+        double s = run_threads(threads, [&](uint32_t th, uint32_t) {
+            uint64_t sum = 0;
+            for (uint64_t p : local ? partitioned[th] : global[th]) {
+                sum += query(p);
+            }
+            sums[th] = sum;
+        });
+        uint64_t checksum = 0;
+        for (auto v : sums) checksum += v;
+        std::cout << name << "\t" << std::fixed << std::setprecision(2)
+                  << threads * queries / s / 1e6 << std::endl;
+        std::cerr << name << " checksum: " << checksum << std::endl;
+    };
+
+    std::cout << "placement\tMranks/s" << std::endl;
+    bench("first-touch", [&](uint64_t p) { return t.rank(p); }, false);
+    if (!dyn::numa::interleave(t)) {
+        std::cerr << "Interleaving failed, pages stay in place" << std::endl;
+    }
+    bench("interleave", [&](uint64_t p) { return t.rank(p); }, false);
+    if (!dyn::numa::pin_partitions(t)) {
+        std::cerr << "Pinning failed, pages stay in place" << std::endl;
+    }
+    bench("partition", [&](uint64_t p) { return t.rank(p); }, true);
+    dyn::numa::replicated<tree> replicas(t);
+    bench("replicas", [&](uint64_t p) { return replicas.rank(p); }, false);
+    return 0;
+}
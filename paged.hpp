@@ -0,0 +1,399 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace dyn {
+/*
+ * Leaf for a buffered_tree whose contents live in a file.
+ *
+ * The nodes of the tree stay in memory, and a paged_leaf itself only keeps
+ * the size and the number of ones of its leaf_type. The leaf_type is paged
+ * in and out through a cache with a fixed number of frames, which is shared
+ * by all paged_leaf<leaf_type, max_bits> and replaced with the CLOCK
+ * algorithm. A changed leaf is written back to its slot in the file when it
+ * is evicted. The write includes the buffered edits, so eviction does not
+ * force a commit. Slots have a fixed size that fits a leaf of max_bits,
+ * which needs to be at least the B_LEAF of the tree.
+ *
+ * prefetch() asks the kernel to read the slots of the leaves of a range in
+ * the background, ahead of a scan or a batch of queries.
+ *
+ * The cache is a single static per paged_leaf<leaf_type, max_bits> type and
+ * is not synchronized. All trees with that leaf type, with their copies and
+ * snapshots, must therefore be used by one thread at a time. Trees that are
+ * used on different threads need different leaf types, for example
+ * different max_bits.
+ */
+template <class leaf_type, uint32_t max_bits = 8192>
+class paged_leaf {
+   public:
+    struct stats {
+        uint64_t faults = 0;
+        uint64_t writebacks = 0;
+        uint64_t resident = 0;
+        uint64_t slots = 0;
+    };
+
+    /*
+     * Pages leaves to the file at path, which is truncated, through a cache
+     * of frames leaves. Needs to be called while no paged_leaf exists. The
+     * default is an unlinked temporary file and 1024 frames.
+     */
+    static void configure(const std::string& path, uint64_t frames) {
+        cache().open(path, frames);
+    }
+
+    static stats statistics() { return cache().statistics(); }
+
+    paged_leaf() { adopt(new leaf_type()); }
+
+    paged_leaf(std::vector<uint64_t>&& words, uint64_t size) {
+        adopt(new leaf_type(std::move(words), size));
+    }
+
+    paged_leaf(std::vector<uint64_t>&& words, uint64_t size, uint64_t ones) {
+        adopt(new leaf_type(std::move(words), size, ones));
+    }
+
+    /*
+     * takes ownership of a resident leaf
+     */
+    explicit paged_leaf(leaf_type* resident) { adopt(resident); }
+
+    paged_leaf(const paged_leaf& other) { adopt(new leaf_type(other.get())); }
+
+    paged_leaf& operator=(const paged_leaf&) = delete;
+
+    ~paged_leaf() { cache().release(this); }
+
+    uint64_t size() const { return size_; }
+
+    uint64_t psum() const { return psum_; }
+
+    bool at(uint64_t i) const { return get().at(i); }
+
+    uint64_t rank(uint64_t i) const { return get().rank(i); }
+
+    uint64_t search(uint64_t x) const { return get().search(x); }
+
+    uint64_t search_0(uint64_t x) const { return get().search_0(x); }
+
+    uint64_t get_bits(uint64_t i, uint8_t n) const {
+        return get().get_bits(i, n);
+    }
+
+    void extract(uint64_t i, uint64_t j, uint64_t* out,
+                 uint64_t offset = 0) const {
+        get().extract(i, j, out, offset);
+    }
+
+    uint64_t count_ones(uint64_t i, uint64_t j) const {
+        return get().count_ones(i, j);
+    }
+
+    uint64_t next_one(uint64_t i) const { return get().next_one(i); }
+
+    uint64_t next_zero(uint64_t i) const { return get().next_zero(i); }
+
+    uint64_t prev_one(uint64_t i) const { return get().prev_one(i); }
+
+    uint64_t prev_zero(uint64_t i) const { return get().prev_zero(i); }
+
+    void insert(uint64_t i, uint64_t x) {
+        leaf_type& l = get();
+        l.insert(i, x);
+        changed(l);
+    }
+
+    void remove(uint64_t i) {
+        leaf_type& l = get();
+        l.remove(i);
+        changed(l);
+    }
+
+    void set(uint64_t i, bool x) {
+        leaf_type& l = get();
+        l.set(i, x);
+        changed(l);
+    }
+
+    void push_back(uint64_t x) {
+        leaf_type& l = get();
+        l.push_back(x);
+        changed(l);
+    }
+
+    void append_bits(const uint64_t* in, uint64_t in_pos, uint64_t n) {
+        leaf_type& l = get();
+        l.append_bits(in, in_pos, n);
+        changed(l);
+    }
+
+    /*
+     * The right half is created resident, which may evict this leaf, so
+     * the counters are taken before.
+     */
+    template <class R = paged_leaf>
+    R* split() {
+        leaf_type& l = get();
+        leaf_type* right = l.template split<leaf_type>();
+        changed(l);
+        return new R(right);
+    }
+
+    /*
+     * checkpoint state, see buffered_packed_vector::dirty()
+     */
+    bool dirty() const { return dirty_; }
+
+    void mark_clean() { dirty_ = false; }
+
+    bool resident() const { return resident_ != nullptr; }
+
+    /*
+     * starts reading the slot of this leaf in the background if it is not
+     * resident
+     */
+    void prefetch() const {
+        if (resident_ == nullptr) cache().advise(slot_);
+    }
+
+    /*
+     * memory used, the leaf_type only counts while resident
+     */
+    uint64_t bit_size() const {
+        return sizeof(paged_leaf) * 8 + (resident_ ? resident_->bit_size() : 0);
+    }
+
+    template <class F>
+    void for_each_block(F f) const {
+        f(static_cast<const void*>(this), sizeof(paged_leaf));
+        if (resident_ != nullptr) resident_->for_each_block(f);
+    }
+
+   private:
+    static constexpr uint64_t NO_SLOT = ~uint64_t(0);
+    static constexpr uint32_t NO_FRAME = ~uint32_t(0);
+    // Header, a full buffer and the words, rounded up to cache lines
+    static constexpr uint64_t SLOT_WORDS =
+        (4 + 64 + (max_bits + 64) / 64 + 1 + 7) / 8 * 8;
+
+    class pager {
+       public:
+        pager() { open("", 1024); }
+
+        ~pager() {
+            if (fd_ >= 0) close(fd_);
+        }
+
+        void open(const std::string& path, uint64_t frames) {
+            assert(live_ == 0 && "Configure paging before creating leaves");
+            assert(frames > 0);
+            if (fd_ >= 0) close(fd_);
+            path_ = path;
+            if (path.empty()) {
+                char name[] = "/tmp/paged_leavesXXXXXX";
+                fd_ = mkstemp(name);
+                if (fd_ >= 0) unlink(name);
+                path_ = name;
+            } else {
+                fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            }
+            if (fd_ < 0) fail();
+            frames_.assign(frames, frame{nullptr, false});
+            hand_ = 0;
+            free_slots_.clear();
+            next_slot_ = 0;
+            io_.assign(SLOT_WORDS, 0);
+            stats_ = stats();
+        }
+
+        /*
+         * gives p, whose leaf is about to be set, a frame
+         */
+        void install(paged_leaf* p) {
+            while (true) {
+                uint32_t f = hand_;
+                hand_ = hand_ + 1 == frames_.size() ? 0 : hand_ + 1;
+                frame& fr = frames_[f];
+                if (fr.owner != nullptr) {
+                    if (fr.referenced) {
+                        fr.referenced = false;
+                        continue;
+                    }
+                    evict(fr.owner);
+                }
+                fr.owner = p;
+                fr.referenced = true;
+                p->frame_ = f;
+                stats_.resident++;
+                return;
+            }
+        }
+
+        void touch(uint32_t f) { frames_[f].referenced = true; }
+
+        void fault(paged_leaf* p) {
+            install(p);
+            leaf_type* l = new leaf_type();
+            uint64_t offset = p->slot_ * SLOT_WORDS * 8;
+            ssize_t r = pread(fd_, io_.data(), SLOT_WORDS * 8, offset);
+            if (r < 32) fail();
+            l->deserialize(io_.data());
+            p->resident_ = l;
+            stats_.faults++;
+        }
+
+        /*
+         * leaf p is deleted
+         */
+        void release(paged_leaf* p) {
+            live_--;
+            if (p->resident_ != nullptr) {
+                delete p->resident_;
+                frames_[p->frame_].owner = nullptr;
+                stats_.resident--;
+            }
+            if (p->slot_ != NO_SLOT) free_slots_.push_back(p->slot_);
+        }
+
+        void advise(uint64_t slot) {
+            posix_fadvise(fd_, slot * SLOT_WORDS * 8, SLOT_WORDS * 8,
+                          POSIX_FADV_WILLNEED);
+        }
+
+        stats statistics() const {
+            stats s = stats_;
+            s.slots = next_slot_ - free_slots_.size();
+            return s;
+        }
+
+        // number of paged_leaf objects
+        uint64_t live_ = 0;
+
+       private:
+        struct frame {
+            paged_leaf* owner;
+            bool referenced;
+        };
+
+        void fail() {
+            std::cerr << "Paging I/O error on " << path_ << ": "
+                      << strerror(errno) << std::endl;
+            exit(1);
+        }
+
+        /*
+         * writes p back to its slot if it changed and drops its leaf
+         */
+        void evict(paged_leaf* p) {
+            if (p->modified_) {
+                if (p->slot_ == NO_SLOT) {
+                    if (free_slots_.empty()) {
+                        p->slot_ = next_slot_++;
+                    } else {
+                        p->slot_ = free_slots_.back();
+                        free_slots_.pop_back();
+                    }
+                }
+                uint64_t words = p->resident_->serialized_words();
+                // A bigger leaf would overwrite the next slot
+                if (words > SLOT_WORDS) {
+                    std::cerr << "Paged leaf of " << p->resident_->size()
+                              << " bits is larger than max_bits " << max_bits
+                              << std::endl;
+                    abort();
+                }
+                p->resident_->serialize(io_.data());
+                uint64_t offset = p->slot_ * SLOT_WORDS * 8;
+                if (pwrite(fd_, io_.data(), words * 8, offset) !=
+                    ssize_t(words * 8)) {
+                    fail();
+                }
+                p->modified_ = false;
+                stats_.writebacks++;
+            }
+            delete p->resident_;
+            p->resident_ = nullptr;
+            p->frame_ = NO_FRAME;
+            stats_.resident--;
+        }
+
+        int fd_ = -1;
+        std::string path_;
+        std::vector<frame> frames_;
+        uint32_t hand_ = 0;
+        std::vector<uint64_t> free_slots_;
+        uint64_t next_slot_ = 0;
+        // one slot, for reads and writes
+        std::vector<uint64_t> io_;
+        stats stats_;
+    };
+
+    static pager& cache() {
+        static pager p;
+        return p;
+    }
+
+    leaf_type& get() const {
+        if (resident_ == nullptr) {
+            cache().fault(const_cast<paged_leaf*>(this));
+        } else {
+            cache().touch(frame_);
+        }
+        return *resident_;
+    }
+
+    void adopt(leaf_type* l) {
+        cache().live_++;
+        cache().install(this);
+        resident_ = l;
+        changed(*l);
+    }
+
+    void changed(const leaf_type& l) {
+        size_ = l.size();
+        psum_ = l.psum();
+        modified_ = true;
+        dirty_ = true;
+    }
+
+    mutable leaf_type* resident_ = nullptr;
+    mutable uint32_t frame_ = NO_FRAME;
+    uint64_t slot_ = NO_SLOT;
+    uint64_t size_ = 0;
+    uint64_t psum_ = 0;
+    // changed since it was last written to its slot
+    bool modified_ = false;
+    bool dirty_ = true;
+};
+
+/*
+ * Starts reading the leaves of a tree of paged leaves overlapping [i, j) in
+ * the background.
+ */
+template <class T>
+void prefetch(const T& tree, uint64_t i, uint64_t j) {
+    tree.for_each_leaf(i, j, [](const typename T::shared_leaf& l) {
+        l.prefetch();
+    });
+}
+
+/*
+ * starts reading the leaves holding the given positions
+ */
+template <class T>
+void prefetch(const T& tree, const std::vector<uint64_t>& positions) {
+    for (uint64_t i : positions) prefetch(tree, i, i + 1);
+}
+}  // namespace dyn
@@ -0,0 +1,116 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include "bufferedbv.hpp"
+#include "bufferedtree.hpp"
+#include "paged.hpp"
+
+/*
+ * Throughput of a tree whose leaves are paged through a bounded cache, see
+ * paged.hpp.
+ *
+ * A tree of n random bits is built with a cache of the given number of
+ * frames, then measured with
+ *
+ *   scan           sequential extract of the whole tree
+ *   scan-prefetch  the same, prefetching the next chunks ahead
+ *   rank           random ranks
+ *   rank-batch     random ranks in batches, prefetched before each batch
+ *   insert         random inserts
+ *
+ * along with the faults and write backs of each phase. The leaf file can be
+ * put on the device under test.
+ *
+ * Usage: paged_bench [n] [frames] [file]
+ */
+
+typedef dyn::paged_leaf<dyn::buffered_packed_vector<8>, 8192> leaf;
+typedef dyn::buffered_tree<leaf, 8192, 16> tree;
+
+int main(int argc, char** argv) {
+    uint64_t n = 1000000000;
+    uint64_t frames = 4096;
+    std::string file;
+    if (argc > 1) std::istringstream(argv[1]) >> n;
+    if (argc > 2) std::istringstream(argv[2]) >> frames;
+    if (argc > 3) file = argv[3];
+    if (n == 0 || frames == 0) {
+        std::cerr << "Usage: " << argv[0] << " [n] [frames] [file]"
+                  << std::endl;
+        return 1;
+    }
+    leaf::configure(file, frames);
+
+    std::mt19937_64 gen(42);
+    tree t;
+    std::vector<uint64_t> chunk(1 << 16);
+    for (uint64_t done = 0; done < n; done += chunk.size() * 64) {
+        for (auto& w : chunk) w = gen();
+        uint64_t bits = std::min<uint64_t>(chunk.size() * 64, n - done);
+        t.append_words(chunk.data(), bits);
+    }
+    std::cerr << n / 8e6 << " MB of bits, cache of " << frames * 8192 / 8e6
+              << " MB" << std::endl;
+
+    std::cout << "phase\tMops/s\tfaults\twritebacks" << std::endl;
+    auto bench = [&](const char* name, uint64_t ops, auto f) {
+        auto before = leaf::statistics();
+        auto start = std::chrono::steady_clock::now();
+        uint64_t checksum = f();
+        std::chrono::duration<double> s =
+            std::chrono::steady_clock::now() - start;
+        auto after = leaf::statistics();
+        std::cout << name << "\t" << std::fixed << std::setprecision(3)
+                  << ops / s.count() / 1e6 << "\t"
+                  << after.faults - before.faults << "\t"
+                  << after.writebacks - before.writebacks << std::endl;
+        std::cerr << name << " checksum: " << checksum << std::endl;
+    };
+
+    const uint64_t step = chunk.size() * 64;
+    auto scan = [&](bool ahead) {
+        uint64_t sum = 0;
+        for (uint64_t i = 0; i < n; i += step) {
+            uint64_t j = std::min(n, i + step);
+            if (ahead && j < n) dyn::prefetch(t, j, std::min(n, j + step));
+            t.extract(i, j, chunk.data());
+            sum += chunk[0];
+        }
+        return sum;
+    };
+    // Words per op, to report Mwords/s for scans
+    bench("scan", n / 64, [&] { return scan(false); });
+    bench("scan-prefetch", n / 64, [&] { return scan(true); });
+
+    const uint64_t queries = 1000000;
+    std::vector<uint64_t> positions(queries);
+    for (auto& p : positions) p = gen() % n;
+    bench("rank", queries, [&] {
+        uint64_t sum = 0;
+        for (uint64_t p : positions) sum += t.rank(p);
+        return sum;
+    });
+    bench("rank-batch", queries, [&] {
+        uint64_t sum = 0;
+        const uint64_t batch = 256;
+        std::vector<uint64_t> next;
+        for (uint64_t b = 0; b < queries; b += batch) {
+            uint64_t e = std::min(queries, b + batch);
+            next.assign(positions.begin() + b, positions.begin() + e);
+            dyn::prefetch(t, next);
+            for (uint64_t p : next) sum += t.rank(p);
+        }
+        return sum;
+    });
+    bench("insert", queries / 10, [&] {
+        for (uint64_t k = 0; k < queries / 10; k++) {
+            t.insert(gen() % t.size(), k % 2);
+        }
+        return t.psum();
+    });
+    return 0;
+}
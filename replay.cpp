@@ -0,0 +1,100 @@
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+#include "bufferedbv.hpp"
+#include "dynamic.hpp"
+#include "spsi.hpp"
+#include "succinct_bitvector.hpp"
+
+#include "runners.hpp"
+#include "trace.hpp"
+
+typedef dyn::suc_bv sbv;
+
+template <uint8_t k>
+using bbv = dyn::succinct_bitvector<
+    dyn::spsi<dyn::buffered_packed_vector<k>, 8192, 16>>;
+
+/*
+ * Writes a uniform random op mix like the one in main.cpp as a trace.
+ */
+void record_random(const char *path, uint64_t initial_size, uint64_t num_ops) {
+    std::random_device rd;
+    std::mt19937_64 gen(rd());
+
+    bbv<8> tree;
+    for (uint64_t i = 0; i < initial_size; i++) {
+        tree.push_back(i % 2);
+    }
+    dyn::trace_recorder<bbv<8>> rec(tree, path);
+    for (uint64_t i = 0; i < num_ops; i++) {
+        uint64_t s = rec.size();
+        uint8_t op = gen() % 8;
+        if (s == 0) op = dyn::trace::PUSH_BACK;
+        switch (op) {
+            case dyn::trace::INSERT:
+                rec.insert(gen() % (s + 1), gen() % 2);
+                break;
+            case dyn::trace::REMOVE:
+                rec.remove(gen() % s);
+                break;
+            case dyn::trace::SET:
+                rec.set(gen() % s, gen() % 2);
+                break;
+            case dyn::trace::PUSH_BACK:
+                rec.push_back(gen() % 2);
+                break;
+            case dyn::trace::RANK:
+                rec.rank(gen() % s);
+                break;
+            case dyn::trace::SELECT: {
+                uint64_t ones = tree.rank(s);
+                if (ones) rec.select(gen() % ones);
+                }
+                break;
+            case dyn::trace::SELECT0: {
+                uint64_t zeros = s - tree.rank(s);
+                if (zeros) rec.select0(gen() % zeros);
+                }
+                break;
+            default:
+                rec.at(gen() % s);
+                break;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc == 5 && std::string(argv[1]) == "-r") {
+        uint64_t initial_size, num_ops;
+        std::istringstream(argv[3]) >> initial_size;
+        std::istringstream(argv[4]) >> num_ops;
+        record_random(argv[2], initial_size, num_ops);
+        return 0;
+    }
+    if (argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " <trace file>\n"
+                  << "       " << argv[0]
+                  << " -r <trace file> <initial size> <number of ops>"
+                  << std::endl;
+        return 1;
+    }
+
+    int w = 12;
+    dyn::trace_reader trace(argv[1]);
+
+    std::cout << "  buf:";
+    auto a = {0, 4, 8, 12, 16, 32};
+    for (auto v : a) std::cout << std::setw(w) << v;
+    std::cout << "\n      ";
+    std::cout << std::setw(w) << run_trace_timing<sbv>(trace);
+    std::cout << std::setw(w) << run_trace_timing<bbv<4>>(trace);
+    std::cout << std::setw(w) << run_trace_timing<bbv<8>>(trace);
+    std::cout << std::setw(w) << run_trace_timing<bbv<12>>(trace);
+    std::cout << std::setw(w) << run_trace_timing<bbv<16>>(trace);
+    std::cout << std::setw(w) << run_trace_timing<bbv<32>>(trace);
+    std::cout << std::endl;
+    return 0;
+}
@@ -0,0 +1,327 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "log_io.hpp"
+
+namespace dyn {
+/*
+ * Log shipping from one writer process to read-only followers on the same
+ * host.
+ *
+ * The writer updates its tree through a replication_source, which applies
+ * every update and encodes it as a trace record (see trace.hpp), the same
+ * way wal does. The records are appended to a stream file in frames. Each
+ * frame has a header with its length, a checksum, the number of records
+ * published up to and including the frame, and the time it was published.
+ * A frame is published when its records reach batch_bytes, when an update
+ * comes max_delay or more after its first record, or on publish(). A writer
+ * that goes idle calls tick() from a timer or its event loop, which
+ * publishes once max_delay has passed, to ship its last updates. Nothing is
+ * synced to disk. Followers on the same host read the frames from the page
+ * cache.
+ *
+ * The stream starts with a copy of the bits the tree held when the source
+ * was created. It is written to a temporary file that is then renamed to
+ * the stream path, so a follower never sees half a stream header and can
+ * attach at any time. A new replication_source starts a new stream, and
+ * followers of the old one stop receiving frames. The stream is never
+ * truncated.
+ *
+ * A replica follows a stream into its own tree. It loads the initial bits
+ * with append_words, and poll() applies the frames published since the last
+ * poll. Runs of push_backs are batched into append_words. A frame that is
+ * incomplete or fails its checksum is still being written, and is retried by
+ * the next poll. lag() is the time since the publication of the oldest
+ * frame that is not applied yet. Times are taken from steady_clock, which on
+ * Linux is the same clock in every process. To answer queries on other
+ * threads while the replica polls, the polling thread takes a snapshot() of
+ * the replica's tree between polls and hands it to them.
+ *
+ * T needs the buffered_tree interface, in particular extract and
+ * append_words. I/O errors are fatal.
+ */
+struct replication {
+    static constexpr char MAGIC[8] = {'B', 'V', 'R', 'E', 'P', 'L', 'S', '1'};
+    static const uint64_t CHUNK_WORDS = 1 << 16;
+
+    struct stream_header {
+        char magic[8];
+        uint64_t size;
+        uint64_t checksum;
+    };
+
+    struct frame_header {
+        uint32_t length;
+        uint32_t checksum;
+        // records published up to and including this frame
+        uint64_t records;
+        // steady_clock nanoseconds
+        int64_t time;
+    };
+
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    /*
+     * checksum of a frame, covering the records and the header fields
+     * after the checksum
+     */
+    static uint32_t checksum(const frame_header& h, const uint8_t* records) {
+        uint64_t c = log_file::hash(&h.records, sizeof(h.records));
+        c = log_file::hash(&h.time, sizeof(h.time), c);
+        return uint32_t(log_file::hash(records, h.length, c));
+    }
+};
+
+template <class T>
+class replication_source {
+   public:
+    /*
+     * Starts a new stream at path with the current bits of tree.
+     * batch_bytes bounds the records of a frame.
+     */
+    replication_source(
+        T& tree, const std::string& path, uint64_t batch_bytes = 1 << 16,
+        std::chrono::nanoseconds max_delay = std::chrono::milliseconds(1))
+        : tree_(tree),
+          path_(path),
+          batch_bytes_(batch_bytes),
+          max_delay_(max_delay.count()) {
+        assert(batch_bytes > 0 && batch_bytes < (uint64_t(1) << 31));
+        std::string tmp = path + ".tmp";
+        fd_ = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) log_file::fail(tmp);
+        replication::stream_header h;
+        memcpy(h.magic, replication::MAGIC, sizeof(h.magic));
+        h.size = tree_.size();
+        h.checksum = 0;
+        log_file::write_all(fd_, &h, sizeof(h), tmp);
+        std::vector<uint64_t> chunk(replication::CHUNK_WORDS);
+        uint64_t checksum = log_file::HASH_SEED;
+        for (uint64_t i = 0; i < h.size; i += chunk.size() * 64) {
+            uint64_t j = std::min<uint64_t>(h.size, i + chunk.size() * 64);
+            uint64_t bytes = (j - i + 63) / 64 * 8;
+            std::fill(chunk.begin(), chunk.end(), 0);
+            tree_.extract(i, j, chunk.data());
+            checksum = log_file::hash(chunk.data(), bytes, checksum);
+            log_file::write_all(fd_, chunk.data(), bytes, tmp);
+        }
+        h.checksum = checksum;
+        if (pwrite(fd_, &h, sizeof(h), 0) != sizeof(h)) {
+            log_file::fail(tmp);
+        }
+        if (rename(tmp.c_str(), path.c_str()) != 0) log_file::fail(tmp);
+        buffer_.resize(sizeof(replication::frame_header));
+    }
+
+    replication_source(const replication_source&) = delete;
+
+    replication_source& operator=(const replication_source&) = delete;
+
+    ~replication_source() {
+        publish();
+        close(fd_);
+    }
+
+    void insert(uint64_t i, bool x) {
+        tree_.insert(i, x);
+        record(trace::INSERT, i, x);
+    }
+
+    void remove(uint64_t i) {
+        tree_.remove(i);
+        record(trace::REMOVE, i, false);
+    }
+
+    void set(uint64_t i, bool x) {
+        tree_.set(i, x);
+        record(trace::SET, i, x);
+    }
+
+    void push_back(bool x) {
+        tree_.push_back(x);
+        record(trace::PUSH_BACK, 0, x);
+    }
+
+    /*
+     * appends the pending updates to the stream as one frame
+     */
+    void publish() {
+        if (pending_ == 0) return;
+        replication::frame_header h;
+        h.length = buffer_.size() - sizeof(h);
+        h.records = records_ + pending_;
+        h.time = replication::now();
+        h.checksum = replication::checksum(h, buffer_.data() + sizeof(h));
+        memcpy(buffer_.data(), &h, sizeof(h));
+        log_file::write_all(fd_, buffer_.data(), buffer_.size(), path_);
+        buffer_.resize(sizeof(h));
+        records_ = h.records;
+        pending_ = 0;
+    }
+
+    /*
+     * publishes the pending updates if max_delay has passed since the first
+     */
+    void tick() {
+        if (pending_ != 0 && replication::now() - first_ >= max_delay_) {
+            publish();
+        }
+    }
+
+    T& tree() { return tree_; }
+
+    /*
+     * updates published so far
+     */
+    uint64_t records() const { return records_; }
+
+    /*
+     * updates not yet published
+     */
+    uint64_t pending() const { return pending_; }
+
+   private:
+    void record(uint8_t op, uint64_t pos, bool x) {
+        trace::append(buffer_, op, pos, x);
+        int64_t time = replication::now();
+        if (pending_++ == 0) first_ = time;
+        if (buffer_.size() - sizeof(replication::frame_header) >=
+                batch_bytes_ ||
+            time - first_ >= max_delay_) {
+            publish();
+        }
+    }
+
+    T& tree_;
+    std::string path_;
+    uint64_t batch_bytes_;
+    int64_t max_delay_;
+    int fd_ = -1;
+    // frame header followed by the records of the next frame
+    std::vector<uint8_t> buffer_;
+    uint64_t records_ = 0;
+    uint64_t pending_ = 0;
+    // time of the first pending update
+    int64_t first_ = 0;
+};
+
+template <class T>
+class replica {
+   public:
+    /*
+     * Follows the stream at path, which has to exist, into tree, which has
+     * to be empty. Only the initial bits are loaded, the frames are applied
+     * by poll().
+     */
+    replica(T& tree, const std::string& path) : tree_(tree) {
+        assert(tree.size() == 0);
+        fd_ = open(path.c_str(), O_RDONLY);
+        if (fd_ < 0) log_file::fail(path);
+        replication::stream_header h;
+        if (!log_file::read_all(fd_, &h, sizeof(h), 0) ||
+            memcmp(h.magic, replication::MAGIC, sizeof(h.magic)) != 0) {
+            std::cerr << path << " is not a replication stream" << std::endl;
+            exit(1);
+        }
+        std::vector<uint64_t> chunk(replication::CHUNK_WORDS);
+        uint64_t checksum = log_file::HASH_SEED;
+        offset_ = sizeof(h);
+        for (uint64_t i = 0; i < h.size; i += chunk.size() * 64) {
+            uint64_t bits = std::min<uint64_t>(h.size - i, chunk.size() * 64);
+            uint64_t bytes = (bits + 63) / 64 * 8;
+            if (!log_file::read_all(fd_, chunk.data(), bytes, offset_)) {
+                std::cerr << path << " is truncated" << std::endl;
+                exit(1);
+            }
+            checksum = log_file::hash(chunk.data(), bytes, checksum);
+            tree_.append_words(chunk.data(), bits);
+            offset_ += bytes;
+        }
+        if (checksum != h.checksum) {
+            std::cerr << path << " is corrupted" << std::endl;
+            exit(1);
+        }
+        bits_.resize(replication::CHUNK_WORDS, 0);
+    }
+
+    replica(const replica&) = delete;
+
+    replica& operator=(const replica&) = delete;
+
+    ~replica() { close(fd_); }
+
+    /*
+     * Applies the frames published since the last poll, returns the number
+     * of updates applied.
+     */
+    uint64_t poll() {
+        uint64_t before = records_;
+        while (true) {
+            replication::frame_header h;
+            if (!log_file::read_all(fd_, &h, sizeof(h), offset_) ||
+                h.length == 0) {
+                break;
+            }
+            frame_.resize(h.length);
+            if (!log_file::read_all(fd_, frame_.data(), h.length,
+                                    offset_ + sizeof(h)) ||
+                replication::checksum(h, frame_.data()) != h.checksum) {
+                break;
+            }
+            apply_records(tree_, frame_.data(), frame_.data() + frame_.size(),
+                          bits_);
+            offset_ += sizeof(h) + h.length;
+            records_ = h.records;
+        }
+        return records_ - before;
+    }
+
+    T& tree() { return tree_; }
+
+    /*
+     * updates applied so far
+     */
+    uint64_t records() const { return records_; }
+
+    /*
+     * Time since the publication of the oldest frame that is not applied
+     * yet, 0 if all published frames are applied. Reads the header of the
+     * next frame in the stream.
+     */
+    std::chrono::nanoseconds lag() const {
+        replication::frame_header h;
+        if (!log_file::read_all(fd_, &h, sizeof(h), offset_) ||
+            h.length == 0) {
+            return std::chrono::nanoseconds(0);
+        }
+        return std::chrono::nanoseconds(
+            std::max<int64_t>(0, replication::now() - h.time));
+    }
+
+   private:
+    T& tree_;
+    int fd_ = -1;
+    // start of the next frame in the stream
+    uint64_t offset_ = 0;
+    uint64_t records_ = 0;
+    std::vector<uint8_t> frame_;
+    std::vector<uint64_t> bits_;
+};
+}  // namespace dyn
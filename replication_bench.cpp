@@ -0,0 +1,114 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "bufferedbv.hpp"
+#include "bufferedtree.hpp"
+#include "replication.hpp"
+
+/*
+ * Lag of the followers of a replication stream, see replication.hpp.
+ *
+ * The writer builds a tree of n random bits, starts a stream and forks the
+ * followers, which load the stream and poll it. The writer then makes random
+ * inserts, removes and sets at full speed. It reports its update throughput
+ * and each follower reports the throughput of its polls and the mean and
+ * maximum lag it had when it started the polls that applied frames.
+ *
+ * Usage: replication_bench [n] [updates] [followers] [file]
+ */
+
+typedef dyn::buffered_tree<dyn::buffered_packed_vector<8>, 8192, 16> tree;
+
+void follow(uint64_t id, const std::string& path, uint64_t updates) {
+    tree t;
+    auto start = std::chrono::steady_clock::now();
+    dyn::replica<tree> r(t, path);
+    std::chrono::duration<double> load =
+        std::chrono::steady_clock::now() - start;
+    std::chrono::duration<double> busy(0);
+    double lag_sum = 0;
+    double lag_max = 0;
+    uint64_t polls = 0;
+    while (r.records() < updates) {
+        double lag = r.lag().count() / 1e6;
+        auto poll_start = std::chrono::steady_clock::now();
+        if (r.poll() == 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(20));
+            continue;
+        }
+        busy += std::chrono::steady_clock::now() - poll_start;
+        lag_sum += lag;
+        lag_max = std::max(lag_max, lag);
+        polls++;
+    }
+    std::cout << "follower " << id << "\t" << std::fixed
+              << std::setprecision(3) << load.count() << "\t"
+              << updates / busy.count() / 1e6 << "\t" << lag_sum / polls
+              << "\t" << lag_max << "\t" << t.psum() << std::endl;
+}
+
+int main(int argc, char** argv) {
+    uint64_t n = 100000000;
+    uint64_t updates = 10000000;
+    uint64_t followers = 4;
+    std::string path = "replication_bench.stream";
+    if (argc > 1) std::istringstream(argv[1]) >> n;
+    if (argc > 2) std::istringstream(argv[2]) >> updates;
+    if (argc > 3) std::istringstream(argv[3]) >> followers;
+    if (argc > 4) path = argv[4];
+    if (n == 0) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [n] [updates] [followers] [file]" << std::endl;
+        return 1;
+    }
+
+    std::mt19937_64 gen(42);
+    tree t;
+    std::vector<uint64_t> chunk(1 << 16);
+    for (uint64_t done = 0; done < n; done += chunk.size() * 64) {
+        for (auto& w : chunk) w = gen();
+        uint64_t bits = std::min<uint64_t>(chunk.size() * 64, n - done);
+        t.append_words(chunk.data(), bits);
+    }
+
+    std::cout << "process\tload s\tMops/s\tlag ms\tmax lag ms\tpsum"
+              << std::endl;
+    {
+        dyn::replication_source<tree> source(t, path);
+        for (uint64_t id = 0; id < followers; id++) {
+            if (fork() == 0) {
+                follow(id, path, updates);
+                _exit(0);
+            }
+        }
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t k = 0; k < updates; k++) {
+            uint64_t op = gen() % 3;
+            if (op == 0) {
+                source.insert(gen() % (t.size() + 1), gen() % 2);
+            } else if (op == 1) {
+                source.remove(gen() % t.size());
+            } else {
+                source.set(gen() % t.size(), gen() % 2);
+            }
+        }
+        source.publish();
+        std::chrono::duration<double> s =
+            std::chrono::steady_clock::now() - start;
+        std::cout << "writer\t0\t" << std::fixed << std::setprecision(3)
+                  << updates / s.count() / 1e6 << "\t0\t0\t" << t.psum()
+                  << std::endl;
+    }
+    while (wait(nullptr) > 0) {
+    }
+    unlink(path.c_str());
+    return 0;
+}
@@ -6,6 +6,8 @@
 #include <iostream>
 #include <vector>
 
+#include "trace.hpp"
+
 template <class T>
 uint8_t execute_op(T &buffered_tree, std::vector<uint32_t> &ops, size_t i,
                    uint64_t &out) {
@@ -43,6 +45,14 @@ uint8_t execute_op(T &buffered_tree, std::vector<uint32_t> &ops, size_t i,
             out = buffered_tree.select(ops[i + 1] % ba_r);
             }
             return 2;
+        case 7: {
+            out = 0;
+            if (s == 0) return 2;
+            uint64_t ba_r0 = s - 1 - buffered_tree.rank(s - 1);
+            if (ba_r0 == 0) return 2;
+            out = buffered_tree.select0(ops[i + 1] % ba_r0);
+            }
+            return 2;
         default:
             out = 0;
             if (s == 0) return 2;
@@ -102,6 +112,29 @@ double run_timing(std::vector<uint32_t> &ops) {
     return elapsed.count();
 }
 
+template <class T>
+double run_trace_timing(const dyn::trace_reader &trace) {
+    auto tree = new T();
+    trace.load(*tree);
+
+    auto start = std::chrono::steady_clock::now();
+    const uint8_t *rec = trace.begin();
+    const uint8_t *end = trace.end();
+    uint64_t tot = 0;
+    uint64_t val = 0;
+    while (rec < end) {
+        rec += dyn::execute_trace_op<T>(*tree, rec, val);
+        tot += val;
+    }
+    auto end_time = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = end_time - start;
+    std::cerr << "tot: " << tot << std::endl;
+
+    delete tree;
+
+    return elapsed.count();
+}
+
 template <class A, class B>
 bool run_test(std::vector<uint32_t> &ops) {
     auto a_tree = new A();
@@ -1,3 +1,12 @@
+#ifndef BV_STATS
+#define BV_STATS
+#endif
+
+#include <malloc.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <random>
 #include <sstream>
@@ -9,34 +18,123 @@
 
 typedef dyn::suc_bv sbv;
 
-typedef dyn::succinct_bitvector<
-    dyn::spsi<dyn::buffered_packed_vector<8>, 8192, 16>>
-    bbv;
+template <uint8_t k, uint32_t max_size = 0>
+using bbv = dyn::succinct_bitvector<
+    dyn::spsi<dyn::buffered_packed_vector<k, max_size>, 8192, 16>>;
 
-int main(int argc, char **argv) {
+/*
+ * Space usage of buffered trees.
+ *
+ * This translation unit is compiled with BV_STATS so the leaves keep a tally
+ * of live leaves and allocated words. The space reported by bit_size() is
+ * broken down into payload, word slack, buffers, leaf headers, estimated
+ * allocator overhead and internal nodes (everything bit_size() counts that is
+ * not in a leaf). It is compared to the bytes malloc reports in use and to the
+ * change in resident set size.
+ *
+ * max is the max_size of the leaf type, 0 for the default layout. All columns
+ * from total to rss are bits per element. buf_bits is the total buffer
+ * overhead of the tree and bound the upper bound for it stated in the README,
+ * both in bits.
+ *
+ * Chunks cached in the glibc tcache are reported as in use by mallinfo2, so
+ * run with GLIBC_TUNABLES=glibc.malloc.tcache_count=0 for an exact malloc
+ * column.
+ */
 
-    std::random_device rd;
-    std::mt19937 gen(rd());
+uint64_t rss_bytes() {
+    std::ifstream statm("/proc/self/statm");
+    uint64_t size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
 
-    if (argc < 2) {
-        std::cerr << "Number of elements required" << std::endl;
-        return 1;
-    }
+uint64_t malloc_bytes() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
 
-    std::istringstream ss(argv[1]);
-    int x;
-    if (!(ss >> x)) {
-        std::cerr << "Invalid number: " << argv[1] << '\n';
-        return 1;
-    }
+template <uint8_t k, uint32_t max_size = 0>
+void measure(std::mt19937 &gen, uint64_t n) {
+    typedef dyn::buffered_packed_vector<k, max_size> leaf;
 
-    auto tree = new bbv();
-    tree->push_back(0);
+    uint64_t rss = rss_bytes();
+    uint64_t heap = malloc_bytes();
 
-    for (size_t i = 1; i < x; i++) {
+    auto tree = new bbv<k, max_size>();
+    tree->push_back(0);
+    for (uint64_t i = 1; i < n; i++) {
         tree->insert(gen() % i, gen() % 2);
     }
 
-    std::cout << "Tree with " << tree->size() << " elements and " << tree->rank(x - 1) << " ones. Taking " << tree->bit_size() << " bits of space." << std::endl;
+    int64_t heap_used = int64_t(malloc_bytes()) - heap;
+    int64_t rss_used = int64_t(rss_bytes()) - rss;
+
+    typename leaf::space per_leaf = leaf().space_usage();
+    uint64_t leaves = dyn::bv_stats::leaves;
+    uint64_t words = dyn::bv_stats::word_capacity;
+    uint64_t payload = n;
+    uint64_t slack = words * 64 - payload;
+    uint64_t buffers = leaves * per_leaf.buffer;
+    uint64_t headers = leaves * per_leaf.header;
+    uint64_t allocator =
+        (leaves * dyn::malloc_overhead(sizeof(leaf)) +
+         dyn::bv_stats::word_malloc_overhead) *
+        8;
+    uint64_t total = tree->bit_size();
+    uint64_t internal =
+        total - payload - slack - buffers - headers - allocator;
+
+    // Bound from the README: (1 + 2n/b) leaves with per_leaf.buffer bits
+    double bound = (1 + 2.0 * n / 8192) * per_leaf.buffer;
+    uint64_t buffer_overhead = leaves * per_leaf.buffer;
 
-}
\ No newline at end of file
+    double dn = n;
+    std::cout << n << "\t" << uint32_t(k) << "\t" << max_size << "\t"
+              << leaves << "\t"
+              << std::fixed << std::setprecision(4) << total / dn << "\t"
+              << payload / dn << "\t" << slack / dn << "\t" << buffers / dn
+              << "\t" << headers / dn << "\t" << allocator / dn << "\t"
+              << internal / dn << "\t" << heap_used * 8 / dn << "\t"
+              << rss_used * 8 / dn << "\t" << buffer_overhead << "\t"
+              << std::setprecision(1) << bound << std::endl;
+
+    delete tree;
+}
+
+void sweep(std::mt19937 &gen, uint64_t n) {
+    measure<4>(gen, n);
+    measure<8>(gen, n);
+    measure<16>(gen, n);
+    measure<32>(gen, n);
+    measure<8, 16383>(gen, n);
+    measure<16, 16383>(gen, n);
+    measure<32, 16383>(gen, n);
+}
+
+int main(int argc, char **argv) {
+    std::random_device rd;
+    std::mt19937 gen(rd());
+
+    std::cout << "n\tbuf\tmax\tleaves\ttotal\tpayload\tslack\tbuffer\theader\t"
+                 "alloc\tnodes\tmalloc\trss\tbuf_bits\tbound"
+              << std::endl;
+
+    if (argc > 1) {
+        std::istringstream ss(argv[1]);
+        uint64_t x;
+        if (!(ss >> x) || x == 0) {
+            std::cerr << "Invalid number: " << argv[1] << '\n';
+            return 1;
+        }
+        sweep(gen, x);
+        return 0;
+    }
+
+    for (uint64_t n = 100000; n <= 100000000; n *= 10) {
+        sweep(gen, n);
+    }
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "../bufferedbv.hpp"
+
+namespace dyn {
+/*
+ * Test access to the internals of buffered_packed_vector, which declares it a
+ * friend.
+ */
+struct bv_test_access {
+    /*
+     * The commit() that moved every word by one edit at a time, kept for the
+     * tests to check the words of commit() against
+     */
+    template <class T>
+    static void commit_reference(T& bv) {
+        if (bv.size_ > bv.fast_mul(bv.words.size())) {
+            bv.words.reserve(bv.words.size() + bv.extra_);
+            bv.words.resize(bv.words.size() + bv.extra_, 0);
+        }
+
+        uint64_t overflow = 0;
+        uint8_t overflow_length = 0;
+        uint8_t underflow_length = 0;
+        size_t current_word = 0;
+        uint8_t current_index = 0;
+        typename T::buffer_type buf = bv.buffer[current_index];
+        size_t target_word = bv.fast_div(bv.buffer_index(buf));
+        size_t target_offset = bv.fast_mod(bv.buffer_index(buf));
+
+        while (current_word < bv.words.size()) {
+            uint64_t underflow = current_word + 1 < bv.words.size()
+                                     ? bv.words[current_word + 1]
+                                     : 0;
+            if (overflow_length) {
+                underflow = (underflow << overflow_length) |
+                            (bv.words[current_word] >> (64 - overflow_length));
+            }
+
+            uint64_t new_overflow = 0;
+            //If buffers need to be commit to this word:
+            if (current_word == target_word &&
+                current_index < bv.buffer_count) {
+                uint64_t word =
+                    underflow_length
+                        ? (bv.words[current_word] >> underflow_length) |
+                              (underflow << (64 - underflow_length))
+                        : (bv.words[current_word] << overflow_length) |
+                              overflow;
+                underflow >>= underflow_length;
+                uint64_t new_word = 0;
+                uint8_t start_offset = 0;
+                //While there are buffers for this word
+                while (current_word == target_word) {
+                    new_word |= (word << start_offset) &
+                                ((T::MASK << target_offset) - 1);
+                    word = (word >> (target_offset - start_offset)) |
+                           (target_offset == 0
+                                ? 0
+                                : target_offset - start_offset == 0
+                                      ? 0
+                                      : (underflow << (64 - (target_offset -
+                                                             start_offset))));
+                    underflow >>= target_offset - start_offset;
+                    if (bv.buffer_is_insertion(buf)) {
+                        if (bv.buffer_value(buf)) {
+                            new_word |= T::MASK << target_offset;
+                        }
+                        start_offset = target_offset + 1;
+                        if (underflow_length)
+                            underflow_length--;
+                        else
+                            overflow_length++;
+                    } else {
+                        word >>= 1;
+                        word |= underflow << 63;
+                        underflow >>= 1;
+                        if (overflow_length)
+                            overflow_length--;
+                        else
+                            underflow_length++;
+                        start_offset = target_offset;
+                    }
+                    current_index++;
+                    if (current_index >= bv.buffer_count) break;
+                    buf = bv.buffer[current_index];
+                    target_word = bv.fast_div(bv.buffer_index(buf));
+                    target_offset = bv.fast_mod(bv.buffer_index(buf));
+                }
+                new_word |=
+                    start_offset < 64 ? (word << start_offset) : uint64_t(0);
+                new_overflow = overflow_length ? bv.words[current_word] >>
+                                                     (64 - overflow_length)
+                                               : 0;
+                bv.words[current_word] = new_word;
+            } else {
+                if (underflow_length) {
+                    bv.words[current_word] =
+                        (bv.words[current_word] >> underflow_length) |
+                        (underflow << (64 - underflow_length));
+                } else if (overflow_length) {
+                    new_overflow =
+                        bv.words[current_word] >> (64 - overflow_length);
+                    bv.words[current_word] =
+                        (bv.words[current_word] << overflow_length) | overflow;
+                    overflow = new_overflow;
+                } else {
+                    overflow = 0;
+                }
+            }
+            overflow = new_overflow;
+            current_word++;
+        }
+        bv.buffer_count = 0;
+        bv.phys_size_ = bv.size_;
+    }
+
+    template <class T>
+    static const std::vector<uint64_t>& words(const T& bv) {
+        return bv.words;
+    }
+};
+}  // namespace dyn
@@ -1,7 +1,12 @@
 #pragma once
 
+#include <chrono>
 #include <cstdint>
+#include <filesystem>
 #include <iostream>
+#include <random>
+#include <thread>
+#include <utility>
 
 typedef dyn::suc_bv control_bv;
 
@@ -99,6 +104,217 @@ void pv_remove_test() {
     EXPECT_EQ(bv->psum(), 0) << "Should be no ones left";
 }
 
+template <class T>
+void pv_split_test() {
+    std::mt19937_64 gen(47);
+    for (uint64_t round = 0; round < 200; round++) {
+        auto bv = new T();
+        std::vector<bool> control;
+        uint64_t fill = 128 + gen() % 2000;
+        for (uint64_t i = 0; i < fill; i++) {
+            bool x = gen() % 2;
+            bv->push_back(x);
+            control.push_back(x);
+        }
+        // Leave up to a full buffer of pending edits
+        uint64_t edits = gen() % 16;
+        for (uint64_t k = 0; k < edits; k++) {
+            uint64_t i = gen() % control.size();
+            if (gen() % 2) {
+                bool x = gen() % 2;
+                bv->insert(i, x);
+                control.insert(control.begin() + i, x);
+            } else {
+                bv->remove(i);
+                control.erase(control.begin() + i);
+            }
+        }
+        auto right = bv->split();
+        ASSERT_EQ(control.size(), bv->size() + right->size());
+        uint64_t ones = 0;
+        for (uint64_t i = 0; i < bv->size(); i++) {
+            ASSERT_EQ(control[i], bv->at(i)) << "Left at " << i;
+            ones += control[i];
+        }
+        ASSERT_EQ(ones, bv->psum());
+        ones = 0;
+        for (uint64_t i = 0; i < right->size(); i++) {
+            bool x = control[bv->size() + i];
+            ASSERT_EQ(x, right->at(i)) << "Right at " << i;
+            ones += x;
+        }
+        ASSERT_EQ(ones, right->psum());
+        // Both halves keep working with the edits they inherited
+        for (auto half : {bv, right}) {
+            for (uint64_t k = 0; k < 40; k++) {
+                half->insert(gen() % (half->size() + 1), k % 2);
+                half->remove(gen() % half->size());
+            }
+            auto copy = new T(*half);
+            copy->commit();
+            for (uint64_t i = 0; i < half->size(); i++) {
+                ASSERT_EQ(copy->at(i), half->at(i));
+            }
+            ASSERT_EQ(copy->rank(copy->size()), half->psum());
+            delete copy;
+        }
+        delete bv;
+        delete right;
+    }
+}
+
+template <class T>
+void pv_max_size_test(const uint64_t max_size) {
+    T bv;
+    for (uint64_t i = 0; i < max_size; i++) bv.push_back(i % 2);
+    ASSERT_EQ(max_size, bv.size());
+    EXPECT_DEATH(bv.push_back(1), "max_size");
+    EXPECT_DEATH(bv.insert(0, 1), "max_size");
+    uint64_t word = 1;
+    EXPECT_DEATH(bv.append_bits(&word, 0, 1), "max_size");
+    // append_bits fills a leaf up to max_size, as push_back does
+    std::vector<uint64_t> words((max_size + 63) / 64, ~uint64_t(0));
+    T appended;
+    appended.append_bits(words.data(), 0, max_size - 1);
+    appended.append_bits(words.data(), 0, 1);
+    ASSERT_EQ(max_size, appended.size());
+    ASSERT_EQ(max_size, appended.psum());
+    EXPECT_DEATH(appended.append_bits(words.data(), 0, 1), "max_size");
+}
+
+template <class T>
+void iv_max_size_test(const uint64_t max_size) {
+    T iv;
+    for (uint64_t i = 0; i < max_size; i++) iv.push_back(i % 3);
+    ASSERT_EQ(max_size, iv.size());
+    EXPECT_DEATH(iv.push_back(1), "max_size");
+    EXPECT_DEATH(iv.append(1), "max_size");
+    EXPECT_DEATH(iv.insert(0, 1), "max_size");
+    EXPECT_DEATH(iv.insert_word(0, 1, 2, 1), "max_size");
+}
+
+/*
+ * Commits copies of the leaf bv with commit() and commit_reference() and
+ * compares their words. Does nothing for trees.
+ */
+template <uint8_t k, uint32_t max_size>
+void check_commit(const dyn::buffered_packed_vector<k, max_size>& bv) {
+    dyn::buffered_packed_vector<k, max_size> committed(bv);
+    dyn::buffered_packed_vector<k, max_size> reference(bv);
+    committed.commit();
+    dyn::bv_test_access::commit_reference(reference);
+    ASSERT_EQ(reference.size(), committed.size());
+    ASSERT_EQ(dyn::bv_test_access::words(reference),
+              dyn::bv_test_access::words(committed));
+}
+
+template <class T>
+void check_commit(const T&) {}
+
+template <class T>
+void pv_commit_test() {
+    std::mt19937_64 gen(50);
+    for (uint64_t round = 0; round < 2000; round++) {
+        T bv;
+        std::vector<bool> control;
+        uint64_t fill = gen() % 1500;
+        for (uint64_t i = 0; i < fill; i++) {
+            bool x = gen() % 2;
+            bv.push_back(x);
+            control.push_back(x);
+        }
+        bv.commit();
+        // Random positions, clustered in a few words, or at the end
+        uint64_t mode = gen() % 3;
+        uint64_t center = gen() % (control.size() + 1);
+        uint64_t edits = gen() % 64;
+        for (uint64_t k = 0; k < edits; k++) {
+            uint64_t n = control.size();
+            uint64_t i = gen() % (n + 1);
+            if (mode == 1) {
+                i = std::min(n, center + gen() % 128);
+            } else if (mode == 2) {
+                i = n - std::min(n, gen() % 4);
+            }
+            if (n == 0 || gen() % 2) {
+                bool x = gen() % 2;
+                bv.insert(i, x);
+                control.insert(control.begin() + i, x);
+            } else {
+                i = std::min(i, n - 1);
+                bv.remove(i);
+                control.erase(control.begin() + i);
+            }
+        }
+        check_commit(bv);
+        // The buffered view and the committed words agree
+        T committed(bv);
+        committed.commit();
+        ASSERT_EQ(control.size(), committed.size());
+        uint64_t ones = 0;
+        for (uint64_t i = 0; i < control.size(); i++) {
+            ASSERT_EQ(control[i], bv.at(i)) << "Round " << round;
+            ASSERT_EQ(control[i], committed.at(i)) << "Round " << round;
+            ones += control[i];
+        }
+        ASSERT_EQ(ones, committed.psum());
+        ASSERT_EQ(ones, committed.rank(committed.size()));
+        // Bits past the end are clear
+        for (uint64_t k = 0; k < 100; k++) committed.push_back(false);
+        committed.commit();
+        ASSERT_EQ(ones, committed.rank(committed.size()));
+    }
+}
+
+template <class T>
+void pv_copy_test() {
+    std::mt19937_64 gen(51);
+    T bv;
+    std::vector<bool> control;
+    for (uint64_t i = 0; i < 1000; i++) {
+        bool x = gen() % 2;
+        bv.push_back(x);
+        control.push_back(x);
+    }
+    // Pending edits are copied along with the words
+    for (uint64_t k = 0; k < 5; k++) {
+        uint64_t i = gen() % control.size();
+        bv.insert(i, k % 2);
+        control.insert(control.begin() + i, k % 2);
+    }
+    auto check = [&](const T& v) {
+        ASSERT_EQ(control.size(), v.size());
+        uint64_t ones = 0;
+        for (uint64_t i = 0; i < control.size(); i++) {
+            ASSERT_EQ(control[i], v.at(i)) << "At " << i;
+            ones += control[i];
+        }
+        ASSERT_EQ(ones, v.psum());
+    };
+    bv.mark_clean();
+    T copy(bv);
+    check(copy);
+    ASSERT_TRUE(copy.dirty());
+    T assigned;
+    assigned.push_back(true);
+    assigned.mark_clean();
+    assigned = bv;
+    check(assigned);
+    ASSERT_TRUE(assigned.dirty());
+    T moved(std::move(copy));
+    check(moved);
+    ASSERT_EQ(0u, copy.size());
+    T move_assigned;
+    move_assigned = std::move(assigned);
+    check(move_assigned);
+    ASSERT_EQ(0u, assigned.size());
+    // Moved from leaves can be used again
+    copy.push_back(true);
+    ASSERT_EQ(1u, copy.size());
+    ASSERT_EQ(1u, copy.psum());
+    ASSERT_FALSE(bv.dirty());
+}
+
 template <class T>
 T* generate_tree(const uint64_t amount) {
     auto tree = new T();
@@ -114,6 +330,62 @@ T* generate_tree(const uint64_t amount) {
     return tree;
 }
 
+/*
+ * n inserts of random bits at random positions into tree and control
+ */
+template <class T>
+void random_inserts(T& tree, std::vector<bool>& control, uint64_t n,
+                    std::mt19937_64& gen) {
+    for (uint64_t k = 0; k < n; k++) {
+        uint64_t i = gen() % (control.size() + 1);
+        bool x = gen() % 2;
+        tree.insert(i, x);
+        control.insert(control.begin() + i, x);
+    }
+}
+
+/*
+ * A random insert, remove, set or push_back, applied to control and through
+ * w, which is a tree or anything forwarding updates to one. Inserts if
+ * control is empty.
+ */
+template <class W>
+void random_update(W& w, std::vector<bool>& control, std::mt19937_64& gen) {
+    uint64_t op = gen() % 4;
+    bool x = gen() % 2;
+    if (op == 0 || control.empty()) {
+        uint64_t i = gen() % (control.size() + 1);
+        w.insert(i, x);
+        control.insert(control.begin() + i, x);
+    } else if (op == 1) {
+        uint64_t i = gen() % control.size();
+        w.remove(i);
+        control.erase(control.begin() + i);
+    } else if (op == 2) {
+        uint64_t i = gen() % control.size();
+        w.set(i, x);
+        control[i] = x;
+    } else {
+        w.push_back(x);
+        control.push_back(x);
+    }
+}
+
+/*
+ * compares the bits, ranks and number of ones of tree to control
+ */
+template <class T, class C>
+void check_bits(const T& tree, const C& control, const char* what) {
+    ASSERT_EQ(control.size(), tree.size()) << what;
+    uint64_t ones = 0;
+    for (uint64_t k = 0; k < control.size(); k++) {
+        ASSERT_EQ(bool(control[k]), tree.at(k)) << what << " at " << k;
+        ASSERT_EQ(ones, tree.rank(k)) << what << " rank " << k;
+        ones += control[k];
+    }
+    ASSERT_EQ(ones, tree.psum()) << what;
+}
+
 template <class T>
 void run_test(std::vector<uint32_t>& ops) {
     auto buffered_tree = generate_tree<T>(ops[0]);
@@ -250,6 +522,7 @@ void mixture_test(const uint64_t size) {
         if (s != i + 1) {
             return;
         }
+        check_commit(*tree);
     }
 
     for (uint64_t i = 0; i < size; i++) {
@@ -261,6 +534,7 @@ void mixture_test(const uint64_t size) {
 
     for (uint64_t i = 1; i < size; i++) {
         tree->remove(0);
+        check_commit(*tree);
         auto new_size = tree->size();
         EXPECT_EQ(size - i, new_size)
             << "Expect size of " << (size - i) << " after removal";
@@ -349,4 +623,987 @@ void remove_test(const uint64_t size) {
         }
     }
     delete tree;
-}
\ No newline at end of file
+}
+
+template <class T>
+void trace_test(const uint64_t size) {
+    const char* path = "trace_test.bin";
+    auto tree = generate_tree<T>(size);
+    std::mt19937_64 gen(size);
+    // Unrecorded updates, which the trace gets from its initial bits
+    for (uint64_t i = 0; i < size / 4; i++) tree->set(gen() % size, gen() % 2);
+    std::vector<uint64_t> results;
+    {
+        dyn::trace_recorder<T> rec(*tree, path);
+        for (uint64_t i = 0; i < size; i++) {
+            uint64_t s = rec.size();
+            switch (gen() % 8) {
+                case 0:
+                    rec.insert(gen() % (s + 1), gen() % 2);
+                    break;
+                case 1:
+                    if (s) rec.remove(gen() % s);
+                    break;
+                case 2:
+                    if (s) rec.set(gen() % s, gen() % 2);
+                    break;
+                case 3:
+                    rec.push_back(gen() % 2);
+                    break;
+                case 4:
+                    if (s) results.push_back(rec.rank(gen() % s));
+                    break;
+                case 5:
+                    if (tree->rank(s)) {
+                        results.push_back(rec.select(gen() % tree->rank(s)));
+                    }
+                    break;
+                case 7:
+                    if (s - tree->rank(s)) {
+                        results.push_back(
+                            rec.select0(gen() % (s - tree->rank(s))));
+                    }
+                    break;
+                default:
+                    if (s) results.push_back(rec.at(gen() % s));
+                    break;
+            }
+        }
+    }
+
+    dyn::trace_reader trace(path);
+    EXPECT_EQ(trace.initial_size(), size);
+    auto control = new control_bv();
+    trace.load(*control);
+    size_t r = 0;
+    const uint8_t* rec = trace.begin();
+    while (rec < trace.end()) {
+        uint8_t op = *rec & dyn::trace::OP_MASK;
+        uint64_t val = 0;
+        rec += dyn::execute_trace_op(*control, rec, val);
+        if (op >= dyn::trace::RANK) {
+            ASSERT_LT(r, results.size()) << "Too many queries in trace";
+            ASSERT_EQ(val, results[r])
+                << "Replayed query " << r << " gave a different result";
+            r++;
+        }
+    }
+    EXPECT_EQ(r, results.size()) << "All queries should be in the trace";
+    ASSERT_EQ(control->size(), tree->size());
+    for (uint64_t i = 0; i < tree->size(); i++) {
+        ASSERT_EQ(control->at(i), tree->at(i)) << "Replay differs at " << i;
+    }
+    // A record cut short at the end is dropped
+    uint64_t records = trace.end() - trace.begin();
+    FILE* f = fopen(path, "ab");
+    fputc(dyn::trace::RANK, f);
+    fputc(0x80, f);
+    fclose(f);
+    dyn::trace_reader truncated(path);
+    EXPECT_EQ(uint64_t(truncated.end() - truncated.begin()), records);
+    unlink(path);
+    delete tree;
+    delete control;
+}
+
+template <class T>
+void range_test(const uint64_t size) {
+    auto tree = new T();
+    std::mt19937_64 gen(size);
+    tree->push_back(0);
+    for (uint64_t i = 1; i < size; i++) {
+        tree->insert(gen() % (tree->size() + 1), gen() % 2);
+        if (i % 3 == 0) tree->remove(gen() % tree->size());
+    }
+    uint64_t s = tree->size();
+    std::vector<uint64_t> out(s / 64 + 2);
+    for (uint64_t r = 0; r < 200; r++) {
+        uint64_t i = gen() % s;
+        uint64_t j = i + gen() % (s - i + 1);
+        uint64_t ones = 0;
+        for (uint64_t k = i; k < j; k++) ones += tree->at(k);
+        ASSERT_EQ(ones, tree->count_ones(i, j))
+            << "count_ones(" << i << ", " << j << ")";
+
+        std::fill(out.begin(), out.end(), ~uint64_t(0));
+        tree->extract(i, j, out.data());
+        for (uint64_t k = i; k < j; k++) {
+            bool v = (out[(k - i) / 64] >> ((k - i) % 64)) & 1;
+            ASSERT_EQ(tree->at(k), v)
+                << "extract(" << i << ", " << j << ") at " << k;
+        }
+        ASSERT_EQ(out[(j - i) / 64] >> ((j - i) % 64),
+                  ~uint64_t(0) >> ((j - i) % 64))
+            << "extract(" << i << ", " << j << ") wrote past the range";
+
+        uint8_t n = gen() % 65;
+        if (i + n > s) n = s - i;
+        uint64_t w = tree->get_bits(i, n);
+        for (uint64_t k = 0; k < 64; k++) {
+            bool expected = k < n ? tree->at(i + k) : false;
+            ASSERT_EQ(expected, (w >> k) & 1)
+                << "get_bits(" << i << ", " << uint32_t(n) << ") bit " << k;
+        }
+    }
+    delete tree;
+}
+
+template <class T>
+void iterator_test(const uint64_t size) {
+    auto tree = new T();
+    std::mt19937_64 gen(size);
+    for (uint64_t i = 0; i < size; i++) {
+        tree->insert(gen() % (tree->size() + 1), gen() % 5 == 0);
+        if (i % 4 == 0) tree->remove(gen() % tree->size());
+    }
+    uint64_t s = tree->size();
+    uint64_t i = 0;
+    for (auto it = tree->begin(); it != tree->end(); ++it, ++i) {
+        ASSERT_EQ(tree->at(i), *it) << "Forward iteration at " << i;
+    }
+    ASSERT_EQ(s, i) << "Forward iteration should visit every bit";
+
+    for (auto it = tree->rbegin(); it != tree->rend(); ++it) {
+        --i;
+        ASSERT_EQ(tree->at(i), *it) << "Reverse iteration at " << i;
+    }
+    ASSERT_EQ(0u, i) << "Reverse iteration should visit every bit";
+
+    uint64_t ones = 0;
+    for (auto it = tree->ones(); it != tree->ones_end(); ++it, ++ones) {
+        ASSERT_EQ(tree->select(ones), *it) << "Position of one " << ones;
+    }
+    ASSERT_EQ(tree->rank(s), ones) << "Every one should be visited";
+
+    for (uint64_t r = 0; r < 100; r++) {
+        uint64_t start = gen() % s;
+        auto it = tree->iterator_at(start);
+        for (i = start; i < s && i < start + 300; i++, ++it) {
+            ASSERT_EQ(tree->at(i), *it) << "Iteration from " << start;
+        }
+        for (; i > start && i + 300 > start; i--) {
+            --it;
+            ASSERT_EQ(tree->at(i - 1), *it) << "Backwards from " << i;
+        }
+        auto o = tree->ones(start);
+        uint64_t rank = tree->rank(start);
+        if (rank == tree->rank(s)) {
+            ASSERT_TRUE(o == tree->ones_end()) << "No ones after " << start;
+        } else {
+            ASSERT_EQ(tree->select(rank), *o) << "First one after " << start;
+        }
+    }
+    delete tree;
+}
+
+template <class T>
+void search_test(const uint64_t size) {
+    auto leaf = new T();
+    std::mt19937_64 gen(size);
+    for (uint64_t i = 0; i < size; i++) {
+        leaf->insert(gen() % (leaf->size() + 1), gen() % 3 == 0);
+        if (i % 3 == 0) leaf->remove(gen() % leaf->size());
+        if (i % 7 != 0) continue;
+        uint64_t ones = 0;
+        uint64_t zeros = 0;
+        for (uint64_t k = 0; k < leaf->size(); k++) {
+            if (leaf->at(k)) {
+                ASSERT_EQ(k, leaf->search(++ones))
+                    << "search(" << ones << ") with "
+                    << uint32_t(leaf->buffer_fill()) << " buffered edits";
+            } else {
+                ASSERT_EQ(k, leaf->search_0(++zeros))
+                    << "search_0(" << zeros << ") with "
+                    << uint32_t(leaf->buffer_fill()) << " buffered edits";
+            }
+        }
+    }
+    delete leaf;
+}
+
+template <class T>
+void select0_test(const uint64_t size) {
+    auto tree = new T();
+    std::mt19937_64 gen(size);
+    tree->push_back(0);
+    for (uint64_t i = 1; i < size; i++) {
+        tree->insert(gen() % (tree->size() + 1), gen() % 3 == 0);
+        if (i % 3 == 0) tree->remove(gen() % tree->size());
+    }
+    uint64_t ones = 0;
+    uint64_t zeros = 0;
+    for (uint64_t k = 0; k < tree->size(); k++) {
+        if (tree->at(k)) {
+            ASSERT_EQ(k, tree->select(ones++)) << "select(" << ones - 1 << ")";
+        } else {
+            ASSERT_EQ(k, tree->select0(zeros++)) << "select0(" << zeros - 1 << ")";
+        }
+    }
+    delete tree;
+}
+
+template <class T>
+void successor_test(const uint64_t size) {
+    auto tree = new T();
+    std::mt19937_64 gen(size);
+    for (uint64_t i = 0; i < size; i++) {
+        // Long runs of equal bits so that searches cross leaves
+        tree->insert(gen() % (tree->size() + 1), (i / 500) % 4 == 0);
+        if (i % 3 == 0) tree->remove(gen() % tree->size());
+    }
+    uint64_t s = tree->size();
+    std::vector<uint64_t> next(s + 1, s), next0(s + 1, s);
+    for (uint64_t k = s; k-- > 0;) {
+        next[k] = tree->at(k) ? k : next[k + 1];
+        next0[k] = tree->at(k) ? next0[k + 1] : k;
+    }
+    uint64_t prev = s, prev0 = s;
+    for (uint64_t k = 0; k < s; k++) {
+        if (tree->at(k)) {
+            prev = k;
+        } else {
+            prev0 = k;
+        }
+        ASSERT_EQ(next[k], tree->next_one(k)) << "next_one(" << k << ")";
+        ASSERT_EQ(next0[k], tree->next_zero(k)) << "next_zero(" << k << ")";
+        ASSERT_EQ(prev, tree->prev_one(k)) << "prev_one(" << k << ")";
+        ASSERT_EQ(prev0, tree->prev_zero(k)) << "prev_zero(" << k << ")";
+    }
+    ASSERT_EQ(s, tree->next_one(s)) << "next_one(size())";
+    ASSERT_EQ(s, tree->next_zero(s)) << "next_zero(size())";
+    delete tree;
+}
+
+template <class T>
+void bitwise_test(const uint64_t size) {
+    std::mt19937_64 gen(size);
+    auto a = new T();
+    auto b = new T();
+    for (uint64_t i = 0; i < size; i++) {
+        a->insert(gen() % (a->size() + 1), gen() % 2);
+        if (i % 3 == 0) b->insert(gen() % (b->size() + 1), gen() % 2);
+        b->push_back(gen() % 4 == 0);
+        if (i % 5 == 0) a->remove(gen() % a->size());
+    }
+    auto expected = [&](uint64_t op, uint64_t k) {
+        bool x = k < a->size() && a->at(k);
+        bool y = k < b->size() && b->at(k);
+        switch (op) {
+            case T::AND:
+                return x && y;
+            case T::OR:
+                return x || y;
+            case T::XOR:
+                return x != y;
+            default:
+                return x && !y;
+        }
+    };
+    uint64_t n = a->size() > b->size() ? a->size() : b->size();
+    for (auto op : {T::AND, T::OR, T::XOR, T::ANDNOT}) {
+        auto c = new T();
+        c->assign(op, *a, *b);
+        ASSERT_EQ(n, c->size()) << "Result of op " << op;
+        uint64_t ones = 0;
+        for (uint64_t k = 0; k < n; k++) {
+            ASSERT_EQ(expected(op, k), c->at(k)) << "Op " << op << " at " << k;
+            ones += c->at(k);
+        }
+        ASSERT_EQ(ones, c->psum()) << "Op " << op;
+        ASSERT_EQ(ones, c->rank(n)) << "Op " << op;
+        for (uint64_t k = 0; k < 1000; k++) {
+            c->insert(gen() % (c->size() + 1), gen() % 2);
+        }
+        ASSERT_EQ(n + 1000, c->size()) << "Inserts after op " << op;
+        delete c;
+    }
+
+    auto copy = new T();
+    copy->assign(T::OR, *a, *a);
+    copy->bitwise_xor(*b);
+    for (uint64_t k = 0; k < n; k++) {
+        ASSERT_EQ(expected(T::XOR, k), copy->at(k)) << "In place xor at " << k;
+    }
+    delete copy;
+    delete a;
+    delete b;
+}
+
+template <class T>
+void append_test(const uint64_t size) {
+    std::mt19937_64 gen(size);
+    auto tree = new T();
+    std::vector<bool> control;
+    std::vector<uint64_t> data(size / 64 + 1);
+    while (control.size() < size) {
+        switch (gen() % 4) {
+            case 0: {
+                uint64_t nbits = gen() % (data.size() * 64 + 1);
+                for (auto& w : data) w = gen();
+                tree->append_words(data.data(), nbits);
+                for (uint64_t k = 0; k < nbits; k++) {
+                    control.push_back((data[k / 64] >> (k % 64)) & 1);
+                }
+                break;
+            }
+            case 1:
+                for (uint64_t k = 0; k < 1000; k++) {
+                    bool x = gen() % 2;
+                    tree->push_back(x);
+                    control.push_back(x);
+                }
+                break;
+            case 2:
+                // Removals near the end so that the last leaf can empty out
+                for (uint64_t k = 0; k < 100 && control.size(); k++) {
+                    uint64_t tail = control.size() < 300 ? control.size() : 300;
+                    uint64_t i = control.size() - 1 - gen() % tail;
+                    tree->remove(i);
+                    control.erase(control.begin() + i);
+                }
+                break;
+            default:
+                for (uint64_t k = 0; k < 100; k++) {
+                    uint64_t i = gen() % (control.size() + 1);
+                    bool x = gen() % 2;
+                    tree->insert(i, x);
+                    control.insert(control.begin() + i, x);
+                }
+                break;
+        }
+        ASSERT_EQ(control.size(), tree->size());
+    }
+    check_bits(*tree, control, "Appended");
+    delete tree;
+}
+
+template <class T>
+void snapshot_test(const uint64_t size) {
+    std::mt19937_64 gen(size);
+    auto tree = new T();
+    std::vector<bool> control;
+    std::vector<T> snapshots;
+    std::vector<std::vector<bool>> expected;
+    for (uint64_t round = 0; round < 8; round++) {
+        snapshots.push_back(tree->snapshot());
+        expected.push_back(control);
+        for (uint64_t k = 0; k < size / 8; k++) {
+            random_update(*tree, control, gen);
+        }
+        // Drop one of the older snapshots while the others stay alive
+        if (round == 4) {
+            snapshots.erase(snapshots.begin() + 2);
+            expected.erase(expected.begin() + 2);
+        }
+    }
+    for (size_t s = 0; s < snapshots.size(); s++) {
+        ASSERT_EQ(expected[s].size(), snapshots[s].size()) << "Snapshot " << s;
+        uint64_t ones = 0;
+        for (uint64_t k = 0; k < expected[s].size(); k++) {
+            ASSERT_EQ(expected[s][k], snapshots[s].at(k))
+                << "Snapshot " << s << " at " << k;
+            ones += expected[s][k];
+        }
+        ASSERT_EQ(ones, snapshots[s].psum()) << "Snapshot " << s;
+    }
+    {
+        // Taken from a const tree. Once the copy replaces its root, the
+        // root of the tree is exclusive again but the path below it is not.
+        const T& view = *tree;
+        T copy = view.snapshot();
+        uint64_t ones = copy.psum();
+        tree->push_back(true);
+        copy.push_back(false);
+        tree->push_back(true);
+        ASSERT_EQ(control.size() + 1, copy.size());
+        ASSERT_EQ(ones, copy.psum());
+        ASSERT_FALSE(copy.at(control.size()));
+        control.push_back(true);
+        control.push_back(true);
+    }
+    check_bits(*tree, control, "Live tree");
+    delete tree;
+    // The snapshots outlive the tree they were taken from
+    for (size_t s = 0; s < snapshots.size(); s++) {
+        ASSERT_EQ(expected[s].size(), snapshots[s].size()) << "Snapshot " << s;
+    }
+}
+
+/*
+ * Removing ranges empties nodes off the removal path, and the root collapses
+ * into nodes that the snapshots share.
+ */
+template <class T>
+void snapshot_remove_test(const uint64_t size) {
+    std::mt19937_64 gen(size);
+    for (uint64_t round = 0; round < 20; round++) {
+        T tree;
+        std::vector<bool> control;
+        random_inserts(tree, control, size, gen);
+        std::vector<T> snapshots;
+        std::vector<std::vector<bool>> expected;
+        while (!control.empty()) {
+            snapshots.push_back(tree.snapshot());
+            expected.push_back(control);
+            uint64_t n = std::min<uint64_t>(control.size(), 1 + gen() % 500);
+            uint64_t i = gen() % (control.size() - n + 1);
+            for (uint64_t k = 0; k < n; k++) tree.remove(i);
+            control.erase(control.begin() + i, control.begin() + i + n);
+        }
+        for (size_t s = 0; s < snapshots.size(); s++) {
+            ASSERT_EQ(expected[s].size(), snapshots[s].size());
+            for (uint64_t k = 0; k < expected[s].size(); k++) {
+                ASSERT_EQ(expected[s][k], snapshots[s].at(k))
+                    << "Round " << round << ", snapshot " << s << " at " << k;
+            }
+        }
+    }
+}
+
+template <class T>
+void wavelet_test(const uint64_t size, uint8_t width) {
+    std::mt19937_64 gen(size);
+    T wm(width);
+    std::vector<uint64_t> control;
+    uint64_t sigma = uint64_t(1) << width;
+    for (uint64_t k = 0; k < size; k++) {
+        uint64_t i = gen() % (control.size() + 1);
+        // Skewed symbol distribution so that some symbols are frequent
+        uint64_t c = (gen() % sigma) & (gen() % sigma);
+        wm.insert(i, c);
+        control.insert(control.begin() + i, c);
+        if (k % 4 == 0) {
+            i = gen() % control.size();
+            wm.remove(i);
+            control.erase(control.begin() + i);
+        }
+    }
+    ASSERT_EQ(control.size(), wm.size());
+    std::vector<uint64_t> counts(sigma, 0);
+    for (uint64_t i = 0; i < control.size(); i++) {
+        uint64_t c = control[i];
+        ASSERT_EQ(c, wm.at(i)) << "at(" << i << ")";
+        ASSERT_EQ(counts[c], wm.rank(i, c)) << "rank(" << i << ", " << c << ")";
+        ASSERT_EQ(i, wm.select(counts[c], c))
+            << "select(" << counts[c] << ", " << c << ")";
+        counts[c]++;
+    }
+    for (uint64_t c = 0; c < sigma; c++) {
+        ASSERT_EQ(counts[c], wm.rank(control.size(), c)) << "Count of " << c;
+    }
+}
+
+template <class T>
+void int_vector_test(const uint64_t size, uint8_t width) {
+    std::mt19937_64 gen(size + width);
+    T v;
+    std::vector<uint64_t> control;
+    uint64_t max = (uint64_t(1) << width) - 1;
+    auto check = [&](uint64_t i) {
+        uint64_t sum = 0;
+        for (uint64_t k = 0; k <= i; k++) sum += control[k];
+        ASSERT_EQ(control[i], v.at(i)) << "at(" << i << ")";
+        ASSERT_EQ(sum, v.psum(i)) << "psum(" << i << ")";
+        ASSERT_EQ(i, v.search_r(sum + i + 1)) << "search_r(" << sum + i + 1
+                                               << ")";
+        ASSERT_TRUE(v.contains_r(sum + i + 1));
+        if (control[i]) {
+            ASSERT_EQ(i, v.search(sum)) << "search(" << sum << ")";
+            ASSERT_TRUE(v.contains(sum));
+        }
+    };
+    for (uint64_t k = 0; k < size; k++) {
+        uint64_t i = gen() % (control.size() + 1);
+        // Mostly small values, so that search hits runs of zeros
+        uint64_t x = gen() % 3 ? gen() % 4 & max : gen() & max;
+        switch (gen() % 8) {
+            case 0:
+                v.push_back(x);
+                control.push_back(x);
+                break;
+            case 1:
+                if (i == control.size()) break;
+                v.set(i, x);
+                control[i] = x;
+                break;
+            case 2:
+                if (i == control.size()) break;
+                x = gen() % (control[i] + 1);
+                v.increment(i, x, true);
+                control[i] -= x;
+                break;
+            case 3:
+            case 4:
+                if (i == control.size()) break;
+                v.remove(i);
+                control.erase(control.begin() + i);
+                break;
+            case 5:
+                if (k % 16 == 0) {
+                    uint8_t n = 64 / width;
+                    uint64_t word = 0;
+                    for (uint8_t j = 0; j < n; j++) {
+                        uint64_t y = gen() & max;
+                        word |= y << (j * width);
+                        control.insert(control.begin() + i + j, y);
+                    }
+                    v.insert_word(i, word, width, n);
+                    break;
+                }
+                // fall through
+            default:
+                v.insert(i, x);
+                control.insert(control.begin() + i, x);
+                break;
+        }
+        ASSERT_EQ(control.size(), v.size());
+        if (!control.empty()) check(gen() % control.size());
+    }
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < control.size(); i++) {
+        ASSERT_EQ(control[i], v.at(i)) << "at(" << i << ")";
+        sum += control[i];
+    }
+    ASSERT_EQ(sum, v.psum());
+    v.commit();
+    for (uint64_t i = 0; i < control.size(); i++) check(i);
+}
+
+template <class T>
+void int_psum_test(const uint64_t size, uint8_t width) {
+    std::mt19937_64 gen(size);
+    T v;
+    std::vector<uint64_t> control;
+    uint64_t max = (uint64_t(1) << width) - 1;
+    for (uint64_t k = 0; k < size; k++) {
+        uint64_t i = gen() % (control.size() + 1);
+        uint64_t x = gen() & max;
+        v.insert(i, x);
+        control.insert(control.begin() + i, x);
+        if (k % 4 == 0) {
+            i = gen() % control.size();
+            v.remove(i);
+            control.erase(control.begin() + i);
+        }
+    }
+    ASSERT_EQ(control.size(), v.size());
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < control.size(); i++) {
+        sum += control[i];
+        ASSERT_EQ(control[i], v.at(i)) << "at(" << i << ")";
+        ASSERT_EQ(sum, v.psum(i)) << "psum(" << i << ")";
+        if (control[i]) {
+            ASSERT_EQ(i, v.search(sum)) << "search(" << sum << ")";
+        }
+    }
+    ASSERT_EQ(sum, v.psum());
+}
+
+template <class T>
+void clone_test(const uint64_t size) {
+    std::mt19937_64 gen(size);
+    T tree;
+    std::vector<bool> control;
+    random_inserts(tree, control, size, gen);
+    T copy = tree.clone();
+    dyn::numa::replicated<T> replicas(tree);
+    uint64_t bytes = 0;
+    copy.for_each_block([&](const void*, uint64_t b, uint64_t pos) {
+        ASSERT_LE(pos, size);
+        bytes += b;
+    });
+    ASSERT_LE(size / 8, bytes);
+    // Updates to the source leave the clone and the replicas alone
+    for (uint64_t k = 0; k < size / 4; k++) tree.remove(gen() % tree.size());
+    ASSERT_EQ(control.size(), copy.size());
+    uint64_t ones = 0;
+    for (uint64_t k = 0; k < control.size(); k++) {
+        ASSERT_EQ(control[k], copy.at(k)) << "Clone at " << k;
+        ASSERT_EQ(ones, replicas.rank(k)) << "Replica rank " << k;
+        ones += control[k];
+    }
+    ASSERT_EQ(ones, copy.psum());
+    for (uint32_t node = 0; node < replicas.size(); node++) {
+        ASSERT_EQ(ones, replicas.on(node).psum()) << "Replica " << node;
+    }
+}
+
+template <class T>
+void finger_test(const uint64_t size) {
+    std::mt19937_64 gen(size);
+    T tree;
+    // bytes, so the inserts in the middle are memmoves
+    std::vector<uint8_t> control;
+    for (uint64_t k = 0; k < size; k++) {
+        bool x = gen() % 2;
+        tree.push_back(x);
+        control.push_back(x);
+    }
+    typename T::finger f(tree, size / 2);
+    typename T::finger other(tree);
+    T snapshot = tree.snapshot();
+    std::vector<uint8_t> expected = control;
+    uint64_t pos = size / 2;
+    for (uint64_t k = 0; k < 4 * size; k++) {
+        // Mostly short steps, sometimes a jump
+        if (gen() % 64 == 0) {
+            pos = gen() % (control.size() + 1);
+        } else {
+            pos += gen() % 9;
+            pos = pos < 4 ? 0 : pos - 4;
+        }
+        if (pos >= control.size()) pos = control.size() - 1;
+        bool x = gen() % 2;
+        switch (gen() % 6) {
+            case 0:
+                f.insert(pos, x);
+                control.insert(control.begin() + pos, x);
+                break;
+            case 1:
+                f.remove(pos);
+                control.erase(control.begin() + pos);
+                break;
+            case 2:
+                f.set(pos, x);
+                control[pos] = x;
+                break;
+            case 3:
+                ASSERT_EQ(control[pos], f.at(pos)) << "At " << pos;
+                break;
+            case 4: {
+                uint64_t ones = 0;
+                uint64_t i = pos;
+                for (uint64_t j = 0; j < pos; j++) ones += control[j];
+                if (gen() % 8 == 0) {
+                    ones = tree.psum();
+                    i = control.size();
+                }
+                ASSERT_EQ(ones, f.rank(i)) << "Rank " << i;
+                break;
+            }
+            default:
+                // Updates elsewhere move the other finger's leaf
+                other.insert(0, x);
+                control.insert(control.begin(), x);
+                if (gen() % 2) {
+                    tree.remove(control.size() - 1);
+                    control.pop_back();
+                }
+                // Fingers copy the leaves they update out of snapshots
+                if (gen() % 256 == 0) {
+                    snapshot = tree.snapshot();
+                    expected = control;
+                }
+                break;
+        }
+        if (control.empty()) {
+            f.insert(0, true);
+            control.push_back(true);
+        }
+        ASSERT_EQ(control.size(), tree.size());
+    }
+    check_bits(tree, control, "Tree");
+    ASSERT_EQ(expected.size(), snapshot.size());
+    for (uint64_t k = 0; k < expected.size(); k++) {
+        ASSERT_EQ(expected[k], snapshot.at(k)) << "Snapshot at " << k;
+    }
+}
+
+template <class T>
+void wal_test(const uint64_t size) {
+    std::mt19937_64 gen(size);
+    char dir[] = "/tmp/wal_testXXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(dir));
+    std::vector<bool> control;
+    std::string log_path;
+    {
+        T tree;
+        dyn::wal<T> log(tree, dir, 64);
+        for (uint64_t k = 0; k < size; k++) {
+            bool x = gen() % 2;
+            log.push_back(x);
+            control.push_back(x);
+        }
+        for (uint64_t k = 0; k < 3 * size; k++) {
+            random_update(log, control, gen);
+            if (k == size) log.checkpoint();
+        }
+        log.sync();
+        ASSERT_EQ(1u, log.generation());
+        check_bits(tree, control, "Logged");
+        log_path = log.log_path(log.generation());
+        // Written by the destructor as the last frame, torn below
+        for (uint64_t k = 0; k < 10; k++) log.push_back(true);
+    }
+    FILE* f = fopen(log_path.c_str(), "r+");
+    ASSERT_NE(nullptr, f);
+    fseek(f, -5, SEEK_END);
+    fputc(0xff, f);
+    fclose(f);
+    for (uint64_t round = 0; round < 3; round++) {
+        T tree;
+        dyn::wal<T> log(tree, dir, 4096, round == 1 ? 1 : 0);
+        check_bits(tree, control, "Recovered");
+        // Updates after recovery append to the truncated log
+        log.push_back(true);
+        control.push_back(true);
+        ASSERT_EQ(round == 0 ? 1u : 2u, log.generation());
+    }
+    std::filesystem::remove_all(dir);
+}
+
+template <class T>
+void replication_test(const uint64_t size) {
+    std::mt19937_64 gen(size);
+    char dir[] = "/tmp/replication_testXXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(dir));
+    std::string path = std::string(dir) + "/stream";
+    T tree;
+    std::vector<bool> control;
+    for (uint64_t k = 0; k < size; k++) {
+        bool x = gen() % 2;
+        tree.push_back(x);
+        control.push_back(x);
+    }
+    dyn::replication_source<T> source(tree, path, 256,
+                                      std::chrono::hours(1));
+    T first;
+    dyn::replica<T> follower(first, path);
+    auto check = [&](T& replica) {
+        check_bits(tree, control, "Source");
+        check_bits(replica, control, "Replica");
+    };
+    check(first);
+    for (uint64_t round = 0; round < 4; round++) {
+        for (uint64_t k = 0; k < size; k++) random_update(source, control, gen);
+        // Only whole frames are shipped
+        uint64_t behind = source.records() - follower.records();
+        if (behind > 0) {
+            ASSERT_GT(follower.lag().count(), 0);
+        }
+        ASSERT_EQ(behind, follower.poll());
+        ASSERT_EQ(0u, follower.poll());
+        ASSERT_EQ(0, follower.lag().count());
+        source.publish();
+        ASSERT_EQ(source.pending(), 0u);
+        follower.poll();
+        ASSERT_EQ(source.records(), follower.records());
+        check(first);
+    }
+    // Late followers replay the whole stream
+    T late;
+    dyn::replica<T> late_follower(late, path);
+    ASSERT_EQ(source.records(), late_follower.poll());
+    check(late);
+    // max_delay is checked on every update, and by tick() without one
+    T timed;
+    dyn::replication_source<T> timed_source(timed, std::string(dir) + "/timed",
+                                            1 << 16,
+                                            std::chrono::milliseconds(1));
+    timed_source.push_back(true);
+    ASSERT_EQ(1u, timed_source.pending());
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    timed_source.push_back(false);
+    ASSERT_EQ(0u, timed_source.pending());
+    ASSERT_EQ(2u, timed_source.records());
+    timed_source.push_back(true);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    timed_source.tick();
+    ASSERT_EQ(0u, timed_source.pending());
+    ASSERT_EQ(3u, timed_source.records());
+    std::filesystem::remove_all(dir);
+}
+
+template <class T>
+void checkpoint_test(const uint64_t size) {
+    std::mt19937_64 gen(size);
+    char dir[] = "/tmp/checkpoint_testXXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(dir));
+    T tree;
+    for (uint64_t k = 0; k < size; k++) {
+        tree.insert(gen() % (tree.size() + 1), gen() % 2);
+    }
+    auto check = [&](uint32_t deltas) {
+        T loaded;
+        dyn::incremental_checkpoint<T> cp(loaded, dir);
+        ASSERT_EQ(deltas, cp.deltas());
+        ASSERT_EQ(tree.size(), loaded.size());
+        ASSERT_EQ(tree.psum(), loaded.psum());
+        for (uint64_t k = 0; k < tree.size(); k++) {
+            ASSERT_EQ(tree.at(k), loaded.at(k)) << "Loaded at " << k;
+        }
+        std::as_const(loaded).for_each_leaf(
+            [](const typename T::shared_leaf& l) { ASSERT_FALSE(l.dirty()); });
+    };
+    dyn::incremental_checkpoint<T> cp(tree, dir);
+    uint64_t full = cp.checkpoint();
+    check(0);
+    // A few sets only write the leaves they touch
+    for (uint64_t k = 0; k < 3; k++) tree.set(gen() % tree.size(), gen() % 2);
+    ASSERT_LT(cp.checkpoint(), full / 2);
+    std::as_const(tree).for_each_leaf(
+        [](const typename T::shared_leaf& l) { ASSERT_FALSE(l.dirty()); });
+    check(1);
+    // Splits and removed leaves
+    for (uint64_t k = 0; k < size; k++) {
+        if (gen() % 2) {
+            tree.insert(gen() % (tree.size() + 1), gen() % 2);
+        } else {
+            tree.remove(gen() % tree.size());
+        }
+    }
+    cp.checkpoint();
+    check(2);
+    cp.compact();
+    check(0);
+    for (uint64_t k = 0; k < size / 10; k++) tree.push_back(gen() % 2);
+    cp.checkpoint();
+    check(1);
+    // Rolling back to a snapshot brings back clean leaves whose entries are
+    // in an older table
+    T snap = tree.snapshot();
+    // The leaves of the snapshot keep their state, the tree gets copies
+    std::vector<std::pair<uint32_t, uint64_t>> state;
+    auto get_state = [&](const typename T::shared_leaf& l) {
+        state.emplace_back(l.slot, l.generation);
+    };
+    std::as_const(snap).for_each_leaf(get_state);
+    auto before = state;
+    cp.checkpoint();
+    check(2);
+    state.clear();
+    std::as_const(snap).for_each_leaf(get_state);
+    ASSERT_EQ(before, state);
+    for (uint64_t k = 0; k < size; k++) {
+        if (gen() % 2) {
+            tree.insert(gen() % (tree.size() + 1), gen() % 2);
+        } else {
+            tree.remove(gen() % tree.size());
+        }
+    }
+    cp.checkpoint();
+    check(3);
+    tree = snap;
+    cp.checkpoint();
+    check(4);
+    std::filesystem::remove_all(dir);
+}
+
+template <class T, class L>
+void paged_test(const uint64_t size) {
+    L::configure("", 4);
+    {
+        std::mt19937_64 gen(size);
+        T tree;
+        std::vector<bool> control;
+        for (uint64_t k = 0; k < 2 * size; k++) {
+            random_update(tree, control, gen);
+        }
+        // Copies write their leaves to slots of their own
+        T copy = tree;
+        std::vector<bool> copied = control;
+        for (uint64_t k = 0; k < size / 4; k++) {
+            uint64_t i = gen() % control.size();
+            tree.set(i, !control[i]);
+            control[i] = !control[i];
+        }
+        dyn::prefetch(tree, 0, tree.size());
+        auto stats = L::statistics();
+        ASSERT_LT(0u, stats.faults);
+        ASSERT_LT(0u, stats.writebacks);
+        ASSERT_GE(4u, stats.resident);
+        ASSERT_EQ(control.size(), tree.size());
+        uint64_t ones = 0;
+        for (uint64_t k = 0; k < control.size(); k++) {
+            ASSERT_EQ(control[k], tree.at(k)) << "Paged at " << k;
+            ASSERT_EQ(ones, tree.rank(k)) << "Paged rank " << k;
+            if (control[k]) {
+                ASSERT_EQ(k, tree.select(ones));
+            }
+            ASSERT_EQ(copied[k], copy.at(k)) << "Copy at " << k;
+            ones += control[k];
+        }
+        ASSERT_EQ(ones, tree.psum());
+    }
+    ASSERT_EQ(0u, L::statistics().resident);
+    L::configure("", 1024);
+}
+
+template <class T>
+void tiered_test(const uint64_t size) {
+    std::mt19937_64 gen(size);
+    T tree;
+    std::vector<bool> control;
+    // Regions of all zeros, all ones, sparse, dense and random bits
+    const uint64_t densities[] = {0, 1000, 10, 990, 500};
+    for (uint64_t k = 0; k < size; k++) {
+        bool x = gen() % 1000 < densities[k / 3000 % 5];
+        tree.push_back(x);
+        control.push_back(x);
+    }
+    auto check = [&] {
+        ASSERT_EQ(control.size(), tree.size());
+        uint64_t ones = 0;
+        uint64_t next_one = control.size();
+        std::vector<uint64_t> next(control.size());
+        for (uint64_t k = control.size(); k-- > 0;) {
+            if (control[k]) next_one = k;
+            next[k] = next_one;
+        }
+        uint64_t prev_zero = control.size();
+        for (uint64_t k = 0; k < control.size(); k++) {
+            if (!control[k]) prev_zero = k;
+            ASSERT_EQ(control[k], tree.at(k)) << "Tiered at " << k;
+            ASSERT_EQ(ones, tree.rank(k)) << "Tiered rank " << k;
+            if (control[k]) {
+                ASSERT_EQ(k, tree.select(ones));
+            } else {
+                ASSERT_EQ(k, tree.select0(k - ones));
+            }
+            ASSERT_EQ(next[k], tree.next_one(k)) << "Tiered next one " << k;
+            ASSERT_EQ(prev_zero, tree.prev_zero(k)) << "Tiered prev zero " << k;
+            ones += control[k];
+        }
+        ASSERT_EQ(ones, tree.psum());
+        uint64_t i = gen() % control.size();
+        uint64_t j = std::min<uint64_t>(control.size(), i + gen() % 5000);
+        std::vector<uint64_t> out((j - i + 63) / 64 + 1, 0);
+        tree.extract(i, j, out.data());
+        for (uint64_t k = i; k < j; k++) {
+            ASSERT_EQ(control[k], bool(out[(k - i) / 64] >> ((k - i) % 64) & 1))
+                << "Tiered extract " << k;
+        }
+    };
+    T snap = tree.snapshot();
+    // Everything was just written, the next round finds it cold
+    ASSERT_EQ(0u, dyn::compress_cold(tree));
+    uint64_t hot_bits = tree.bit_size();
+    ASSERT_LT(0u, dyn::compress_cold(tree));
+    ASSERT_GT(hot_bits, tree.bit_size());
+    check();
+    // The snapshot shared every leaf and stays hot
+    std::as_const(snap).for_each_leaf(
+        [](const typename T::shared_leaf& l) { ASSERT_FALSE(l.is_cold()); });
+    ASSERT_EQ(control.size(), snap.size());
+    for (uint64_t k = 0; k < control.size(); k++) {
+        ASSERT_EQ(control[k], snap.at(k)) << "Tiered snapshot at " << k;
+    }
+    for (uint64_t k = 0; k < size / 10; k++) {
+        uint64_t i = gen() % control.size();
+        bool x = gen() % 2;
+        if (k % 3 == 0) {
+            tree.insert(i, x);
+            control.insert(control.begin() + i, x);
+        } else if (k % 3 == 1) {
+            tree.remove(i);
+            control.erase(control.begin() + i);
+        } else {
+            tree.set(i, x);
+            control[i] = x;
+        }
+    }
+    check();
+    dyn::compress_cold(tree, 0);
+    dyn::compress_cold(tree, 0);
+    check();
+}
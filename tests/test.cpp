@@ -1,4 +1,15 @@
 #include "../bufferedbv.hpp"
+#include "../bufferediv.hpp"
+#include "../bufferedtree.hpp"
+#include "../checkpoint.hpp"
+#include "../numa.hpp"
+#include "../paged.hpp"
+#include "../replication.hpp"
+#include "../tiered.hpp"
+#include "../trace.hpp"
+#include "../wal.hpp"
+#include "../wavelet_matrix.hpp"
+#include "commit_reference.hpp"
 #include "dynamic.hpp"
 #include "gtest.h"
 #include "helpers.hpp"
@@ -9,6 +20,22 @@ using namespace dyn;
 
 typedef succinct_bitvector<spsi<buffered_packed_vector<8>, 8192, 16>> bbv;
 typedef buffered_packed_vector<8> pv;
+typedef buffered_packed_vector<8, 16383> cpv;
+typedef succinct_bitvector<spsi<cpv, 4096, 16>> cbbv;
+typedef buffered_tree<buffered_packed_vector<8, 8192>, 8192, 16> bt;
+typedef buffered_tree<buffered_packed_vector<8>, 256, 4> sbt;
+typedef paged_leaf<buffered_packed_vector<8>, 256> pl;
+typedef buffered_tree<pl, 256, 4> pbt;
+typedef buffered_tree<tiered_leaf<buffered_packed_vector<8>>, 8192, 16> tbt;
+typedef wavelet_matrix<suc_bv> uwm;
+typedef buffered_wavelet_matrix<8> bwm;
+typedef wavelet_matrix<bt> twm;
+typedef buffered_int_vector<2, 8> iv2;
+typedef buffered_int_vector<3, 8> iv3;
+typedef buffered_int_vector<8, 16, 16383> civ8;
+typedef buffered_int_vector<13, 4> iv13;
+typedef buffered_int_vector<32, 8> iv32;
+typedef buffered_spsi<8, 8> bps;
 
 TEST(PV, push_back) { pv_pushback_test<pv>(); }
 
@@ -16,6 +43,14 @@ TEST(PV, insert) { pv_insert_test<pv>(); }
 
 TEST(PV, remove) { pv_remove_test<pv>(); }
 
+TEST(PV, split) { pv_split_test<pv>(); }
+
+TEST(PV, commit) { pv_commit_test<pv>(); }
+
+TEST(PV, commit64) { pv_commit_test<buffered_packed_vector<64>>(); }
+
+TEST(PV, copy) { pv_copy_test<pv>(); }
+
 TEST(PV, Insertion10) { insert_test<pv>(10); }
 
 TEST(PV, Insertion100) { insert_test<pv>(100); }
@@ -64,6 +99,44 @@ TEST(PV, Select1000) { select_test<pv>(1000); }
 
 TEST(PV, Select10000) { select_test<pv>(10000); }
 
+TEST(PV, Range100) { range_test<pv>(100); }
+
+TEST(PV, Range3000) { range_test<pv>(3000); }
+
+TEST(PV, Search3000) { search_test<pv>(3000); }
+
+TEST(PV, Successor3000) { successor_test<pv>(3000); }
+
+TEST(CPV, Search3000) { search_test<cpv>(3000); }
+
+TEST(CPV, Successor3000) { successor_test<cpv>(3000); }
+
+TEST(CPV, push_back) { pv_pushback_test<cpv>(); }
+
+TEST(CPV, insert) { pv_insert_test<cpv>(); }
+
+TEST(CPV, remove) { pv_remove_test<cpv>(); }
+
+TEST(CPV, split) { pv_split_test<cpv>(); }
+
+TEST(CPV, commit) { pv_commit_test<cpv>(); }
+
+TEST(CPV, max_size) {
+    pv_max_size_test<buffered_packed_vector<8, 100>>(100);
+}
+
+TEST(CPV, Insertion1000) { insert_test<cpv>(1000); }
+
+TEST(CPV, Mixture1000) { mixture_test<cpv>(1000); }
+
+TEST(CPV, Rank1000) { rank_test<cpv>(1000); }
+
+TEST(CPV, Remove1000) { remove_test<cpv>(1000); }
+
+TEST(CPV, Update1000) { update_test<cpv>(1000); }
+
+TEST(CPV, Select1000) { select_test<cpv>(1000); }
+
 TEST(BBV, Random1) {
     std::vector<uint32_t> ops{3, 1, 0, 0, 1, 1, 2, 0, 0, 1,
                               0, 2, 0, 1, 3, 0, 0, 0, 1};
@@ -166,4 +239,154 @@ TEST(BBV, Select10000) { select_test<bbv>(10000); }
 
 TEST(BBV, Select100000) { select_test<bbv>(100000); }
 
-TEST(BBV, Select1000000) { select_test<bbv>(1000000); }
\ No newline at end of file
+TEST(BBV, Select1000000) { select_test<bbv>(1000000); }
+
+TEST(BBV, Select0100000) { select0_test<bbv>(100000); }
+
+TEST(Trace, RoundTrip1000) { trace_test<bbv>(1000); }
+
+TEST(Trace, RoundTrip100000) { trace_test<bbv>(100000); }
+
+TEST(CBBV, Insertion100000) { insert_test<cbbv>(100000); }
+
+TEST(CBBV, Mixture10000) { mixture_test<cbbv>(10000); }
+
+TEST(CBBV, Rank100000) { rank_test<cbbv>(100000); }
+
+TEST(CBBV, Remove100000) { remove_test<cbbv>(100000); }
+
+TEST(CBBV, Update100000) { update_test<cbbv>(100000); }
+
+TEST(CBBV, Select100000) { select_test<cbbv>(100000); }
+
+TEST(CBBV, Select0100000) { select0_test<cbbv>(100000); }
+
+TEST(BT, Random3) {
+    std::vector<uint32_t> ops{47, 3, 1,     5, 15391, 4, 19, 3, 0, 5, 10556, 4,
+                              47, 5, 27092, 5, 24392, 4, 3,  0, 3, 1};
+    run_test<bt>(ops);
+}
+
+TEST(BT, Random4) {
+    std::vector<uint32_t> ops{98, 5,  21266, 1, 64, 2, 9, 1,  3, 1, 5, 26631,
+                              0,  87, 1,     2, 94, 0, 1, 63, 3, 1, 5, 4707};
+    run_test<bt>(ops);
+}
+
+TEST(BT, Insertion100000) { insert_test<bt>(100000); }
+
+TEST(BT, Mixture10000) { mixture_test<bt>(10000); }
+
+TEST(BT, Rank100000) { rank_test<bt>(100000); }
+
+TEST(BT, Remove100000) { remove_test<bt>(100000); }
+
+TEST(BT, Update100000) { update_test<bt>(100000); }
+
+TEST(BT, Select100000) { select_test<bt>(100000); }
+
+TEST(BT, Select0100000) { select0_test<bt>(100000); }
+
+TEST(BT, Range100000) { range_test<bt>(100000); }
+
+TEST(BT, Iterator100000) { iterator_test<bt>(100000); }
+
+TEST(BT, Successor100000) { successor_test<bt>(100000); }
+
+TEST(BT, Bitwise100000) { bitwise_test<bt>(100000); }
+
+TEST(BT, Append100000) { append_test<bt>(100000); }
+
+TEST(BT, Snapshot100000) { snapshot_test<bt>(100000); }
+
+TEST(BT, Clone100000) { clone_test<bt>(100000); }
+
+TEST(BT, Finger50000) { finger_test<bt>(50000); }
+
+TEST(BT, Wal100000) { wal_test<bt>(100000); }
+
+TEST(BT, Replication100000) { replication_test<bt>(100000); }
+
+TEST(BT, Checkpoint100000) { checkpoint_test<bt>(100000); }
+
+TEST(SBT, Iterator10000) { iterator_test<sbt>(10000); }
+
+TEST(SBT, Successor10000) { successor_test<sbt>(10000); }
+
+TEST(SBT, Bitwise10000) { bitwise_test<sbt>(10000); }
+
+TEST(SBT, Append10000) { append_test<sbt>(10000); }
+
+TEST(SBT, Snapshot10000) { snapshot_test<sbt>(10000); }
+
+TEST(SBT, SnapshotRemove10000) { snapshot_remove_test<sbt>(10000); }
+
+TEST(SBT, Clone10000) { clone_test<sbt>(10000); }
+
+TEST(SBT, Finger10000) { finger_test<sbt>(10000); }
+
+TEST(SBT, Wal10000) { wal_test<sbt>(10000); }
+
+TEST(SBT, Replication10000) { replication_test<sbt>(10000); }
+
+TEST(SBT, Checkpoint10000) { checkpoint_test<sbt>(10000); }
+
+TEST(PBT, Paged10000) { paged_test<pbt, pl>(10000); }
+
+TEST(PBT, Checkpoint10000) { checkpoint_test<pbt>(10000); }
+
+TEST(PBT, max_bits) {
+    // Leaves split into halves of 8192 bits, which do not fit the slots of pl
+    typedef buffered_tree<pl, 16384, 4> wide;
+    pl::configure("", 1);
+    EXPECT_DEATH(
+        {
+            wide tree;
+            for (uint64_t k = 0; k < 32768; k++) tree.push_back(k % 2);
+        },
+        "max_bits");
+}
+
+TEST(TBT, Tiered100000) { tiered_test<tbt>(100000); }
+
+TEST(TBT, Checkpoint100000) { checkpoint_test<tbt>(100000); }
+
+TEST(SBT, Insertion10000) { insert_test<sbt>(10000); }
+
+TEST(SBT, Mixture10000) { mixture_test<sbt>(10000); }
+
+TEST(SBT, Rank10000) { rank_test<sbt>(10000); }
+
+TEST(SBT, Remove10000) { remove_test<sbt>(10000); }
+
+TEST(SBT, Update10000) { update_test<sbt>(10000); }
+
+TEST(SBT, Select10000) { select_test<sbt>(10000); }
+
+TEST(SBT, Select010000) { select0_test<sbt>(10000); }
+
+TEST(SBT, Range10000) { range_test<sbt>(10000); }
+
+TEST(WM, Plain10000) { wavelet_test<uwm>(10000, 8); }
+
+TEST(WM, Buffered100000) { wavelet_test<bwm>(100000, 8); }
+
+TEST(WM, BufferedWidth3) { wavelet_test<bwm>(10000, 3); }
+
+TEST(WM, Tree100000) { wavelet_test<twm>(100000, 8); }
+
+TEST(IV, Width2) { int_vector_test<iv2>(3000, 2); }
+
+TEST(IV, Width3) { int_vector_test<iv3>(3000, 3); }
+
+TEST(IV, Width8) { int_vector_test<civ8>(3000, 8); }
+
+TEST(IV, Width13) { int_vector_test<iv13>(3000, 13); }
+
+TEST(IV, Width32) { int_vector_test<iv32>(3000, 32); }
+
+TEST(IV, max_size) {
+    iv_max_size_test<buffered_int_vector<8, 16, 100>>(100);
+}
+
+TEST(BPS, Psum100000) { int_psum_test<bps>(100000, 8); }
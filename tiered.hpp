@@ -0,0 +1,550 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace dyn {
+/*
+ * Read only bit vector of less than 2^16 bits, compressed in blocks of 512
+ * bits. Depending on its number of ones k, a block is stored as nothing
+ * (all zeros or all ones), the positions of its ones or zeros if there are
+ * fewer than 32 of them, or the plain 32 16-bit units. One allocation holds
+ * the number of ones before every block, the offsets of the blocks and the
+ * block contents, so a query decodes a single block.
+ */
+class compressed_bits {
+   public:
+    static constexpr uint64_t BLOCK = 512;
+    static constexpr uint64_t MAX_SIZE = 65535;
+
+    compressed_bits() = default;
+
+    /*
+     * compresses the first size bits of words, which has to be zero past
+     * them
+     */
+    compressed_bits(const uint64_t* words, uint64_t size) : size_(size) {
+        assert(size <= MAX_SIZE);
+        uint64_t nb = blocks();
+        std::vector<uint16_t> payload;
+        data_.assign(2 * (nb + 1), 0);
+        for (uint64_t b = 0; b < nb; b++) {
+            uint64_t len = block_size(b);
+            const uint64_t* w = words + b * BLOCK / 64;
+            uint64_t nr_words = (len + 63) / 64;
+            uint64_t k = 0;
+            for (uint64_t j = 0; j < nr_words; j++) {
+                k += __builtin_popcountll(w[j]);
+            }
+            data_[b + 1] = data_[b] + k;
+            data_[nb + 1 + b] = payload.size();
+            switch (type(k, len)) {
+                case ONES_LIST:
+                case ZEROS_LIST:
+                    for (uint64_t j = 0; j < nr_words; j++) {
+                        uint64_t v = w[j];
+                        if (type(k, len) == ZEROS_LIST) v = ~v & mask(len, j);
+                        for (; v; v &= v - 1) {
+                            payload.push_back(j * 64 + __builtin_ctzll(v));
+                        }
+                    }
+                    break;
+                case PLAIN:
+                    for (uint64_t j = 0; j < nr_words; j++) {
+                        uint16_t units[4];
+                        memcpy(units, &w[j], sizeof(units));
+                        payload.insert(payload.end(), units, units + 4);
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+        data_[2 * nb + 1] = payload.size();
+        data_.insert(data_.end(), payload.begin(), payload.end());
+        data_.shrink_to_fit();
+    }
+
+    uint64_t size() const { return size_; }
+
+    uint64_t psum() const { return data_.empty() ? 0 : data_[blocks()]; }
+
+    bool at(uint64_t i) const {
+        assert(i < size_);
+        uint64_t w[BLOCK / 64];
+        decode(i / BLOCK, w);
+        return (w[i % BLOCK / 64] >> (i % 64)) & 1;
+    }
+
+    /*
+     * number of ones in [0, i)
+     */
+    uint64_t rank(uint64_t i) const {
+        assert(i <= size_);
+        uint64_t b = i / BLOCK;
+        if (b == blocks()) return psum();
+        uint64_t res = ones_before(b);
+        uint64_t o = i % BLOCK;
+        if (o == 0) return res;
+        uint64_t w[BLOCK / 64];
+        decode(b, w);
+        for (uint64_t j = 0; j < o / 64; j++) {
+            res += __builtin_popcountll(w[j]);
+        }
+        if (o % 64) {
+            uint64_t m = (uint64_t(1) << o % 64) - 1;
+            res += __builtin_popcountll(w[o / 64] & m);
+        }
+        return res;
+    }
+
+    /*
+     * position of the x-th one, 1-based
+     */
+    uint64_t search(uint64_t x) const { return select_bit<true>(x); }
+
+    /*
+     * position of the x-th zero, 1-based
+     */
+    uint64_t search_0(uint64_t x) const { return select_bit<false>(x); }
+
+    /*
+     * n <= 64 bits starting from i
+     */
+    uint64_t get_bits(uint64_t i, uint8_t n) const {
+        assert(n <= 64 && i + n <= size_);
+        uint64_t res = 0;
+        extract(i, i + n, &res);
+        return res;
+    }
+
+    /*
+     * copies bits [i, j) to out, starting from bit offset of out
+     */
+    void extract(uint64_t i, uint64_t j, uint64_t* out,
+                 uint64_t offset = 0) const {
+        assert(i <= j && j <= size_);
+        uint64_t w[BLOCK / 64 + 1];
+        for (uint64_t p = i; p < j;) {
+            uint64_t b = p / BLOCK;
+            decode(b, w);
+            w[BLOCK / 64] = 0;
+            uint64_t end = std::min(j, (b + 1) * BLOCK);
+            for (; p < end;) {
+                uint64_t o = p % BLOCK;
+                uint64_t n = std::min<uint64_t>(64, end - p);
+                uint64_t v = w[o / 64] >> (o % 64);
+                if (o % 64) v |= w[o / 64 + 1] << (64 - o % 64);
+                if (n < 64) v &= (uint64_t(1) << n) - 1;
+                write_bits(out, offset + p - i, v, n);
+                p += n;
+            }
+        }
+    }
+
+    uint64_t count_ones(uint64_t i, uint64_t j) const {
+        return rank(j) - rank(i);
+    }
+
+    /*
+     * position of the first one / zero at or after i, size() if none
+     */
+    template <bool bit>
+    uint64_t next_bit(uint64_t i) const {
+        assert(i <= size_);
+        uint64_t w[BLOCK / 64];
+        for (uint64_t b = i / BLOCK; b < blocks(); b++) {
+            if (!has(b, bit)) continue;
+            decode(b, w);
+            uint64_t start = b * BLOCK;
+            for (uint64_t j = 0; j * 64 < block_size(b); j++) {
+                uint64_t v = bit ? w[j] : ~w[j] & mask(block_size(b), j);
+                if (start + j * 64 + 63 < i) continue;
+                if (start + j * 64 < i) {
+                    v &= ~uint64_t(0) << (i - start - j * 64);
+                }
+                if (v) return start + j * 64 + __builtin_ctzll(v);
+            }
+        }
+        return size_;
+    }
+
+    /*
+     * position of the last one / zero at or before i, size() if none
+     */
+    template <bool bit>
+    uint64_t prev_bit(uint64_t i) const {
+        assert(i < size_);
+        uint64_t w[BLOCK / 64];
+        for (uint64_t b = i / BLOCK + 1; b-- > 0;) {
+            if (!has(b, bit)) continue;
+            decode(b, w);
+            uint64_t start = b * BLOCK;
+            for (uint64_t j = (block_size(b) + 63) / 64; j-- > 0;) {
+                uint64_t v = bit ? w[j] : ~w[j] & mask(block_size(b), j);
+                uint64_t first = start + j * 64;
+                if (first > i) continue;
+                if (i - first < 63) v &= ~uint64_t(0) >> (63 - (i - first));
+                if (v) return first + 63 - __builtin_clzll(v);
+            }
+        }
+        return size_;
+    }
+
+    /*
+     * all bits as words, for expanding into a plain leaf
+     */
+    std::vector<uint64_t> words() const {
+        std::vector<uint64_t> res((size_ + 63) / 64);
+        uint64_t w[BLOCK / 64];
+        for (uint64_t b = 0; b < blocks(); b++) {
+            decode(b, w);
+            uint64_t n = (block_size(b) + 63) / 64;
+            std::copy(w, w + n, res.begin() + b * BLOCK / 64);
+        }
+        return res;
+    }
+
+    uint64_t bit_size() const {
+        return sizeof(compressed_bits) * 8 + data_.capacity() * 16;
+    }
+
+    const void* data() const { return data_.data(); }
+
+    uint64_t bytes() const { return data_.capacity() * sizeof(uint16_t); }
+
+   private:
+    enum block_type { ZEROS, ONES, ONES_LIST, ZEROS_LIST, PLAIN };
+
+    // Fewer ones or zeros than this are stored as a list of positions
+    static constexpr uint64_t LIST_LIMIT = 32;
+
+    static block_type type(uint64_t k, uint64_t len) {
+        if (k == 0) return ZEROS;
+        if (k == len) return ONES;
+        if (k < LIST_LIMIT) return ONES_LIST;
+        if (len - k < LIST_LIMIT) return ZEROS_LIST;
+        return PLAIN;
+    }
+
+    /*
+     * valid bits of word j of a block of len bits
+     */
+    static uint64_t mask(uint64_t len, uint64_t j) {
+        uint64_t n = len - j * 64;
+        return n >= 64 ? ~uint64_t(0) : (uint64_t(1) << n) - 1;
+    }
+
+    static void write_bits(uint64_t* out, uint64_t pos, uint64_t v,
+                           uint64_t n) {
+        uint64_t w = pos / 64;
+        uint64_t o = pos % 64;
+        uint64_t m = n < 64 ? (uint64_t(1) << n) - 1 : ~uint64_t(0);
+        out[w] = (out[w] & ~(m << o)) | (v << o);
+        if (o + n > 64) {
+            out[w + 1] = (out[w + 1] & ~(m >> (64 - o))) | (v >> (64 - o));
+        }
+    }
+
+    uint64_t blocks() const { return (size_ + BLOCK - 1) / BLOCK; }
+
+    uint64_t block_size(uint64_t b) const {
+        return std::min<uint64_t>(BLOCK, size_ - b * BLOCK);
+    }
+
+    uint64_t ones_before(uint64_t b) const { return data_[b]; }
+
+    /*
+     * whether block b has an element equal to bit
+     */
+    bool has(uint64_t b, bool bit) const {
+        uint64_t k = ones_before(b + 1) - ones_before(b);
+        return bit ? k > 0 : k < block_size(b);
+    }
+
+    template <bool bit>
+    uint64_t select_bit(uint64_t x) const {
+        uint64_t nb = blocks();
+        assert(x > 0);
+        // Last block with fewer than x elements before it
+        uint64_t lo = 0;
+        uint64_t hi = nb;
+        while (hi - lo > 1) {
+            uint64_t mid = (lo + hi) / 2;
+            uint64_t before =
+                bit ? ones_before(mid) : mid * BLOCK - ones_before(mid);
+            if (before < x) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        x -= bit ? ones_before(lo) : lo * BLOCK - ones_before(lo);
+        uint64_t w[BLOCK / 64];
+        decode(lo, w);
+        for (uint64_t j = 0;; j++) {
+            uint64_t v = bit ? w[j] : ~w[j] & mask(block_size(lo), j);
+            uint64_t c = __builtin_popcountll(v);
+            if (c >= x) {
+                for (; x > 1; x--) v &= v - 1;
+                return lo * BLOCK + j * 64 + __builtin_ctzll(v);
+            }
+            x -= c;
+        }
+    }
+
+    /*
+     * writes the bits of block b to w, zeros past the end
+     */
+    void decode(uint64_t b, uint64_t* w) const {
+        uint64_t nb = blocks();
+        uint64_t len = block_size(b);
+        uint64_t k = ones_before(b + 1) - ones_before(b);
+        const uint16_t* p = data_.data() + 2 * (nb + 1) + data_[nb + 1 + b];
+        uint64_t units = data_[nb + 2 + b] - data_[nb + 1 + b];
+        std::fill(w, w + BLOCK / 64, 0);
+        switch (type(k, len)) {
+            case ZEROS:
+                break;
+            case ONES:
+                for (uint64_t j = 0; j * 64 < len; j++) w[j] = mask(len, j);
+                break;
+            case ONES_LIST:
+                for (uint64_t u = 0; u < units; u++) {
+                    w[p[u] / 64] |= uint64_t(1) << (p[u] % 64);
+                }
+                break;
+            case ZEROS_LIST:
+                for (uint64_t j = 0; j * 64 < len; j++) w[j] = mask(len, j);
+                for (uint64_t u = 0; u < units; u++) {
+                    w[p[u] / 64] &= ~(uint64_t(1) << (p[u] % 64));
+                }
+                break;
+            default:
+                memcpy(w, p, units * sizeof(uint16_t));
+                break;
+        }
+    }
+
+    uint32_t size_ = 0;
+    // ones before each block, block offsets, block contents
+    std::vector<uint16_t> data_;
+};
+
+/*
+ * Leaf for a buffered_tree that is either hot, a plain leaf_type, or cold, a
+ * compressed_bits. Queries are answered by either form. The first write to
+ * a cold leaf expands it back into a leaf_type.
+ *
+ * Each leaf counts its reads and notes writes. compress_cold() ends a round
+ * of this tracking and compresses the leaves that were not written and
+ * read at most max_reads times since the previous round. Leaves that are
+ * shared with snapshots are copied first, the snapshots keep their form.
+ */
+template <class leaf_type>
+class tiered_leaf {
+   public:
+    tiered_leaf() : hot_(new leaf_type()) {}
+
+    tiered_leaf(std::vector<uint64_t>&& words, uint64_t size)
+        : hot_(new leaf_type(std::move(words), size)) {}
+
+    tiered_leaf(std::vector<uint64_t>&& words, uint64_t size, uint64_t ones)
+        : hot_(new leaf_type(std::move(words), size, ones)) {}
+
+    /*
+     * takes ownership of a hot leaf
+     */
+    explicit tiered_leaf(leaf_type* hot) : hot_(hot) {}
+
+    tiered_leaf(const tiered_leaf& other)
+        : hot_(other.hot_ ? new leaf_type(*other.hot_) : nullptr),
+          cold_(other.cold_),
+          reads_(other.reads_.load(std::memory_order_relaxed)),
+          written_(other.written_),
+          cold_dirty_(other.cold_dirty_) {}
+
+    tiered_leaf& operator=(const tiered_leaf&) = delete;
+
+    ~tiered_leaf() { delete hot_; }
+
+    uint64_t size() const { return hot_ ? hot_->size() : cold_.size(); }
+
+    uint64_t psum() const { return hot_ ? hot_->psum() : cold_.psum(); }
+
+    bool at(uint64_t i) const {
+        read();
+        return hot_ ? hot_->at(i) : cold_.at(i);
+    }
+
+    uint64_t rank(uint64_t i) const {
+        read();
+        return hot_ ? hot_->rank(i) : cold_.rank(i);
+    }
+
+    uint64_t search(uint64_t x) const {
+        read();
+        return hot_ ? hot_->search(x) : cold_.search(x);
+    }
+
+    uint64_t search_0(uint64_t x) const {
+        read();
+        return hot_ ? hot_->search_0(x) : cold_.search_0(x);
+    }
+
+    uint64_t get_bits(uint64_t i, uint8_t n) const {
+        read();
+        return hot_ ? hot_->get_bits(i, n) : cold_.get_bits(i, n);
+    }
+
+    void extract(uint64_t i, uint64_t j, uint64_t* out,
+                 uint64_t offset = 0) const {
+        read();
+        if (hot_) {
+            hot_->extract(i, j, out, offset);
+        } else {
+            cold_.extract(i, j, out, offset);
+        }
+    }
+
+    uint64_t count_ones(uint64_t i, uint64_t j) const {
+        read();
+        return hot_ ? hot_->count_ones(i, j) : cold_.count_ones(i, j);
+    }
+
+    uint64_t next_one(uint64_t i) const {
+        read();
+        return hot_ ? hot_->next_one(i) : cold_.template next_bit<true>(i);
+    }
+
+    uint64_t next_zero(uint64_t i) const {
+        read();
+        return hot_ ? hot_->next_zero(i) : cold_.template next_bit<false>(i);
+    }
+
+    uint64_t prev_one(uint64_t i) const {
+        read();
+        return hot_ ? hot_->prev_one(i) : cold_.template prev_bit<true>(i);
+    }
+
+    uint64_t prev_zero(uint64_t i) const {
+        read();
+        return hot_ ? hot_->prev_zero(i) : cold_.template prev_bit<false>(i);
+    }
+
+    void insert(uint64_t i, uint64_t x) { write().insert(i, x); }
+
+    void remove(uint64_t i) { write().remove(i); }
+
+    void set(uint64_t i, bool x) { write().set(i, x); }
+
+    void push_back(uint64_t x) { write().push_back(x); }
+
+    void append_bits(const uint64_t* in, uint64_t in_pos, uint64_t n) {
+        write().append_bits(in, in_pos, n);
+    }
+
+    template <class R = tiered_leaf>
+    R* split() {
+        return new R(write().template split<leaf_type>());
+    }
+
+    /*
+     * checkpoint state, see buffered_packed_vector::dirty()
+     */
+    bool dirty() const { return hot_ ? hot_->dirty() : cold_dirty_; }
+
+    void mark_clean() {
+        if (hot_) {
+            hot_->mark_clean();
+        } else {
+            cold_dirty_ = false;
+        }
+    }
+
+    bool is_cold() const { return hot_ == nullptr; }
+
+    /*
+     * Ends a round of access tracking. A hot leaf that was not written and
+     * read at most max_reads times since the last round is compressed.
+     * Returns true if the leaf was compressed.
+     */
+    bool cool(uint64_t max_reads) {
+        uint64_t reads = reads_.load(std::memory_order_relaxed);
+        bool written = written_;
+        reads_.store(0, std::memory_order_relaxed);
+        written_ = false;
+        if (!hot_ || written || reads > max_reads) return false;
+        if (hot_->size() > compressed_bits::MAX_SIZE) return false;
+        std::vector<uint64_t> words((hot_->size() + 63) / 64, 0);
+        if (hot_->size()) hot_->extract(0, hot_->size(), words.data());
+        cold_ = compressed_bits(words.data(), hot_->size());
+        cold_dirty_ = hot_->dirty();
+        delete hot_;
+        hot_ = nullptr;
+        return true;
+    }
+
+    uint64_t bit_size() const {
+        return sizeof(tiered_leaf) * 8 +
+               (hot_ ? hot_->bit_size() : cold_.bit_size() - sizeof(cold_) * 8);
+    }
+
+    template <class F>
+    void for_each_block(F f) const {
+        f(static_cast<const void*>(this), sizeof(tiered_leaf));
+        if (hot_) {
+            hot_->for_each_block(f);
+        } else if (cold_.bytes()) {
+            f(cold_.data(), cold_.bytes());
+        }
+    }
+
+   private:
+    void read() const {
+        reads_.store(reads_.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_relaxed);
+    }
+
+    /*
+     * the hot leaf, expanded first if cold
+     */
+    leaf_type& write() {
+        written_ = true;
+        if (!hot_) {
+            uint64_t ones = cold_.psum();
+            uint64_t size = cold_.size();
+            std::vector<uint64_t> words = cold_.words();
+            hot_ = size ? new leaf_type(std::move(words), size, ones)
+                        : new leaf_type();
+            cold_ = compressed_bits();
+        }
+        return *hot_;
+    }
+
+    leaf_type* hot_;
+    compressed_bits cold_;
+    // reads since the last round, not synchronized beyond atomicity
+    mutable std::atomic<uint64_t> reads_{0};
+    bool written_ = true;
+    bool cold_dirty_ = false;
+};
+
+/*
+ * Ends a round of access tracking on all leaves of a tree of tiered_leaf
+ * and compresses the cold ones. Leaves shared with snapshots are copied
+ * first. Returns the number of leaves compressed.
+ */
+template <class T>
+uint64_t compress_cold(T& tree, uint64_t max_reads = ~uint64_t(0)) {
+    uint64_t res = 0;
+    tree.for_each_leaf([&](typename T::shared_leaf& l) {
+        res += l.cool(max_reads);
+    });
+    return res;
+}
+}  // namespace dyn
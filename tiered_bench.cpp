@@ -0,0 +1,107 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include "bufferedbv.hpp"
+#include "bufferedtree.hpp"
+#include "tiered.hpp"
+
+/*
+ * Memory and query cost of compressing cold leaves, see tiered.hpp.
+ *
+ * A tree of n bits with one in density_per_mille ones on average is built
+ * hot, in runs of 1 to 4096 equal bits for a clustered bitmap with -c. Rank
+ * throughput and memory are measured hot and after compress_cold(), then
+ * random sets go to a small fraction of the leaves, which expands them.
+ *
+ * Usage: tiered_bench [-c] [n] [density_per_mille]
+ */
+
+typedef dyn::buffered_tree<dyn::tiered_leaf<dyn::buffered_packed_vector<8>>,
+                           8192, 16>
+    tree;
+
+int main(int argc, char** argv) {
+    bool clustered = false;
+    int arg = 1;
+    if (arg < argc && std::string(argv[arg]) == "-c") {
+        clustered = true;
+        arg++;
+    }
+    uint64_t n = 500000000;
+    uint64_t density = 10;
+    if (arg < argc) std::istringstream(argv[arg++]) >> n;
+    if (arg < argc) std::istringstream(argv[arg++]) >> density;
+    if (n == 0 || density > 1000) {
+        std::cerr << "Usage: " << argv[0] << " [-c] [n] [density_per_mille]"
+                  << std::endl;
+        return 1;
+    }
+
+    std::mt19937_64 gen(42);
+    tree t;
+    std::vector<uint64_t> chunk(1 << 16);
+    bool run_bit = false;
+    uint64_t run = 0;
+    for (uint64_t done = 0; done < n; done += chunk.size() * 64) {
+        for (auto& w : chunk) {
+            w = 0;
+            for (uint64_t b = 0; b < 64; b++) {
+                if (clustered) {
+                    if (run == 0) {
+                        run = 1 + gen() % 4096;
+                        run_bit = gen() % 1000 < density;
+                    }
+                    run--;
+                    w |= uint64_t(run_bit) << b;
+                } else {
+                    w |= uint64_t(gen() % 1000 < density) << b;
+                }
+            }
+        }
+        uint64_t bits = std::min<uint64_t>(chunk.size() * 64, n - done);
+        t.append_words(chunk.data(), bits);
+    }
+
+    const uint64_t queries = 1000000;
+    std::vector<uint64_t> positions(queries);
+    for (auto& p : positions) p = gen() % n;
+    std::cout << "phase\tbits/bit\tMops/s" << std::endl;
+    auto bench = [&](const char* name, uint64_t ops, auto f) {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t checksum = f();
+        std::chrono::duration<double> s =
+            std::chrono::steady_clock::now() - start;
+        std::cout << name << "\t" << std::fixed << std::setprecision(3)
+                  << double(t.bit_size()) / n << "\t" << ops / s.count() / 1e6
+                  << std::endl;
+        std::cerr << name << " checksum: " << checksum << std::endl;
+    };
+    auto ranks = [&] {
+        uint64_t sum = 0;
+        for (uint64_t p : positions) sum += t.rank(p);
+        return sum;
+    };
+
+    bench("rank-hot", queries, ranks);
+    dyn::compress_cold(t);
+    auto start = std::chrono::steady_clock::now();
+    uint64_t leaves = dyn::compress_cold(t);
+    std::chrono::duration<double> s = std::chrono::steady_clock::now() - start;
+    std::cerr << leaves << " leaves compressed in " << s.count() << " s"
+              << std::endl;
+    bench("rank-cold", queries, ranks);
+    // Writes to 1% of the leaves
+    uint64_t region = n / 100;
+    bench("set-expand", queries / 10, [&] {
+        for (uint64_t k = 0; k < queries / 10; k++) {
+            t.set(gen() % region, k % 2);
+        }
+        return t.psum();
+    });
+    bench("rank-mixed", queries, ranks);
+    return 0;
+}
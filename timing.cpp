@@ -51,6 +51,7 @@ void opt_main() {
     std::chrono::duration<double> elapsed = end - start;
     std::cout << "B-ins\t";
     std::cout << std::setw(5) << (elapsed.count() /  m) << std::endl;
+    BV_STAT(dyn::bv_stats::print(std::cerr));
 
     uint64_t num_ones = 0;
     for (uint64_t i = 0; i < m; i++) {
@@ -95,6 +96,21 @@ void opt_main() {
     std::cout << "B-select\t";
     std::cout << std::setw(5) << (elapsed.count() / m) << "\t" << num_ones << std::endl;
 
+    num_ones = 0;
+    limit = N - 1 - tree->rank(N - 1);
+
+    for (uint64_t i = 0; i < m; i++) {
+        pos[i] = gen() % limit;
+    }
+    start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < m; i++) {
+        num_ones += tree->select0(pos[i]);
+    }
+    end = std::chrono::steady_clock::now();
+    elapsed = end - start;
+    std::cout << "B-select0\t";
+    std::cout << std::setw(5) << (elapsed.count() / m) << "\t" << num_ones << std::endl;
+
     delete tree;
 
     auto ctree = new sbv();
@@ -159,6 +175,21 @@ void opt_main() {
     std::cout << "C-select\t";
     std::cout << std::setw(5) << (elapsed.count() / m) << "\t" << num_ones << std::endl;
 
+    num_ones = 0;
+    limit = N - 1 - ctree->rank(N - 1);
+
+    for (uint64_t i = 0; i < m; i++) {
+        pos[i] = gen() % limit;
+    }
+    start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < m; i++) {
+        num_ones += ctree->select0(pos[i]);
+    }
+    end = std::chrono::steady_clock::now();
+    elapsed = end - start;
+    std::cout << "C-select0\t";
+    std::cout << std::setw(5) << (elapsed.count() / m) << "\t" << num_ones << std::endl;
+
     delete ctree;
 }
 
@@ -206,6 +237,7 @@ int main(int argc, char **argv) {
     std::cout << std::setw(5) << (tot / out) << "\t";
     std::cout << std::setw(5) << min << "\t";
     std::cout << std::setw(5) << max << std::endl;
+    BV_STAT(dyn::bv_stats::print(std::cerr));
 
     tot = 0;
     min = 1;
@@ -276,6 +308,31 @@ int main(int argc, char **argv) {
     std::cout << std::setw(5) << max << "\t";
     std::cout << num_ones << std::endl;
 
+    tot = 0;
+    min = 1;
+    max = 0;
+
+    num_ones = 0;
+
+    limit = N - 1 - tree->rank(N - 1);
+
+    for (uint64_t i = 0; i < at; i++) {
+        uint64_t pos = gen() % limit;
+        auto start = std::chrono::steady_clock::now();
+        num_ones += tree->select0(pos);
+        auto end = std::chrono::steady_clock::now();
+        std::chrono::duration<double> elapsed = end - start;
+        double time = elapsed.count();
+        tot += time;
+        min = min < time ? min : time;
+        max = max > time ? max : time;
+    }
+    std::cout << "B-select0\t";
+    std::cout << std::setw(5) << (tot / out) << "\t";
+    std::cout << std::setw(5) << min << "\t";
+    std::cout << std::setw(5) << max << "\t";
+    std::cout << num_ones << std::endl;
+
     delete tree;
 
     auto ctree = new sbv();
@@ -376,5 +433,30 @@ int main(int argc, char **argv) {
     std::cout << std::setw(5) << max << "\t";
     std::cout << num_ones << std::endl;
 
+    tot = 0;
+    min = 1;
+    max = 0;
+
+    num_ones = 0;
+
+    limit = N - 1 - ctree->rank(N - 1);
+
+    for (uint64_t i = 0; i < at; i++) {
+        uint64_t pos = gen() % limit;
+        auto start = std::chrono::steady_clock::now();
+        num_ones += ctree->select0(pos);
+        auto end = std::chrono::steady_clock::now();
+        std::chrono::duration<double> elapsed = end - start;
+        double time = elapsed.count();
+        tot += time;
+        min = min < time ? min : time;
+        max = max > time ? max : time;
+    }
+    std::cout << "U-select0\t";
+    std::cout << std::setw(5) << (tot / out) << "\t";
+    std::cout << std::setw(5) << min << "\t";
+    std::cout << std::setw(5) << max << "\t";
+    std::cout << num_ones << std::endl;
+
     delete ctree;
 }
@@ -0,0 +1,238 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "log_io.hpp"
+
+namespace dyn {
+/*
+ * Binary workload traces.
+ *
+ * A trace is an 8 byte magic followed by the initial size of the bit vector
+ * as a little endian uint64_t, the initial bits as (initial_size + 63) / 64
+ * words, and a sequence of the records in log_io.hpp.
+ *
+ * The replayed tree is loaded with the initial bits, so a trace recorded
+ * from a live tree replays against the contents it was recorded on.
+ */
+
+/*
+ * Bits [i, j) of tree into out, which has to be zeroed. Trees without
+ * extract() are read a bit at a time.
+ */
+template <class T>
+auto copy_bits(T& tree, uint64_t i, uint64_t j, uint64_t* out, int)
+    -> decltype(tree.extract(i, j, out), void()) {
+    tree.extract(i, j, out);
+}
+
+template <class T>
+void copy_bits(T& tree, uint64_t i, uint64_t j, uint64_t* out, long) {
+    for (uint64_t k = i; k < j; k++) {
+        out[(k - i) / 64] |= uint64_t(tree.at(k)) << ((k - i) % 64);
+    }
+}
+
+template <class T>
+void copy_bits(T& tree, uint64_t i, uint64_t j, uint64_t* out) {
+    copy_bits(tree, i, j, out, 0);
+}
+
+/*
+ * Buffered writer for trace files. The header holds the bits of tree.
+ */
+class trace_writer {
+   public:
+    template <class T>
+    trace_writer(const char* path, T& tree) {
+        file_ = fopen(path, "wb");
+        if (file_ == nullptr) {
+            std::cerr << "Unable to open trace file " << path << std::endl;
+            exit(1);
+        }
+        uint64_t initial_size = tree.size();
+        fwrite(trace::MAGIC, 1, sizeof(trace::MAGIC), file_);
+        fwrite(&initial_size, sizeof(initial_size), 1, file_);
+        std::vector<uint64_t> chunk(1 << 14);
+        for (uint64_t i = 0; i < initial_size; i += chunk.size() * 64) {
+            uint64_t j =
+                std::min<uint64_t>(initial_size, i + chunk.size() * 64);
+            std::fill(chunk.begin(), chunk.end(), 0);
+            copy_bits(tree, i, j, chunk.data());
+            fwrite(chunk.data(), 8, (j - i + 63) / 64, file_);
+        }
+    }
+
+    ~trace_writer() {
+        flush();
+        fclose(file_);
+    }
+
+    void write(uint8_t op, uint64_t pos = 0, bool value = false) {
+        if (count_ + trace::MAX_RECORD > sizeof(buf_)) flush();
+        count_ += trace::encode(buf_ + count_, op, pos, value);
+    }
+
+    void flush() {
+        fwrite(buf_, 1, count_, file_);
+        fflush(file_);
+        count_ = 0;
+    }
+
+   private:
+    FILE* file_;
+    uint8_t buf_[1 << 16];
+    size_t count_ = 0;
+};
+
+/*
+ * Forwards operations to the wrapped tree and records every call in a trace.
+ * Return values are not recorded, only the arguments.
+ */
+template <class T>
+class trace_recorder {
+   public:
+    trace_recorder(T& tree, const char* path)
+        : tree_(tree), writer_(path, tree) {}
+
+    bool at(uint64_t i) {
+        writer_.write(trace::AT, i);
+        return tree_.at(i);
+    }
+
+    uint64_t rank(uint64_t i) {
+        writer_.write(trace::RANK, i);
+        return tree_.rank(i);
+    }
+
+    uint64_t select(uint64_t i) {
+        writer_.write(trace::SELECT, i);
+        return tree_.select(i);
+    }
+
+    uint64_t select0(uint64_t i) {
+        writer_.write(trace::SELECT0, i);
+        return tree_.select0(i);
+    }
+
+    void insert(uint64_t i, bool x) {
+        writer_.write(trace::INSERT, i, x);
+        tree_.insert(i, x);
+    }
+
+    void remove(uint64_t i) {
+        writer_.write(trace::REMOVE, i);
+        tree_.remove(i);
+    }
+
+    void set(uint64_t i, bool x) {
+        writer_.write(trace::SET, i, x);
+        tree_.set(i, x);
+    }
+
+    void push_back(bool x) {
+        writer_.write(trace::PUSH_BACK, 0, x);
+        tree_.push_back(x);
+    }
+
+    uint64_t size() const { return tree_.size(); }
+
+    void flush() { writer_.flush(); }
+
+    T& tree() { return tree_; }
+
+   private:
+    T& tree_;
+    trace_writer writer_;
+};
+
+/*
+ * Read only memory mapping of a trace file. A last record cut short, by a
+ * recorder that did not flush, is dropped.
+ */
+class trace_reader {
+   public:
+    explicit trace_reader(const char* path) {
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 ||
+            size_t(st.st_size) < sizeof(trace::MAGIC) + sizeof(uint64_t)) {
+            std::cerr << "Unable to open trace file " << path << std::endl;
+            exit(1);
+        }
+        length_ = st.st_size;
+        void* m = mmap(nullptr, length_, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (m == MAP_FAILED) {
+            std::cerr << "Unable to map trace file " << path << std::endl;
+            exit(1);
+        }
+        madvise(m, length_, MADV_SEQUENTIAL);
+        data_ = static_cast<const uint8_t*>(m);
+        if (memcmp(data_, trace::MAGIC, sizeof(trace::MAGIC)) != 0) {
+            std::cerr << path << " is not a trace file" << std::endl;
+            exit(1);
+        }
+        memcpy(&initial_size_, data_ + sizeof(trace::MAGIC),
+               sizeof(initial_size_));
+        uint64_t header = sizeof(trace::MAGIC) + sizeof(uint64_t);
+        if ((length_ - header) / 8 < (initial_size_ + 63) / 64) {
+            std::cerr << path << " is truncated" << std::endl;
+            exit(1);
+        }
+        begin_ = data_ + header + (initial_size_ + 63) / 64 * 8;
+        end_ = begin_;
+        while (uint8_t n = trace::record_length(end_, data_ + length_)) {
+            end_ += n;
+        }
+        if (end_ != data_ + length_) {
+            std::cerr << "Dropped a truncated record at the end of " << path
+                      << std::endl;
+        }
+    }
+
+    ~trace_reader() { munmap(const_cast<uint8_t*>(data_), length_); }
+
+    uint64_t initial_size() const { return initial_size_; }
+
+    /*
+     * the initial_size() bits the trace starts from
+     */
+    const uint64_t* initial_bits() const {
+        return reinterpret_cast<const uint64_t*>(data_ + sizeof(trace::MAGIC) +
+                                                 sizeof(uint64_t));
+    }
+
+    /*
+     * loads the initial bits into tree, which has to be empty
+     */
+    template <class T>
+    void load(T& tree) const {
+        assert(tree.size() == 0);
+        load_bits(tree, initial_bits(), initial_size_);
+    }
+
+    const uint8_t* begin() const { return begin_; }
+
+    const uint8_t* end() const { return end_; }
+
+   private:
+    const uint8_t* data_;
+    size_t length_;
+    uint64_t initial_size_ = 0;
+    const uint8_t* begin_;
+    const uint8_t* end_;
+};
+}  // namespace dyn
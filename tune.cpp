@@ -0,0 +1,389 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bufferedbv.hpp"
+#include "bufferedtree.hpp"
+#include "dynamic.hpp"
+#include "spsi.hpp"
+#include "succinct_bitvector.hpp"
+
+#include "trace.hpp"
+
+/*
+ * Workload-driven tuner for buffer size, leaf size and fanout.
+ *
+ * The workload is either a trace file (see trace.hpp) or an op mix such as
+ * insert=30,remove=10,at=40,rank=20, which is expanded to a random trace in
+ * memory. Every configuration of the grid below is instantiated at compile
+ * time, replayed repetitions times to get the mean throughput and a 95%
+ * confidence interval, and once more with every op timed for the latency
+ * percentiles. Configurations are ranked by throughput, or by p99 latency
+ * with -l, and the typedef of the winner is printed.
+ *
+ * All configurations need to return the same query results, a mismatch is
+ * reported as an error.
+ */
+
+template <uint8_t k, uint32_t B_LEAF, uint32_t B>
+using spsi_bv = dyn::succinct_bitvector<
+    dyn::spsi<dyn::buffered_packed_vector<k>, B_LEAF, B>>;
+
+template <uint8_t k, uint32_t B_LEAF, uint32_t B>
+using tree_bv = dyn::buffered_tree<dyn::buffered_packed_vector<k>, B_LEAF, B>;
+
+struct workload {
+    uint64_t initial_size = 0;
+    // the initial_size bits the workload starts from
+    const uint64_t *bits = nullptr;
+    const uint8_t *begin = nullptr;
+    const uint8_t *end = nullptr;
+    uint64_t ops = 0;
+};
+
+struct result {
+    uint32_t buffer, leaf, fanout;
+    double mean;  // Mops/s
+    double ci;    // half width of the 95% confidence interval
+    double p50, p99, p999;  // ns
+    double p99_lo, p99_hi;  // 95% confidence interval of p99
+    uint64_t checksum;
+};
+
+// Indexed by op code
+static const char *OP_NAMES[] = {"insert", "remove", "set", "push_back",
+                                 "rank",   "select", "at",  "select0"};
+
+/*
+ * two-sided 95% critical values of Student's t for 1 to 30 degrees of freedom
+ */
+double t_critical(uint64_t df) {
+    static const double t[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447,
+                               2.365,  2.306, 2.262, 2.228, 2.201, 2.179,
+                               2.160,  2.145, 2.131, 2.120, 2.110, 2.101,
+                               2.093,  2.086, 2.080, 2.074, 2.069, 2.064,
+                               2.060,  2.056, 2.052, 2.048, 2.045, 2.042};
+    if (df == 0) return 0;
+    return df <= 30 ? t[df - 1] : 1.96;
+}
+
+template <class T>
+T *initial_tree(const workload &w) {
+    auto tree = new T();
+    dyn::load_bits(*tree, w.bits, w.initial_size);
+    return tree;
+}
+
+template <class T>
+double replay(const workload &w, uint64_t &checksum) {
+    auto tree = initial_tree<T>(w);
+    uint64_t val = 0;
+    checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const uint8_t *rec = w.begin; rec < w.end;) {
+        rec += dyn::execute_trace_op<T>(*tree, rec, val);
+        checksum += val;
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    delete tree;
+    return elapsed.count();
+}
+
+template <class T>
+std::vector<uint32_t> latencies(const workload &w) {
+    auto tree = initial_tree<T>(w);
+    std::vector<uint32_t> res;
+    res.reserve(w.ops);
+    uint64_t val = 0;
+    for (const uint8_t *rec = w.begin; rec < w.end;) {
+        auto start = std::chrono::steady_clock::now();
+        rec += dyn::execute_trace_op<T>(*tree, rec, val);
+        std::chrono::duration<double, std::nano> elapsed =
+            std::chrono::steady_clock::now() - start;
+        res.push_back(elapsed.count());
+    }
+    delete tree;
+    return res;
+}
+
+double percentile(std::vector<uint32_t> &v, double p) {
+    if (v.empty()) return 0;
+    auto it = v.begin() + uint64_t(p * (v.size() - 1));
+    std::nth_element(v.begin(), it, v.end());
+    return *it;
+}
+
+/*
+ * 95% confidence interval of the p quantile of v, between the order
+ * statistics 1.96 binomial standard deviations away from rank p * n
+ */
+void percentile_interval(std::vector<uint32_t> &v, double p, double &lo,
+                         double &hi) {
+    double d = v.empty() ? 0 : 1.96 * std::sqrt(p * (1 - p) / v.size());
+    lo = percentile(v, std::max(0.0, p - d));
+    hi = percentile(v, std::min(1.0, p + d));
+}
+
+template <class T>
+result measure(const workload &w, uint32_t buffer, uint32_t leaf,
+               uint32_t fanout, uint32_t repetitions) {
+    result r = {buffer, leaf, fanout, 0, 0, 0, 0, 0, 0, 0, 0};
+    std::vector<double> mops(repetitions);
+    for (auto &m : mops) m = w.ops / replay<T>(w, r.checksum) / 1e6;
+    for (auto m : mops) r.mean += m / repetitions;
+    double var = 0;
+    for (auto m : mops) var += (m - r.mean) * (m - r.mean);
+    if (repetitions > 1) {
+        r.ci = t_critical(repetitions - 1) *
+               std::sqrt(var / (repetitions - 1) / repetitions);
+    }
+    auto lat = latencies<T>(w);
+    r.p50 = percentile(lat, 0.5);
+    r.p99 = percentile(lat, 0.99);
+    r.p999 = percentile(lat, 0.999);
+    percentile_interval(lat, 0.99, r.p99_lo, r.p99_hi);
+    std::cerr << "k=" << buffer << " leaf=" << leaf << " fanout=" << fanout
+              << " checksum: " << r.checksum << std::endl;
+    return r;
+}
+
+template <template <uint8_t, uint32_t, uint32_t> class F, uint32_t B_LEAF,
+          uint32_t B, uint8_t... ks>
+void tune_buffers(const workload &w, uint32_t repetitions,
+                  std::vector<result> &results) {
+    (results.push_back(measure<F<ks, B_LEAF, B>>(w, ks, B_LEAF, B,
+                                                 repetitions)),
+     ...);
+}
+
+template <template <uint8_t, uint32_t, uint32_t> class F, uint32_t B_LEAF,
+          uint32_t B>
+void tune_leaf(const workload &w, uint32_t repetitions,
+               std::vector<result> &results) {
+    tune_buffers<F, B_LEAF, B, 4, 8, 16, 32>(w, repetitions, results);
+}
+
+/*
+ * buffer size {4, 8, 16, 32} x leaf bits {4096, 8192, 16384} x fanout
+ * {8, 16, 32}
+ */
+template <template <uint8_t, uint32_t, uint32_t> class F>
+void tune_grid(const workload &w, uint32_t repetitions,
+               std::vector<result> &results) {
+    tune_leaf<F, 4096, 8>(w, repetitions, results);
+    tune_leaf<F, 4096, 16>(w, repetitions, results);
+    tune_leaf<F, 4096, 32>(w, repetitions, results);
+    tune_leaf<F, 8192, 8>(w, repetitions, results);
+    tune_leaf<F, 8192, 16>(w, repetitions, results);
+    tune_leaf<F, 8192, 32>(w, repetitions, results);
+    tune_leaf<F, 16384, 8>(w, repetitions, results);
+    tune_leaf<F, 16384, 16>(w, repetitions, results);
+    tune_leaf<F, 16384, 32>(w, repetitions, results);
+}
+
+/*
+ * parses a mix like insert=30,at=70 into weights indexed by op code
+ */
+bool parse_mix(const std::string &mix, std::vector<uint64_t> &weights) {
+    weights.assign(8, 0);
+    std::istringstream in(mix);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        auto eq = item.find('=');
+        if (eq == std::string::npos) return false;
+        std::string name = item.substr(0, eq);
+        uint8_t op = 0;
+        while (op < 8 && name != OP_NAMES[op]) op++;
+        if (op == 8) return false;
+        std::istringstream(item.substr(eq + 1)) >> weights[op];
+    }
+    uint64_t total = 0;
+    for (auto v : weights) total += v;
+    return total > 0;
+}
+
+/*
+ * random trace with the op mix, positions are uniform over the valid range,
+ * starting from initial_size alternating bits
+ */
+void generate(const std::vector<uint64_t> &weights, uint64_t initial_size,
+              uint64_t num_ops, std::vector<uint64_t> &bits,
+              std::vector<uint8_t> &out) {
+    std::mt19937_64 gen(42);
+    std::discrete_distribution<uint32_t> pick(weights.begin(), weights.end());
+    bits.assign((initial_size + 63) / 64, 0xaaaaaaaaaaaaaaaaull);
+    if (initial_size % 64) {
+        bits.back() &= (uint64_t(1) << initial_size % 64) - 1;
+    }
+    tree_bv<8, 8192, 16> tree;
+    tree.append_words(bits.data(), initial_size);
+    for (uint64_t i = 0; i < num_ops; i++) {
+        uint64_t s = tree.size();
+        uint8_t op = pick(gen);
+        bool x = gen() % 2;
+        // Ops that need elements turn into push_backs on an empty vector
+        if (s == 0 && op != dyn::trace::INSERT) op = dyn::trace::PUSH_BACK;
+        uint64_t pos = s ? gen() % s : 0;
+        switch (op) {
+            case dyn::trace::INSERT:
+                pos = gen() % (s + 1);
+                tree.insert(pos, x);
+                break;
+            case dyn::trace::REMOVE:
+                tree.remove(pos);
+                break;
+            case dyn::trace::SET:
+                tree.set(pos, x);
+                break;
+            case dyn::trace::PUSH_BACK:
+                tree.push_back(x);
+                break;
+            case dyn::trace::SELECT: {
+                uint64_t ones = tree.rank(s);
+                if (ones == 0) continue;
+                pos = gen() % ones;
+                break;
+            }
+            case dyn::trace::SELECT0: {
+                uint64_t zeros = s - tree.rank(s);
+                if (zeros == 0) continue;
+                pos = gen() % zeros;
+                break;
+            }
+            default:
+                break;
+        }
+        dyn::trace::append(out, op, pos, x);
+    }
+}
+
+void print_typedef(const result &r, bool tree) {
+    if (tree) {
+        std::cout << "typedef dyn::buffered_tree<dyn::buffered_packed_vector<"
+                  << r.buffer << ">, " << r.leaf << ", " << r.fanout
+                  << ">\n    bbv;" << std::endl;
+    } else {
+        std::cout << "typedef dyn::succinct_bitvector<\n"
+                  << "    dyn::spsi<dyn::buffered_packed_vector<" << r.buffer
+                  << ">, " << r.leaf << ", " << r.fanout << ">>\n    bbv;"
+                  << std::endl;
+    }
+}
+
+int usage(const char *name) {
+    std::cerr << "Usage: " << name << " [-r repetitions] [-t] [-l] <trace file>\n"
+              << "       " << name
+              << " [-r repetitions] [-t] [-l] -m <mix> [initial size] "
+                 "[number of ops]\n"
+              << "  -t  tune buffered_tree instead of succinct_bitvector<spsi>\n"
+              << "  -l  rank by p99 latency instead of throughput\n"
+              << "  mix is op=weight,... with ops insert, remove, set, "
+                 "push_back, rank, select, at, select0"
+              << std::endl;
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    uint32_t repetitions = 5;
+    bool tree = false;
+    bool latency = false;
+    std::string mix;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "-r" && i + 1 < argc) {
+            std::istringstream(argv[++i]) >> repetitions;
+        } else if (a == "-t") {
+            tree = true;
+        } else if (a == "-l") {
+            latency = true;
+        } else if (a == "-m" && i + 1 < argc) {
+            mix = argv[++i];
+        } else {
+            args.push_back(a);
+        }
+    }
+    if (repetitions == 0) return usage(argv[0]);
+
+    workload w;
+    std::vector<uint8_t> generated;
+    std::vector<uint64_t> generated_bits;
+    dyn::trace_reader *trace = nullptr;
+    if (!mix.empty()) {
+        std::vector<uint64_t> weights;
+        uint64_t num_ops = 1000000;
+        if (!parse_mix(mix, weights) || args.size() > 2) return usage(argv[0]);
+        if (args.size() > 0) std::istringstream(args[0]) >> w.initial_size;
+        if (args.size() > 1) std::istringstream(args[1]) >> num_ops;
+        generate(weights, w.initial_size, num_ops, generated_bits, generated);
+        w.bits = generated_bits.data();
+        w.begin = generated.data();
+        w.end = generated.data() + generated.size();
+    } else {
+        if (args.size() != 1) return usage(argv[0]);
+        trace = new dyn::trace_reader(args[0].c_str());
+        w.initial_size = trace->initial_size();
+        w.bits = trace->initial_bits();
+        w.begin = trace->begin();
+        w.end = trace->end();
+    }
+    for (const uint8_t *rec = w.begin; rec < w.end; w.ops++) {
+        uint64_t pos;
+        rec += 1 + (dyn::trace::has_position(*rec)
+                        ? dyn::trace::read_varint(rec + 1, pos)
+                        : 0);
+    }
+    if (w.ops == 0) {
+        std::cerr << "Empty workload" << std::endl;
+        return 1;
+    }
+
+    std::vector<result> results;
+    if (tree) {
+        tune_grid<tree_bv>(w, repetitions, results);
+    } else {
+        tune_grid<spsi_bv>(w, repetitions, results);
+    }
+    delete trace;
+
+    for (const auto &r : results) {
+        if (r.checksum != results[0].checksum) {
+            std::cerr << "Query results differ between configurations"
+                      << std::endl;
+            return 1;
+        }
+    }
+    std::sort(results.begin(), results.end(),
+              [&](const result &a, const result &b) {
+                  return latency ? a.p99 < b.p99 : a.mean > b.mean;
+              });
+
+    // A * marks configurations whose interval of the ranking metric, the
+    // throughput or with -l the p99 latency, overlaps that of the best
+    const result &best = results[0];
+    std::cout << "rank\tk\tleaf\tfanout\tMops/s\t+-95%\tp50_ns\tp99_ns\t"
+                 "p999_ns\ttie"
+              << std::endl;
+    for (size_t i = 0; i < results.size(); i++) {
+        const result &r = results[i];
+        bool tie = latency ? r.p99_lo <= best.p99_hi && r.p99_hi >= best.p99_lo
+                           : r.mean + r.ci >= best.mean - best.ci &&
+                                 r.mean - r.ci <= best.mean + best.ci;
+        std::cout << i + 1 << "\t" << r.buffer << "\t" << r.leaf << "\t"
+                  << r.fanout << "\t" << std::fixed << std::setprecision(3)
+                  << r.mean << "\t" << r.ci << "\t" << std::setprecision(0)
+                  << r.p50 << "\t" << r.p99 << "\t" << r.p999 << "\t"
+                  << (tie ? "*" : "") << std::endl;
+    }
+    std::cout << std::endl;
+    print_typedef(best, tree);
+    return 0;
+}
@@ -0,0 +1,305 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "log_io.hpp"
+
+namespace dyn {
+/*
+ * Write-ahead log of the updates of a tree, with checkpoints.
+ *
+ * A log directory holds at most one checkpoint, a copy of all bits that is
+ * replaced atomically with a rename, and the log files wal.<generation> with
+ * the updates made since. Updates are encoded as trace records (see
+ * trace.hpp) and written in frames of a length, a checksum and the records
+ * of one group commit, so a frame torn by a crash is detected and dropped
+ * on recovery.
+ *
+ * Updates are applied to the tree right away and become durable when sync()
+ * returns, which happens automatically every group_size updates, so there is
+ * one fdatasync per group. Opening a directory recovers the tree: the
+ * checkpoint is loaded with append_words and the log tail is replayed, with
+ * runs of push_backs batched into append_words as well. checkpoint() writes
+ * the current bits and starts a new, empty log generation.
+ *
+ * T needs the buffered_tree interface, in particular extract and
+ * append_words. I/O errors are fatal.
+ */
+template <class T>
+class wal {
+   public:
+    /*
+     * Opens or creates the log in dir and recovers tree, which has to be
+     * empty, from it. With a checkpoint_interval, a checkpoint is written
+     * every checkpoint_interval updates.
+     */
+    wal(T& tree, const std::string& dir, uint64_t group_size = 4096,
+        uint64_t checkpoint_interval = 0)
+        : tree_(tree),
+          dir_(dir),
+          group_size_(group_size),
+          checkpoint_interval_(checkpoint_interval) {
+        assert(tree.size() == 0);
+        if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+            log_file::fail(dir);
+        }
+        load_checkpoint();
+        // A crash right after the last checkpoint can leave its old log
+        if (generation_ > 0) unlink(log_path(generation_ - 1).c_str());
+        uint64_t valid = 0;
+        while (replay(log_path(generation_), valid)) {
+            if (access(log_path(generation_ + 1).c_str(), F_OK) != 0) break;
+            generation_++;
+        }
+        open_log(valid);
+        buffer_.resize(FRAME_HEADER);
+    }
+
+    wal(const wal&) = delete;
+
+    wal& operator=(const wal&) = delete;
+
+    ~wal() {
+        sync();
+        close(fd_);
+    }
+
+    void insert(uint64_t i, bool x) {
+        tree_.insert(i, x);
+        record(trace::INSERT, i, x);
+    }
+
+    void remove(uint64_t i) {
+        tree_.remove(i);
+        record(trace::REMOVE, i, false);
+    }
+
+    void set(uint64_t i, bool x) {
+        tree_.set(i, x);
+        record(trace::SET, i, x);
+    }
+
+    void push_back(bool x) {
+        tree_.push_back(x);
+        record(trace::PUSH_BACK, 0, x);
+    }
+
+    /*
+     * group commit: writes the pending updates as one frame and waits until
+     * they are on disk
+     */
+    void sync() {
+        if (pending_ == 0) return;
+        uint32_t length = buffer_.size() - FRAME_HEADER;
+        uint32_t checksum =
+            log_file::hash(buffer_.data() + FRAME_HEADER, length);
+        memcpy(buffer_.data(), &length, sizeof(length));
+        memcpy(buffer_.data() + sizeof(length), &checksum, sizeof(checksum));
+        log_file::write_all(fd_, buffer_.data(), buffer_.size(),
+                            log_path(generation_));
+        if (fdatasync(fd_) != 0) log_file::fail(log_path(generation_));
+        buffer_.resize(FRAME_HEADER);
+        pending_ = 0;
+    }
+
+    /*
+     * Writes all bits to a new checkpoint, which atomically replaces the old
+     * one, and starts a new log generation. The old log is deleted.
+     */
+    void checkpoint() {
+        sync();
+        std::string tmp = dir_ + "/checkpoint.tmp";
+        int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) log_file::fail(tmp);
+        checkpoint_header h;
+        memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+        h.next_generation = generation_ + 1;
+        h.size = tree_.size();
+        h.checksum = 0;
+        log_file::write_all(fd, &h, sizeof(h), tmp);
+        std::vector<uint64_t> chunk(CHUNK_WORDS);
+        uint64_t checksum = log_file::HASH_SEED;
+        for (uint64_t i = 0; i < h.size; i += CHUNK_WORDS * 64) {
+            uint64_t j = std::min(h.size, i + CHUNK_WORDS * 64);
+            uint64_t words = (j - i + 63) / 64;
+            std::fill(chunk.begin(), chunk.begin() + words, 0);
+            tree_.extract(i, j, chunk.data());
+            checksum = log_file::hash(chunk.data(), words * 8, checksum);
+            log_file::write_all(fd, chunk.data(), words * 8, tmp);
+        }
+        h.checksum = checksum;
+        if (pwrite(fd, &h, sizeof(h), 0) != sizeof(h)) log_file::fail(tmp);
+        if (fsync(fd) != 0) log_file::fail(tmp);
+        close(fd);
+        if (rename(tmp.c_str(), checkpoint_path().c_str()) != 0) {
+            log_file::fail(tmp);
+        }
+        sync_dir();
+
+        close(fd_);
+        std::string old_log = log_path(generation_);
+        generation_++;
+        open_log(0);
+        unlink(old_log.c_str());
+        since_checkpoint_ = 0;
+    }
+
+    T& tree() { return tree_; }
+
+    uint64_t generation() const { return generation_; }
+
+    /*
+     * updates not yet synced
+     */
+    uint64_t pending() const { return pending_; }
+
+    std::string log_path(uint64_t generation) const {
+        return dir_ + "/wal." + std::to_string(generation);
+    }
+
+    std::string checkpoint_path() const { return dir_ + "/checkpoint"; }
+
+   private:
+    static constexpr char LOG_MAGIC[8] = {'B', 'V', 'W', 'A', 'L', 'O', 'G', '1'};
+    static constexpr char CHECKPOINT_MAGIC[8] = {'B', 'V', 'C', 'K', 'P',
+                                                 'N', 'T', '1'};
+    // length and checksum of a frame
+    static const uint64_t FRAME_HEADER = 8;
+    static const uint64_t CHUNK_WORDS = 1 << 16;
+
+    struct checkpoint_header {
+        char magic[8];
+        uint64_t next_generation;
+        uint64_t size;
+        uint64_t checksum;
+    };
+
+    void record(uint8_t op, uint64_t pos, bool x) {
+        trace::append(buffer_, op, pos, x);
+        if (++pending_ == group_size_) sync();
+        if (++since_checkpoint_ == checkpoint_interval_) checkpoint();
+    }
+
+    void sync_dir() {
+        int fd = open(dir_.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd < 0 || fsync(fd) != 0) log_file::fail(dir_);
+        close(fd);
+    }
+
+    void load_checkpoint() {
+        generation_ = 0;
+        std::string path = checkpoint_path();
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            if (errno == ENOENT) return;
+            log_file::fail(path);
+        }
+        checkpoint_header h;
+        if (!log_file::read_all(fd, &h, sizeof(h), 0) ||
+            memcmp(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic)) != 0) {
+            std::cerr << path << " is not a checkpoint" << std::endl;
+            exit(1);
+        }
+        std::vector<uint64_t> chunk(CHUNK_WORDS);
+        uint64_t checksum = log_file::HASH_SEED;
+        uint64_t offset = sizeof(h);
+        for (uint64_t i = 0; i < h.size; i += CHUNK_WORDS * 64) {
+            uint64_t bits = std::min(h.size - i, CHUNK_WORDS * 64);
+            uint64_t bytes = (bits + 63) / 64 * 8;
+            if (!log_file::read_all(fd, chunk.data(), bytes, offset)) {
+                std::cerr << path << " is truncated" << std::endl;
+                exit(1);
+            }
+            checksum = log_file::hash(chunk.data(), bytes, checksum);
+            tree_.append_words(chunk.data(), bits);
+            offset += bytes;
+        }
+        close(fd);
+        if (checksum != h.checksum) {
+            std::cerr << path << " is corrupted" << std::endl;
+            exit(1);
+        }
+        generation_ = h.next_generation;
+    }
+
+    /*
+     * Replays the valid frames of a log file, returns false if it does not
+     * exist. valid is set to the length of the file up to the last valid
+     * frame.
+     */
+    bool replay(const std::string& path, uint64_t& valid) {
+        valid = 0;
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        char magic[8];
+        if (!log_file::read_all(fd, magic, sizeof(magic), 0) ||
+            memcmp(magic, LOG_MAGIC, sizeof(magic)) != 0) {
+            close(fd);
+            return true;
+        }
+        valid = sizeof(magic);
+        std::vector<uint8_t> frame;
+        std::vector<uint64_t> bits(CHUNK_WORDS, 0);
+        while (true) {
+            uint32_t header[2];
+            if (!log_file::read_all(fd, header, sizeof(header), valid)) break;
+            if (header[0] == 0) break;
+            frame.resize(header[0]);
+            if (!log_file::read_all(fd, frame.data(), header[0],
+                                    valid + FRAME_HEADER) ||
+                uint32_t(log_file::hash(frame.data(), header[0])) !=
+                    header[1]) {
+                break;
+            }
+            apply_records(tree_, frame.data(), frame.data() + frame.size(),
+                          bits);
+            valid += FRAME_HEADER + header[0];
+        }
+        close(fd);
+        return true;
+    }
+
+    /*
+     * opens the current log generation for appending after its first valid
+     * bytes, creating it if valid is 0
+     */
+    void open_log(uint64_t valid) {
+        std::string path = log_path(generation_);
+        fd_ = open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+        if (fd_ < 0) log_file::fail(path);
+        if (valid == 0) {
+            if (ftruncate(fd_, 0) != 0) log_file::fail(path);
+            log_file::write_all(fd_, LOG_MAGIC, sizeof(LOG_MAGIC), path);
+            if (fsync(fd_) != 0) log_file::fail(path);
+            sync_dir();
+        } else {
+            // Drop a frame torn by a crash
+            if (ftruncate(fd_, valid) != 0) log_file::fail(path);
+            if (lseek(fd_, valid, SEEK_SET) < 0) log_file::fail(path);
+        }
+    }
+
+    T& tree_;
+    std::string dir_;
+    uint64_t group_size_;
+    uint64_t checkpoint_interval_;
+    uint64_t generation_ = 0;
+    int fd_ = -1;
+    // frame header followed by the records of the next group commit
+    std::vector<uint8_t> buffer_;
+    uint64_t pending_ = 0;
+    uint64_t since_checkpoint_ = 0;
+};
+}  // namespace dyn
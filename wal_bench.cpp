@@ -0,0 +1,128 @@
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include "bufferedbv.hpp"
+#include "bufferedtree.hpp"
+#include "wal.hpp"
+
+/*
+ * Cost of the write-ahead log of wal.hpp.
+ *
+ * A tree of n random bits is checkpointed, then the same random updates are
+ * applied to a plain tree and through the log for each group size, which
+ * gives the logging overhead per update. Recovery loads the checkpoint and
+ * replays the log of the last run, and is compared to rebuilding the tree by
+ * replaying all updates from the start.
+ *
+ * Usage: wal_bench [n] [updates] [directory]
+ */
+
+typedef dyn::buffered_tree<dyn::buffered_packed_vector<8>, 8192, 16> tree;
+
+template <class F>
+double seconds(F f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+struct update {
+    uint8_t op;
+    bool x;
+    uint64_t pos;
+};
+
+template <class T>
+void apply_updates(T& t, const std::vector<update>& updates) {
+    for (const auto& u : updates) {
+        if (u.op == 0) {
+            t.insert(u.pos, u.x);
+        } else if (u.op == 1) {
+            t.remove(u.pos);
+        } else {
+            t.set(u.pos, u.x);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    uint64_t n = 100000000;
+    uint64_t count = 1000000;
+    std::string dir = "wal_bench.log";
+    if (argc > 1) std::istringstream(argv[1]) >> n;
+    if (argc > 2) std::istringstream(argv[2]) >> count;
+    if (argc > 3) dir = argv[3];
+    if (n == 0) {
+        std::cerr << "Usage: " << argv[0] << " [n] [updates] [directory]"
+                  << std::endl;
+        return 1;
+    }
+    std::filesystem::remove_all(dir);
+
+    std::mt19937_64 gen(42);
+    std::vector<uint64_t> words((n + 63) / 64);
+    for (auto& w : words) w = gen();
+    std::vector<update> updates(count);
+    uint64_t size = n;
+    for (auto& u : updates) {
+        u.op = gen() % 3;
+        u.x = gen() % 2;
+        u.pos = gen() % (size + (u.op == 0));
+        size += u.op == 0;
+        size -= u.op == 1;
+    }
+
+    std::cout << "phase\tgroup\tseconds\tns/update" << std::endl;
+    auto report = [&](const char* phase, uint64_t group, double s, uint64_t ops) {
+        std::cout << phase << "\t" << group << "\t" << std::fixed
+                  << std::setprecision(3) << s << "\t" << std::setprecision(1)
+                  << s / ops * 1e9 << std::endl;
+    };
+
+    {
+        tree t;
+        t.append_words(words.data(), n);
+        report("plain", 0, seconds([&] { apply_updates(t, updates); }), count);
+    }
+    for (uint64_t group : {1, 64, 4096}) {
+        std::filesystem::remove_all(dir);
+        tree t;
+        dyn::wal<tree> log(t, dir, group);
+        // The bulk load bypasses the log, the checkpoint covers it
+        t.append_words(words.data(), n);
+        report("checkpoint", group, seconds([&] { log.checkpoint(); }), n);
+        // Unbatched fsyncs are slow, run a fraction of the updates
+        uint64_t ops = group == 1 ? std::min<uint64_t>(count, 10000) : count;
+        std::vector<update> part(updates.begin(), updates.begin() + ops);
+        report("logged", group, seconds([&] {
+                   apply_updates(log, part);
+                   log.sync();
+               }),
+               ops);
+    }
+    tree recovered;
+    double s = seconds([&] { dyn::wal<tree> log(recovered, dir); });
+    report("recover", 0, s, count);
+    tree rebuilt;
+    s = seconds([&] {
+        for (uint64_t i = 0; i < n; i++) {
+            rebuilt.push_back(words[i / 64] >> (i % 64) & 1);
+        }
+        apply_updates(rebuilt, updates);
+    });
+    report("replay-all", 0, s, n + count);
+    if (recovered.size() != rebuilt.size() ||
+        recovered.psum() != rebuilt.psum()) {
+        std::cerr << "Recovered tree differs from the replayed one" << std::endl;
+        return 1;
+    }
+    std::filesystem::remove_all(dir);
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bufferedbv.hpp"
+#include "bufferedtree.hpp"
+#include "dynamic.hpp"
+#include "spsi.hpp"
+#include "succinct_bitvector.hpp"
+#include "wavelet_matrix.hpp"
+
+/*
+ * Dynamic wavelet matrix with plain and buffered level bit vectors.
+ *
+ * n symbols of the given width are inserted at random positions, then
+ * random at, rank and select queries are run and finally n / 10 random
+ * symbols are removed. Symbols are the AND of two uniform values, so small
+ * symbols are more frequent than large ones. Times are microseconds per
+ * operation, space is bits per symbol.
+ */
+
+typedef dyn::wavelet_matrix<dyn::suc_bv> uwm;
+
+template <uint8_t k>
+using bwm = dyn::buffered_wavelet_matrix<k, 8192, 16>;
+
+template <uint8_t k>
+using twm = dyn::wavelet_matrix<
+    dyn::buffered_tree<dyn::buffered_packed_vector<k>, 8192, 16>>;
+
+static const uint64_t QUERIES = 100000;
+
+double micros_since(std::chrono::steady_clock::time_point start,
+                    uint64_t ops) {
+    std::chrono::duration<double, std::micro> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count() / ops;
+}
+
+template <class T>
+void bench(const char *name, uint64_t n, uint8_t width, uint64_t seed) {
+    std::mt19937_64 gen(seed);
+    uint64_t sigma = uint64_t(1) << width;
+    T wm(width);
+    uint64_t checksum = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < n; i++) {
+        wm.insert(gen() % (i + 1), (gen() % sigma) & (gen() % sigma));
+    }
+    double ins = micros_since(start, n);
+
+    std::vector<uint64_t> pos(QUERIES);
+    for (auto &p : pos) p = gen() % n;
+    start = std::chrono::steady_clock::now();
+    for (auto p : pos) checksum += wm.at(p);
+    double at = micros_since(start, QUERIES);
+
+    std::vector<uint64_t> syms(QUERIES);
+    for (uint64_t q = 0; q < QUERIES; q++) syms[q] = wm.at(pos[q]);
+    start = std::chrono::steady_clock::now();
+    for (uint64_t q = 0; q < QUERIES; q++) checksum += wm.rank(pos[q], syms[q]);
+    double rank = micros_since(start, QUERIES);
+
+    // Select an occurrence that is known to exist
+    std::vector<uint64_t> ranks(QUERIES);
+    for (uint64_t q = 0; q < QUERIES; q++) ranks[q] = wm.rank(pos[q], syms[q]);
+    start = std::chrono::steady_clock::now();
+    for (uint64_t q = 0; q < QUERIES; q++) {
+        checksum += wm.select(ranks[q], syms[q]);
+    }
+    double select = micros_since(start, QUERIES);
+
+    uint64_t bits = wm.bit_size();
+
+    uint64_t removals = n / 10;
+    start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < removals; i++) wm.remove(gen() % wm.size());
+    double rem = micros_since(start, removals);
+
+    std::cout << name << "\t" << std::fixed << std::setprecision(3) << ins
+              << "\t" << at << "\t" << rank << "\t" << select << "\t" << rem
+              << "\t" << std::setprecision(2) << double(bits) / n << std::endl;
+    std::cerr << name << " checksum: " << checksum << std::endl;
+}
+
+int main(int argc, char **argv) {
+    uint64_t n = 1000000;
+    uint32_t width = 8;
+    if (argc > 1) std::istringstream(argv[1]) >> n;
+    if (argc > 2) std::istringstream(argv[2]) >> width;
+    if (n == 0 || width == 0 || width > 32) {
+        std::cerr << "Usage: " << argv[0] << " [n] [width <= 32]" << std::endl;
+        return 1;
+    }
+    std::random_device rd;
+    uint64_t seed = rd();
+
+    std::cout << "type\tins\tat\trank\tselect\tremove\tbits/sym" << std::endl;
+    bench<uwm>("suc_bv", n, width, seed);
+    bench<bwm<4>>("bbv4", n, width, seed);
+    bench<bwm<8>>("bbv8", n, width, seed);
+    bench<bwm<16>>("bbv16", n, width, seed);
+    bench<twm<8>>("tree8", n, width, seed);
+    return 0;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include "bufferedbv.hpp"
+#include "spsi.hpp"
+#include "succinct_bitvector.hpp"
+
+namespace dyn {
+/*
+ * Dynamic wavelet matrix over symbols of width bits.
+ *
+ * Level l holds bit width - 1 - l of every symbol, with the symbols ordered
+ * by their higher bits: the symbols with a 0 at level l come first in level
+ * l + 1 (zeros_[l] of them), followed by the ones with a 1. Every operation
+ * touches each level once, so it costs width rank/select/insert/remove calls
+ * on the level bit vectors.
+ *
+ * bv_type can be any dynamic bit vector with the succinct_bitvector
+ * interface, e.g. dyn::suc_bv, a succinct_bitvector with buffered leaves
+ * (buffered_wavelet_matrix below) or dyn::buffered_tree.
+ */
+template <class bv_type>
+class wavelet_matrix {
+   public:
+    explicit wavelet_matrix(uint8_t width = 8)
+        : width_(width), levels_(width), zeros_(width, 0) {
+        assert(width > 0 && width <= 64);
+    }
+
+    uint64_t size() const { return size_; }
+
+    uint8_t width() const { return width_; }
+
+    uint64_t at(uint64_t i) const {
+        assert(i < size_);
+        uint64_t c = 0;
+        for (uint8_t l = 0; l < width_; l++) {
+            bool b = levels_[l].at(i);
+            c = (c << 1) | b;
+            i = next_position(l, i, b);
+        }
+        return c;
+    }
+
+    uint64_t operator[](uint64_t i) const { return at(i); }
+
+    /*
+     * number of occurrences of c in [0, i)
+     */
+    uint64_t rank(uint64_t i, uint64_t c) const {
+        assert(i <= size_);
+        uint64_t start = 0;
+        for (uint8_t l = 0; l < width_; l++) {
+            bool b = bit(c, l);
+            start = next_position(l, start, b);
+            i = next_position(l, i, b);
+        }
+        return i - start;
+    }
+
+    /*
+     * position of the (x + 1)-th occurrence of c
+     */
+    uint64_t select(uint64_t x, uint64_t c) const {
+        // Start of the range of c at every level, top down
+        std::vector<uint64_t> starts(width_ + 1);
+        for (uint8_t l = 0; l < width_; l++) {
+            starts[l + 1] = next_position(l, starts[l], bit(c, l));
+        }
+        uint64_t pos = starts[width_] + x;
+        for (uint8_t l = width_; l-- > 0;) {
+            if (bit(c, l)) {
+                pos = levels_[l].select(pos - zeros_[l]);
+            } else {
+                pos = levels_[l].select0(pos);
+            }
+        }
+        return pos;
+    }
+
+    void insert(uint64_t i, uint64_t c) {
+        assert(i <= size_);
+        assert(width_ == 64 || (c >> width_) == 0);
+        for (uint8_t l = 0; l < width_; l++) {
+            bool b = bit(c, l);
+            uint64_t next = next_position(l, i, b);
+            levels_[l].insert(i, b);
+            zeros_[l] += !b;
+            i = next;
+        }
+        size_++;
+    }
+
+    void push_back(uint64_t c) { insert(size_, c); }
+
+    void remove(uint64_t i) {
+        assert(i < size_);
+        for (uint8_t l = 0; l < width_; l++) {
+            bool b = levels_[l].at(i);
+            levels_[l].remove(i);
+            zeros_[l] -= !b;
+            i = next_position(l, i, b);
+        }
+        size_--;
+    }
+
+    uint64_t bit_size() const {
+        uint64_t bits = sizeof(wavelet_matrix) * 8 +
+                        zeros_.capacity() * sizeof(uint64_t) * 8;
+        for (const auto& level : levels_) bits += level.bit_size();
+        return bits;
+    }
+
+   private:
+    bool bit(uint64_t c, uint8_t l) const {
+        return (c >> (width_ - 1 - l)) & 1;
+    }
+
+    /*
+     * position in level l + 1 of the element at position i of level l, given
+     * its bit b at level l. Also maps range boundaries.
+     */
+    uint64_t next_position(uint8_t l, uint64_t i, bool b) const {
+        uint64_t ones = levels_[l].rank(i);
+        return b ? zeros_[l] + ones : i - ones;
+    }
+
+    uint8_t width_;
+    uint64_t size_ = 0;
+    std::vector<bv_type> levels_;
+    std::vector<uint64_t> zeros_;
+};
+
+/*
+ * Wavelet matrix whose levels are succinct bit vectors with buffered leaves.
+ */
+template <uint8_t buffer_size, uint32_t B_LEAF = 8192, uint32_t B = 16>
+using buffered_wavelet_matrix = wavelet_matrix<succinct_bitvector<
+    spsi<buffered_packed_vector<buffer_size>, B_LEAF, B>>>;
+}  // namespace dyn